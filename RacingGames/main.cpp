@@ -1,731 +1,8349 @@
-#include <glad/glad.h>
-
-#include <GLFW/glfw3.h>
-
-#include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtc/type_ptr.hpp>
-
-#include <learnopengl/camera.h>
-#include <learnopengl/filesystem.h>
-#include <learnopengl/model.h>
-#include <learnopengl/shader_m.h>
-
-#include <my/car.h>
-#include <my/fixed_camera.h>
-
-#include <iostream>
-
-#pragma comment(lib, "glfw3.lib")
-#pragma comment(lib, "assimp.lib")
-
-
-// function declaration
-GLFWwindow* windowInit();
-bool init();
-void depthMapFBOInit();
-void skyboxInit();
-
-void setDeltaTime();
-void changeLightPosAsTime();
-void updateFixedCamera();
-
-// use "&" for better performance
-void renderLight(Shader& shader);
-void renderCarAndCamera(Model& carModel, Model& cameraModel, Shader& shader);
-void renderCar(Model& model, glm::mat4 modelMatrix, Shader& shader);
-void renderCamera(Model& model, glm::mat4 modelMatrix, Shader& shader);
-void renderStopSign(Model& model, Shader& shader);
-void renderRaceTrack(Model& model, Shader& shader);
-void renderSkyBox(Shader& shader);
-
-void framebuffer_size_callback(GLFWwindow* window, int width, int height);
-void mouse_callback(GLFWwindow* window, double xpos, double ypos);
-void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
-void handleKeyInput(GLFWwindow* window);
-void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
-
-unsigned int loadCubemap(vector<std::string> faces);
-
-// ------------------------------------------
-// global variable
-// ------------------------------------------
-
-// window size
-const unsigned int SCR_WIDTH = 1280;
-const unsigned int SCR_HEIGHT = 720;
-
-// Window resolution when rendering shadows (affects the jaggedness of shadows)
-const unsigned int SHADOW_WIDTH = 1024 * 10;
-const unsigned int SHADOW_HEIGHT = 1024 * 10;
-
-// Whether it is in wireframe mode
-bool isPolygonMode = false;
-
-// Y-axis unit vector of the world coordinate system
-glm::vec3 WORLD_UP(0.0f, 1.0f, 0.0f);
-
-// car
-Car car(glm::vec3(0.0f, 0.05f, 0.0f));
-
-// camera
-glm::vec3 cameraPos(0.0f, 2.0f, 5.0f);
-Camera camera(cameraPos);
-FixedCamera fixedCamera(cameraPos);
-bool isCameraFixed = false;
-
-// Lighting related properties
-glm::vec3 lightPos(-1.0f, 1.0f, -1.0f);
-glm::vec3 lightDirection = glm::normalize(lightPos);
-glm::mat4 lightSpaceMatrix;
-
-// ID of the depth map
-unsigned int depthMap;
-unsigned int depthMapFBO;
-
-// Set the mouse to the center of the screen
-float lastX = SCR_WIDTH / 2.0f;
-float lastY = SCR_HEIGHT / 2.0f;
-bool firstMouse = true;
-
-// timing is used to balance the speed changes caused by different computer rendering levels
-float deltaTime = 0.0f;
-float lastFrame = 0.0f;
-
-// skybox
-unsigned int cubemapTexture;
-unsigned int skyboxVAO, skyboxVBO;
-
-
-// skybox vertex data
-const float skyboxVertices[] = {
-    // positions
-    -1.0f, 1.0f, -1.0f,
-    -1.0f, -1.0f, -1.0f,
-    1.0f, -1.0f, -1.0f,
-    1.0f, -1.0f, -1.0f,
-    1.0f, 1.0f, -1.0f,
-    -1.0f, 1.0f, -1.0f,
-
-    -1.0f, -1.0f, 1.0f,
-    -1.0f, -1.0f, -1.0f,
-    -1.0f, 1.0f, -1.0f,
-    -1.0f, 1.0f, -1.0f,
-    -1.0f, 1.0f, 1.0f,
-    -1.0f, -1.0f, 1.0f,
-
-    1.0f, -1.0f, -1.0f,
-    1.0f, -1.0f, 1.0f,
-    1.0f, 1.0f, 1.0f,
-    1.0f, 1.0f, 1.0f,
-    1.0f, 1.0f, -1.0f,
-    1.0f, -1.0f, -1.0f,
-
-    -1.0f, -1.0f, 1.0f,
-    -1.0f, 1.0f, 1.0f,
-    1.0f, 1.0f, 1.0f,
-    1.0f, 1.0f, 1.0f,
-    1.0f, -1.0f, 1.0f,
-    -1.0f, -1.0f, 1.0f,
-
-    -1.0f, 1.0f, -1.0f,
-    1.0f, 1.0f, -1.0f,
-    1.0f, 1.0f, 1.0f,
-    1.0f, 1.0f, 1.0f,
-    -1.0f, 1.0f, 1.0f,
-    -1.0f, 1.0f, -1.0f,
-
-    -1.0f, -1.0f, -1.0f,
-    -1.0f, -1.0f, 1.0f,
-    1.0f, -1.0f, -1.0f,
-    1.0f, -1.0f, -1.0f,
-    -1.0f, -1.0f, 1.0f,
-    1.0f, -1.0f, 1.0f
-};
-
-// face data of the skybox
-const vector<std::string> faces{
-    FileSystem::getPath("asset/textures/skybox/right.tga"),
-    FileSystem::getPath("asset/textures/skybox/left.tga"),
-    FileSystem::getPath("asset/textures/skybox/top.tga"),
-    FileSystem::getPath("asset/textures/skybox/bottom.tga"),
-    FileSystem::getPath("asset/textures/skybox/front.tga"),
-    FileSystem::getPath("asset/textures/skybox/back.tga")
-};
-
-// ------------------------------------------
-//main function
-// ------------------------------------------
-
-int main()
-{
-    // ------------------------------
-    //initialization
-    // ------------------------------
-
-    // window initialization
-    GLFWwindow* window = windowInit();
-
-    //OpenGL initialization
-    bool isInit = init();
-    if (window == NULL || !isInit) {
-        return -1;
-    }
-    // FBO configuration of Depth Map
-    depthMapFBOInit();
-    // skybox configuration
-    skyboxInit();
-
-    // ------------------------------
-     // build and compile the shader
-     // ------------------------------
-
-     // shader that adds lighting and shadows to all objects
-    Shader shader("shader/light_and_shadow.vs", "shader/light_and_shadow.fs");
-    // A shader that generates depth information from the angle of the sun's parallel light
-    Shader depthShader("shader/shadow_mapping_depth.vs", "shader/shadow_mapping_depth.fs");
-    // skybox shader
-    Shader skyboxShader("shader/skybox.vs", "shader/skybox.fs");
-
-    // ------------------------------
-    // model loading
-    // -------------------------------
-
-    // car model
-    Model carModel(FileSystem::getPath("asset/models/obj/Lamborghini/Lamborghini.obj"));
-
-    // camera model
-    Model cameraModel(FileSystem::getPath("asset/models/obj/camera-cube/camera-cube.obj"));
-
-    // track model
-    Model raceTrackModel(FileSystem::getPath("asset/models/obj/race-track/race-track.obj"));
-
-    // STOP card model
-    Model stopSignModel(FileSystem::getPath("asset/models/obj/StopSign/StopSign.obj"));
-
-    // ---------------------------------
-      // shader texture configuration
-      // ---------------------------------
-
-    shader.use();
-    shader.setInt("diffuseTexture", 0);
-    shader.setInt("shadowMap", 15); // The 15 here refers to "GL_TEXTURE15", which needs to correspond to the following
-
-    skyboxShader.use();
-    skyboxShader.setInt("skybox", 0);
-    // ---------------------------------
-    // loop rendering
-    // ---------------------------------
-
-
-    while (!glfwWindowShouldClose(window)) {
-
-        // Calculate the length of a frame to make the frame drawing speed even
-        setDeltaTime();
-        // Change light source position over time
-                // changeLightPosAsTime();
-
-                // listen for keystrokes
-        handleKeyInput(window);
-        // render background
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // ---------------------------------
-        // Render to get the depth information of the scene
-        // ---------------------------------
-
-        // Define the view volume of the light source, that is, the orthographic projection matrix of the shadow generation range
-        glm::mat4 lightProjection = glm::ortho(
-            -200.0f, 200.0f,
-            -200.0f, 200.0f,
-            -200.0f, 200.0f);
-
-        // TODO lightPos moves with the camera position, so that shadows are always generated around the camera
-        glm::mat4 lightView = glm::lookAt(lightPos, glm::vec3(0.0f), WORLD_UP);
-        lightSpaceMatrix = lightProjection * lightView;
-
-        // render the entire scene from the light source
-        depthShader.use();
-        depthShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-
-        // Resize the viewport for depth rendering
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        // Use the depth shader to render the generated scene
-        glClear(GL_DEPTH_BUFFER_BIT);
-        renderCarAndCamera(carModel, cameraModel, depthShader);
-        renderRaceTrack(raceTrackModel, depthShader);
-        renderStopSign(stopSignModel, depthShader);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        // restore viewport
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // ---------------------------------
-         // model rendering
-         // ---------------------------------
-
-        shader.use();
-
-        // Set lighting related properties
-        renderLight(shader);
-
-        car.UpdateDelayYaw();
-        car.UpdateDelayPosition();
-
-
-        // When switching to camera fixed, you need to modify the camera state every frame
-        if (isCameraFixed) {
-            updateFixedCamera();
-        }
-
-        // Use shader to render car and Camera (hierarchical model)
-        renderCarAndCamera(carModel, cameraModel, shader);
-
-        // Render the Stop card
-        renderStopSign(stopSignModel, shader);
-
-
-        // render the track
-        renderRaceTrack(raceTrackModel, shader);
-
-        // --------------
-        // Finally render the skybox
-
-        // Change the depth test to infinity when depth equals 1.0
-        glDepthFunc(GL_LEQUAL);
-        skyboxShader.use();
-        renderSkyBox(skyboxShader);
-        // restore depth test
-        glDepthFunc(GL_LESS);
-
-        // swap buffers and investigate IO events (key pressed, mouse movement, etc.)
-        glfwSwapBuffers(window);
-
-        // poll for events
-        glfwPollEvents();
-    }
-
-    // close glfw
-    glfwTerminate();
-    return 0;
-}
-
-// ------------------------------------------------------
-// other functions
-// ------------------------------------------------------
-
-
-// ---------------------------------
-// initialize
-// ---------------------------------
-
-GLFWwindow* windowInit()
-{
-    // initialize configuration
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-
-    // create window
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, u8"Race car game", NULL, NULL);
-    if (window == NULL) {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        system("pause");
-        return NULL;
-    }
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
-
-    // Make GLFW capture the user's mouse
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-
-    return window;
-}
-
-bool init()
-{
-    // Load all OpenGL function pointers
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        system("pause");
-        return false;
-    }
-
-    // Configure global openGL state
-    glEnable(GL_DEPTH_TEST);
-
-    return true;
-}
-
-
-// depth map configuration
-void depthMapFBOInit()
-{
-    glGenFramebuffers(1, &depthMapFBO);
-
-    // create depth texture
-    glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-    // Use the generated depth texture as the depth buffer of the framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-// skybox configuration
-void skyboxInit()
-{
-    // skybox VAO
-    glGenVertexArrays(1, &skyboxVAO);
-    glGenBuffers(1, &skyboxVBO);
-    glBindVertexArray(skyboxVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-
-
-    // texture loading
-    cubemapTexture = loadCubemap(faces);
-}
-
-
-// ---------------------------------
-// time related function
-// ---------------------------------
-
-// Calculate the duration of a frame
-void setDeltaTime()
-{
-    float currentFrame = glfwGetTime();
-    deltaTime = currentFrame - lastFrame;
-    lastFrame = currentFrame;
-}
-
-void changeLightPosAsTime()
-{
-    float freq = 0.1;
-    lightPos.x = 1.0 + cos(glfwGetTime() * freq) * -0.5f;
-    lightPos.z = -1.0 + sin(glfwGetTime() * freq) * 0.5f;
-    lightPos.y = 1.0 + cos(glfwGetTime() * freq) * 0.5f;
-    lightDirection = glm::normalize(lightPos);
-}
-
-
-// ---------------------------------
-// camera position update
-// ---------------------------------
-
-void updateFixedCamera()
-{
-    // Automatically gradually restore Zoom to default
-    camera.ZoomRecover();
-
-    // Process the vector coordinates of the camera relative to the vehicle coordinate system and convert it to a vector in the world coordinate system
-    float angle = glm::radians(-car.getMidValYaw());
-    glm::mat4 rotateMatrix(
-        cos(angle), 0.0, sin(angle), 0.0,
-        0.0, 1.0, 0.0, 0.0,
-        -sin(angle), 0.0, cos(angle), 0.0,
-        0.0, 0.0, 0.0, 1.0);
-    glm::vec3 rotatedPosition = glm::vec3(rotateMatrix * glm::vec4(fixedCamera.getPosition(), 1.0));
-
-    camera.FixView(rotatedPosition + car.getMidValPosition(), fixedCamera.getYaw() + car.getMidValYaw());
-}
-// ---------------------------------
-// render function
-// ---------------------------------
-
-// Set lighting related properties
-void renderLight(Shader& shader)
-{
-    shader.setVec3("viewPos", camera.Position);
-    shader.setVec3("lightDirection", lightDirection);
-    shader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-
-    glActiveTexture(GL_TEXTURE15);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-}
-
-void renderCarAndCamera(Model& carModel, Model& cameraModel, Shader& shader)
-{
-    // view transition
-    glm::mat4 viewMatrix = camera.GetViewMatrix();
-    shader.setMat4("view", viewMatrix);
-    // Projection transformation
-    glm::mat4 projMatrix = camera.GetProjMatrix((float)SCR_WIDTH / (float)SCR_HEIGHT);
-    shader.setMat4("projection", projMatrix);
-
-    // -------
-    // Hierarchical modeling
-
-    // model conversion
-    glm::mat4 modelMatrix = glm::mat4(1.0f);
-    modelMatrix = glm::translate(modelMatrix, car.getMidValPosition());
-    modelMatrix = glm::rotate(modelMatrix, glm::radians(car.getDelayYaw() / 2), WORLD_UP);
-
-    // render the car
-    renderCar(carModel, modelMatrix, shader);
-
-    // Since mat4 is passed by value as a function parameter, there is no need to back up modelMatrix
-
-    // render camera
-    renderCamera(cameraModel, modelMatrix, shader);
-}
-
-// render the car
-void renderCar(Model& model, glm::mat4 modelMatrix, Shader& shader)
-{
-    modelMatrix = glm::rotate(modelMatrix, glm::radians(car.getYaw() - car.getDelayYaw() / 2), WORLD_UP);
-    // offset the original rotation of the model
-    modelMatrix = glm::rotate(modelMatrix, glm::radians(-90.0f), WORLD_UP);
-    // resize the model
-    modelMatrix = glm::scale(modelMatrix, glm::vec3(0.004f, 0.004f, 0.004f));
-
-    // apply transformation matrix
-    shader.setMat4("model", modelMatrix);
-
-    model.Draw(shader);
-}
-
-void renderCamera(Model& model, glm::mat4 modelMatrix, Shader& shader)
-{
-    modelMatrix = glm::rotate(modelMatrix, glm::radians(fixedCamera.getYaw() + car.getYaw() / 2), WORLD_UP);
-    modelMatrix = glm::translate(modelMatrix, cameraPos);
-    modelMatrix = glm::scale(modelMatrix, glm::vec3(0.01f, 0.01f, 0.01f));
-
-
-    // apply transformation matrix
-    shader.setMat4("model", modelMatrix);
-
-    model.Draw(shader);
-}
-
-void renderStopSign(Model& model, Shader& shader)
-{
-    // view transition
-    glm::mat4 viewMatrix = camera.GetViewMatrix();
-    shader.setMat4("view", viewMatrix);
-
-    // model conversion
-    glm::mat4 modelMatrix = glm::mat4(1.0f);
-    modelMatrix = glm::translate(modelMatrix, glm::vec3(3.0f, 1.5f, -4.0f));
-    modelMatrix = glm::rotate(modelMatrix, glm::radians(-120.0f), WORLD_UP);
-    shader.setMat4("model", modelMatrix);
-    // Projection transformation
-    glm::mat4 projMatrix = camera.GetProjMatrix((float)SCR_WIDTH / (float)SCR_HEIGHT);
-    shader.setMat4("projection", projMatrix);
-
-    model.Draw(shader);
-}
-
-void renderRaceTrack(Model& model, Shader& shader)
-{
-    // view transition
-    glm::mat4 viewMatrix = camera.GetViewMatrix();
-    shader.setMat4("view", viewMatrix);
-    // model conversion
-    glm::mat4 modelMatrix = glm::mat4(1.0f);
-    shader.setMat4("model", modelMatrix);
-   
-    // Projection transformation
-    glm::mat4 projMatrix = camera.GetProjMatrix((float)SCR_WIDTH / (float)SCR_HEIGHT);
-    shader.setMat4("projection", projMatrix);
-
-    model.Draw(shader);
-}
-
-void renderSkyBox(Shader& shader)
-{
-    // viewMatrix is ​​constructed to remove the movement of the camera
-    glm::mat4 viewMatrix = glm::mat4(glm::mat3(camera.GetViewMatrix()));
-
-    // projection
-    glm::mat4 projMatrix = camera.GetProjMatrix((float)SCR_WIDTH / (float)SCR_HEIGHT);
-
-    shader.setMat4("view", viewMatrix);
-    shader.setMat4("projection", projMatrix);
-
-    glBindVertexArray(skyboxVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
-}
-
-// ---------------------------------
-// keyboard/mouse monitor
-// ---------------------------------
-
-void handleKeyInput(GLFWwindow* window)
-{
-    // esc exit
-// Camera WSAD front, back, left and right Space up and left Ctrl down
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
-
-    if (!isCameraFixed) {
-
-        // Camera WSAD front, back, left and right Space up and left Ctrl down
-        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-            camera.ProcessKeyboard(FORWARD, deltaTime);
-        if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-            camera.ProcessKeyboard(BACKWARD, deltaTime);
-        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-            camera.ProcessKeyboard(LEFT, deltaTime);
-        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-            camera.ProcessKeyboard(RIGHT, deltaTime);
-        if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-            camera.ProcessKeyboard(UP, deltaTime);
-        if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
-            camera.ProcessKeyboard(DOWN, deltaTime);
-    }
-    else {
-        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-            fixedCamera.ProcessKeyboard(CAMERA_LEFT, deltaTime);
-        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-            fixedCamera.ProcessKeyboard(CAMERA_RIGHT, deltaTime);
-    }
-
-    // cart move
-    if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
-        car.ProcessKeyboard(CAR_FORWARD, deltaTime);
-
-        // You can only rotate left and right when the car is moving
-        if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
-            car.ProcessKeyboard(CAR_LEFT, deltaTime);
-        if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
-            car.ProcessKeyboard(CAR_RIGHT, deltaTime);
-
-        if (isCameraFixed)
-            camera.ZoomOut();
-    }
-    if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
-        car.ProcessKeyboard(CAR_BACKWARD, deltaTime);
-
-
-        // You can only rotate left and right when the car is moving, functions same as above
-        if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
-            car.ProcessKeyboard(CAR_LEFT, deltaTime);
-        if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
-            car.ProcessKeyboard(CAR_RIGHT, deltaTime);
-
-        if (isCameraFixed)
-            camera.ZoomIn();
-    }
-
-    // Callback to monitor the key press (a key will only trigger an event once)
-    glfwSetKeyCallback(window, key_callback);
-}
-
-
-// key callback function, so that only one event is triggered per key press
-void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
-{
-    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
-        isCameraFixed = !isCameraFixed;
-        string info = isCameraFixed ? "ÇÐ»»Îª¹Ì¶¨ÊÓ½Ç" : "ÇÐ»»Îª×ÔÓÉÊÓ½Ç";
-        std::cout << "[CAMERA]" << info << std::endl;
-    }
-    if (key == GLFW_KEY_X && action == GLFW_PRESS) {
-        isPolygonMode = !isPolygonMode;
-        if (isPolygonMode) {
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        }
-        else {
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        }
-        string info = isPolygonMode ? "ÇÐ»»ÎªÏß¿òÍ¼äÖÈ¾Ä£Ê½" : "ÇÐ»»ÎªÕý³£äÖÈ¾Ä£Ê½";
-        std::cout << "[POLYGON_MODE]" << info << std::endl;
-    }
-}
-
-// mouse movement
-void mouse_callback(GLFWwindow* window, double xpos, double ypos)
-{
-    if (!isCameraFixed) {
-        if (firstMouse) {
-            lastX = xpos;
-            lastY = ypos;
-            firstMouse = false;
-        }
-
-        float xoffset = xpos - lastX;
-        float yoffset = lastY - ypos; // Coordinates are flipped to correspond to the coordinate system
-
-        lastX = xpos;
-        lastY = ypos;
-
-        camera.ProcessMouseMovement(xoffset, yoffset);
-    }
-}
-
-// mouse wheel
-void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
-{
-    camera.ProcessMouseScroll(yoffset);
-}
-
-// ---------------------------------
-// window related functions
-// ---------------------------------
-
-// Callback function for resizing the window
-void framebuffer_size_callback(GLFWwindow* window, int width, int height)
-{
-
-    // Make sure the window matches the new window size
-    glViewport(0, 0, width, height);
-}
-
-
-// ---------------------------------
-// load related functions
-// ---------------------------------
-
-// Load six textures as a cubemap texture
-unsigned int loadCubemap(vector<std::string> faces)
-{
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, nrChannels;
-    for (unsigned int i = 0; i < faces.size(); i++) {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data) {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        }
-        else {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
-    }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-    return textureID;
-}
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <learnopengl/camera.h>
+#include <learnopengl/filesystem.h>
+#include <learnopengl/model.h>
+
+#include <my/car.h>
+#include <my/fixed_camera.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+// memory mapping of the model cache
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 1 ms sleep resolution for the frame pacer
+#ifdef _WIN32
+#include <mmsystem.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+// SIMD paths of the track collision and the traffic fleet; AVX2 only when the compiler targets it (/arch:AVX2, -mavx2).
+// They use no fused multiply-adds, and the scalar code must not get them either (-ffp-contract=off with -mfma)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define USE_AVX2
+#include <immintrin.h>
+#endif
+
+// glad only declares the entry points it was generated for. The indirect batches need GL 4.3, or
+// GL_ARB_multi_draw_indirect with GL_ARB_base_instance; the shader binary cache GL 4.1 or GL_ARB_get_program_binary.
+// A glad generated for GL 3.3 alone leaves both out, which init reports; regenerate it with those extensions
+#if defined(GL_VERSION_4_3) || (defined(GL_ARB_multi_draw_indirect) && defined(GL_ARB_base_instance))
+#define USE_MULTI_DRAW_INDIRECT
+#endif
+#if defined(GL_VERSION_4_1) || defined(GL_ARB_get_program_binary)
+#define USE_PROGRAM_BINARY
+#endif
+
+#pragma comment(lib, "glfw3.lib")
+#pragma comment(lib, "assimp.lib")
+
+
+// ------------------------------------------
+// type definition
+// ------------------------------------------
+
+// Bits of the keys that drive the simulation, sampled once per frame and applied to every tick of that frame
+enum SimInputKey {
+    INPUT_CAMERA_FORWARD = 1 << 0,
+    INPUT_CAMERA_BACKWARD = 1 << 1,
+    INPUT_CAMERA_LEFT = 1 << 2,
+    INPUT_CAMERA_RIGHT = 1 << 3,
+    INPUT_CAMERA_UP = 1 << 4,
+    INPUT_CAMERA_DOWN = 1 << 5,
+    INPUT_CAR_FORWARD = 1 << 6,
+    INPUT_CAR_BACKWARD = 1 << 7,
+    INPUT_CAR_LEFT = 1 << 8,
+    INPUT_CAR_RIGHT = 1 << 9
+};
+
+// Kinds of events in the input log
+enum InputEventType : unsigned char {
+    // the set of pressed keys changed
+    INPUT_EVENT_KEYS,
+    // mouse movement, offset in x and y
+    INPUT_EVENT_MOUSE,
+    // mouse wheel, offset in y
+    INPUT_EVENT_SCROLL,
+    // "C" switched between the free and the fixed camera
+    INPUT_EVENT_TOGGLE_CAMERA,
+    // end of the log, the tick is the number of recorded ticks
+    INPUT_EVENT_END
+};
+
+// One input event and the simulation tick it is applied on
+struct InputEvent {
+    InputEventType type = INPUT_EVENT_KEYS;
+    long long tick = 0;
+    // seconds since the start of the session
+    float time = 0.0f;
+    unsigned int keys = 0;
+    float x = 0.0f;
+    float y = 0.0f;
+};
+
+// Compact binary log of the input events: recorded live, replayed headless or rendered
+class InputLog {
+public:
+    bool startRecording(const std::string& path, bool isCameraFixed);
+    bool startReplay(const std::string& path, bool& isCameraFixed);
+    void record(const InputEvent& event);
+    void finish(long long tick);
+
+    // Append the replayed events of the tick, in recorded order
+    void eventsForTick(long long tick, std::vector<InputEvent>& tickEvents);
+
+    bool isRecording() const { return recording; }
+    bool isReplaying() const { return replaying; }
+    long long getEndTick() const { return endTick; }
+
+private:
+    static const unsigned char VERSION = 1;
+
+    std::ofstream out;
+    bool recording = false;
+    long long lastTick = 0;
+    long long lastMicroseconds = 0;
+
+    bool replaying = false;
+    std::vector<InputEvent> events;
+    size_t nextEvent = 0;
+    long long endTick = 0;
+};
+
+// Input of one simulation tick
+struct SimInput {
+    unsigned int keys = 0;
+
+    bool isDown(SimInputKey key) const { return (keys & key) != 0; }
+};
+
+// Handle of a resource of the resource manager, 0 is none
+typedef unsigned int ResourceHandle;
+
+// What the memory of a resource is used for; the resource manager reports every category separately
+enum MemoryCategory {
+    MEMORY_TEXTURE,
+    MEMORY_MESH,
+    MEMORY_SKYBOX,
+    MEMORY_SHADOW_MAP,
+    MEMORY_RENDER_TARGET,
+    MEMORY_COLLISION,
+    MEMORY_CATEGORY_COUNT
+};
+
+// Where a resource is: the layer of a texture in the texture array, or the first vertex (first) and index
+// (second) of a mesh in the geometry arena
+struct ResourceLocation {
+    unsigned int first = 0;
+    unsigned int second = 0;
+};
+
+// One cascade of the shadow map, covering one slice of the view frustum
+struct ShadowCascade {
+    unsigned int depthMap = 0;
+    unsigned int depthMapFBO = 0;
+    unsigned int resolution = 0;
+    // both depth maps and their framebuffers, in the resource manager
+    ResourceHandle resource = 0;
+    // view space distance at which this cascade ends
+    float splitFar = 0.0f;
+    // half size of the cascade in light space
+    float radius = 0.0f;
+    glm::mat4 lightSpaceMatrix = glm::mat4(1.0f);
+
+    // Static layer: the track and the props, rendered over a larger area than the cascade and kept
+    // until the cascade leaves that area, the light moves or the static geometry changes
+    unsigned int staticDepthMap = 0;
+    unsigned int staticDepthMapFBO = 0;
+    unsigned int staticResolution = 0;
+    bool isStaticDirty = true;
+    // light space center (x, y) and depth of the static layer, and the radius of the cascade it was rendered for
+    glm::vec3 staticCenter = glm::vec3(0.0f);
+    float staticRadius = 0.0f;
+    glm::mat4 staticLightSpaceMatrix = glm::mat4(1.0f);
+    // position of the cascade inside the static layer, in texels
+    int staticOffsetX = 0;
+    int staticOffsetY = 0;
+};
+
+// Binding point of the uniform block "FrameConstants" shared by all shaders
+const unsigned int FRAME_CONSTANTS_BINDING = 0;
+
+// Per-frame constants, std140 layout of the uniform block "FrameConstants", which the shaders in shader/ declare the same way
+struct FrameConstants {
+    glm::mat4 view;
+    glm::mat4 projection;
+    // view matrix without the movement of the camera, for the skybox
+    glm::mat4 skyboxView;
+    glm::mat4 lightSpaceMatrices[4];
+    // far distance of cascade 0 to 3 in x, y, z, w
+    glm::vec4 cascadePlaneDistances;
+    glm::vec4 viewPos;
+    glm::vec4 lightDirection;
+    // cluster of a fragment: gl_FragCoord.xy times x, y, and log(view depth) times z plus w
+    glm::vec4 clusterScale;
+};
+static_assert(sizeof(FrameConstants) == 7 * 64 + 4 * 16, "FrameConstants must match the std140 layout");
+
+// A point light, or a spot light when spotCosOuter is above -1. It fades to nothing at "range" from its position,
+// and a spot light from spotCosInner to spotCosOuter of the angle to its direction
+struct Light {
+    glm::vec3 position;
+    float range;
+    glm::vec3 color;
+    float spotCosOuter;
+    glm::vec3 direction;
+    float spotCosInner;
+};
+static_assert(sizeof(Light) == 48, "Light is uploaded as three RGBA32F texels");
+
+// A shader that uses the per-frame uniform block, with the locations of its per-pass uniforms looked up once.
+// The model matrix is not a uniform: it comes from the instance buffer, attribute locations 7 to 10.
+// The sources get a "#define" line per define after their "#version" line, and the linked program is kept
+// in the program binary cache
+class ShaderProgram {
+public:
+    unsigned int ID = 0;
+    GLint lightSpaceMatrixLocation = -1;
+
+    ShaderProgram() = default;
+    ShaderProgram(const ShaderProgram&) = delete;
+    ShaderProgram& operator=(const ShaderProgram&) = delete;
+    ~ShaderProgram() { if (ID != 0) glDeleteProgram(ID); }
+
+    bool load(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines);
+
+    void use() const { glUseProgram(ID); }
+    void setInt(const std::string& name, int value) const { glUniform1i(glGetUniformLocation(ID, name.c_str()), value); }
+    void setLightSpaceMatrix(const glm::mat4& lightSpaceMatrix) const
+    {
+        glUniformMatrix4fv(lightSpaceMatrixLocation, 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+    }
+
+private:
+    bool compile(const std::string& vertexSource, const std::string& fragmentSource);
+    bool loadBinary(const std::string& cachePath);
+    void saveBinary(const std::string& cachePath) const;
+};
+
+// Every permutation of the shaders that was asked for, compiled (or read from the cache) on first use
+class ShaderLibrary {
+public:
+    // "defines" like { "SHADOW_FILTER_SIZE 3" }; nullptr when the program cannot be built
+    ShaderProgram* get(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines);
+    // delete every program, while the context is still there
+    void clear() { programs.clear(); }
+
+private:
+    std::map<std::string, std::unique_ptr<ShaderProgram>> programs;
+};
+
+// Passes of a frame measured by the profiler
+enum ProfilePass {
+    PROFILE_INPUT,
+    PROFILE_UPLOAD,
+    PROFILE_SHADOW,
+    PROFILE_MAIN,
+    PROFILE_SKYBOX,
+    PROFILE_SWAP,
+    PROFILE_PASS_COUNT
+};
+
+const char* const PROFILE_PASS_NAMES[PROFILE_PASS_COUNT] = { "input", "upload", "shadow", "main", "skybox", "swap" };
+
+// CPU and GPU time of every pass of one frame, in milliseconds
+struct FrameTiming {
+    long long frame = 0;
+    double frameMs = 0.0;
+    double cpuMs[PROFILE_PASS_COUNT] = {};
+    // negative when the GPU result was not available
+    double gpuMs[PROFILE_PASS_COUNT] = {};
+};
+
+// Distribution of a series of timings
+struct TimingSummary {
+    double average = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+// Fixed size ring buffer with a single writer; readers never block the writer, the oldest entries are overwritten
+template <typename T, size_t CAPACITY>
+class RingBuffer {
+public:
+    void push(const T& value)
+    {
+        size_t index = writeIndex.load(std::memory_order_relaxed);
+        items[index % CAPACITY] = value;
+        writeIndex.store(index + 1, std::memory_order_release);
+    }
+
+    size_t size() const
+    {
+        size_t count = writeIndex.load(std::memory_order_acquire);
+        return count < CAPACITY ? count : CAPACITY;
+    }
+
+    // i = 0 is the oldest entry still in the buffer
+    const T& at(size_t i) const
+    {
+        size_t count = writeIndex.load(std::memory_order_acquire);
+        size_t first = count < CAPACITY ? 0 : count - CAPACITY;
+        return items[(first + i) % CAPACITY];
+    }
+
+private:
+    T items[CAPACITY];
+    std::atomic<size_t> writeIndex{ 0 };
+};
+
+// Number of frames kept by the profiler
+const size_t PROFILE_HISTORY_FRAMES = 4096;
+
+// Measures the passes of every frame with CPU timers and GL timer queries
+class FrameProfiler {
+public:
+    void init();
+    void beginFrame();
+    void beginPass(ProfilePass pass);
+    void endPass(ProfilePass pass);
+    void endFrame();
+
+    void finish();
+
+    void recordStartup(const std::string& name, double ms);
+    void drawOverlay(int width, int height) const;
+    std::string summary(size_t frames) const;
+    bool writeCsv(const std::string& path) const;
+    bool writeJson(const std::string& path) const;
+
+    const RingBuffer<FrameTiming, PROFILE_HISTORY_FRAMES>& getHistory() const { return history; }
+    long long getFrame() const { return frame; }
+    void writeBenchmark(std::ostream& out, long long firstFrame) const;
+
+private:
+    // Queries are read back QUERY_LATENCY frames later, so reading them never waits for the GPU
+    static const int QUERY_LATENCY = 3;
+
+    unsigned int queries[QUERY_LATENCY][PROFILE_PASS_COUNT] = {};
+    bool isQueryIssued[QUERY_LATENCY][PROFILE_PASS_COUNT] = {};
+    FrameTiming pending[QUERY_LATENCY];
+    std::chrono::steady_clock::time_point frameStart;
+    std::chrono::steady_clock::time_point passStart[PROFILE_PASS_COUNT];
+    long long frame = 0;
+
+    RingBuffer<FrameTiming, PROFILE_HISTORY_FRAMES> history;
+    std::vector<std::pair<std::string, double>> startupTimings;
+
+    void collect(int slot);
+};
+
+// Planes of a view volume in world space, (normal, distance) with the normals pointing inside
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+class OcclusionBuffer;
+
+// What a pass draws for: the frustum to cull against, and the projection to pick the level of detail by
+struct DrawView {
+    Frustum frustum;
+    bool isOrthographic = false;
+    // perspective: position of the camera
+    glm::vec3 eye = glm::vec3(0.0f);
+    // 1 / tan(fovy / 2) for a perspective projection, 1 / half height of the volume for an orthographic one
+    float projectionScale = 1.0f;
+    // the screen size is divided by this before the level is picked, above 1 picks coarser levels
+    float lodBias = 1.0f;
+    // occluders of the view, nullptr to test only the frustum
+    const OcclusionBuffer* occlusion = nullptr;
+};
+
+// Meshes drawn, skipped by the frustum culling and hidden behind occluders, and triangles drawn, in the current frame
+struct CullingStats {
+    int drawn = 0;
+    int culled = 0;
+    int occluded = 0;
+    long long triangles = 0;
+    int drawCalls = 0;
+};
+
+// Sum of the squared distances to a set of planes, as the symmetric 4x4 matrix of the plane equations
+struct Quadric {
+    double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0, b2 = 0.0, bc = 0.0, bd = 0.0, c2 = 0.0, cd = 0.0, d2 = 0.0;
+
+    void addPlane(const glm::vec3& n, double d, double weight)
+    {
+        a2 += weight * n.x * n.x; ab += weight * n.x * n.y; ac += weight * n.x * n.z; ad += weight * n.x * d;
+        b2 += weight * n.y * n.y; bc += weight * n.y * n.z; bd += weight * n.y * d;
+        c2 += weight * n.z * n.z; cd += weight * n.z * d;
+        d2 += weight * d * d;
+    }
+
+    void add(const Quadric& q)
+    {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2; bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+    }
+
+    double evaluate(const glm::vec3& p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        return a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x
+            + b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y
+            + c2 * z * z + 2.0 * cd * z + d2;
+    }
+};
+
+// Interleaved vertex of the model cache, matching the attribute locations 0 (position), 1 (normal) and 2 (texture coordinates)
+struct ModelVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoords;
+};
+static_assert(sizeof(ModelVertex) == 32, "ModelVertex is stored in the model cache as is");
+
+// One mesh of a model, or one chunk of a large mesh: its range in the index buffer of the model, its material
+// and its bounding box in model space
+struct ModelMeshEntry {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    // added to every index of the mesh
+    unsigned int baseVertex;
+    unsigned int material;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+static_assert(sizeof(ModelMeshEntry) == 40, "ModelMeshEntry is stored in the model cache as is");
+
+// Levels of detail per mesh, level 0 is the original
+const unsigned int MODEL_LOD_COUNT = 4;
+
+// Material of a mesh: offset of its diffuse texture path in the string table, or MODEL_NO_TEXTURE
+struct ModelMaterialEntry {
+    unsigned int diffuseTexture;
+};
+
+const unsigned int MODEL_NO_TEXTURE = 0xffffffffu;
+
+// Header of a model cache file. It is followed by the vertices, the indices, the meshes (meshCount entries
+// for each level of detail), the materials and the string table (texture paths relative to the model,
+// each terminated by '\0'), without any padding
+struct ModelCacheHeader {
+    char magic[4];
+    unsigned int version;
+    // size, modification time and FNV-1a hash of the OBJ the cache was converted from
+    unsigned long long sourceSize;
+    long long sourceTime;
+    unsigned long long sourceHash;
+    unsigned int vertexCount;
+    unsigned int indexCount;
+    unsigned int meshCount;
+    unsigned int materialCount;
+    unsigned int stringBytes;
+    unsigned int lodCount;
+};
+static_assert(sizeof(ModelCacheHeader) == 56, "ModelCacheHeader is stored in the model cache as is");
+
+// Header of the track tiles ("<obj>.rctiles"): the track model cut into square tiles on the xz plane, each one a
+// model of its own. The header is followed by the tile entries and the sections of every tile, compressed
+// with lzCompress
+struct TrackTilesHeader {
+    char magic[4];
+    unsigned int version;
+    // hash of the OBJ the tiles were cut from, as in the model cache
+    unsigned long long sourceHash;
+    float tileSize;
+    unsigned int tileCount;
+};
+static_assert(sizeof(TrackTilesHeader) == 24, "TrackTilesHeader is stored in the track tiles as is");
+
+// A tile: the header of its model (without source), its bounds, and where its compressed sections are in the file
+struct TrackTileEntry {
+    ModelCacheHeader header;
+    glm::vec3 boundsMin;
+    unsigned int compressedSize;
+    glm::vec3 boundsMax;
+    // of the sections, uncompressed
+    unsigned int size;
+    unsigned long long offset;
+};
+static_assert(sizeof(TrackTileEntry) == 96, "TrackTileEntry is stored in the track tiles as is");
+
+// A model converted from the OBJ, in the layout of the model cache
+struct ModelData {
+    std::vector<ModelVertex> vertices;
+    std::vector<unsigned int> indices;
+    // level 0 of every mesh, followed by the other levels
+    std::vector<ModelMeshEntry> meshes;
+    unsigned int lodCount = 1;
+    std::vector<ModelMaterialEntry> materials;
+    std::string strings;
+};
+
+// Size and modification time of the file a model cache was converted from
+struct ModelSource {
+    unsigned long long size = 0;
+    long long time = 0;
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path);
+    void close();
+
+    const unsigned char* getData() const { return data; }
+    size_t getSize() const { return size; }
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+};
+
+// A model stored in the geometry arena. It is loaded from the binary cache next to the OBJ
+// ("<obj>.rcmodel"), and Assimp only runs when the cache is missing or older than the OBJ.
+// The loading happens on the asset loader; until the model arrives, nothing is drawn
+class CachedModel {
+public:
+    explicit CachedModel(const std::string& path);
+    // an empty model, for the asset loader to fill
+    CachedModel() = default;
+    ~CachedModel() { release(); }
+    CachedModel(const CachedModel&) = delete;
+    CachedModel& operator=(const CachedModel&) = delete;
+
+    // Add the model to the draw batch once per transform. The instances outside the frustum are skipped,
+    // and each one is drawn at the level of detail of its size on screen. A single instance is culled and
+    // its level picked per mesh, for the chunks of a large model
+    void Draw(const DrawView& view, const glm::mat4* transforms, size_t count) const;
+    void Draw(const DrawView& view, const glm::mat4& modelMatrix) const { Draw(view, &modelMatrix, 1); }
+
+    bool isLoaded() const { return !meshes.empty(); }
+    // of all meshes in model space, once loaded
+    const glm::vec3& getBoundsMin() const { return boundsMin; }
+    const glm::vec3& getBoundsMax() const { return boundsMax; }
+    // the asset loader could not read it, it stays empty
+    bool isFailed() const { return isLoadFailed; }
+    void fail() { isLoadFailed = true; }
+
+    // called on the GL thread; "sections" holds the sections of a cache file described by the header
+    void upload(const ModelCacheHeader& header, const unsigned char* sections, const std::string& directory);
+    // Drop the references on the geometry and the textures, the model draws nothing afterwards. What no other
+    // model uses stays loaded until the memory budget needs it
+    void release();
+
+private:
+    // every level of detail of every mesh, level by level, with the indices and vertices of the arena
+    std::vector<ModelMeshEntry> meshes;
+    unsigned int meshCount = 0;
+    unsigned int lodCount = 1;
+    // bounds of all meshes, for the culling of the instances
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    // visible instances of each level of detail, reused from draw to draw
+    mutable std::vector<glm::mat4> lodInstances[MODEL_LOD_COUNT];
+    // the vertices and indices in the arena, and the textures requested for the meshes
+    struct TextureRequest {
+        std::string path;
+        unsigned int firstVertex;
+        unsigned int vertexCount;
+    };
+    ResourceHandle meshResource = 0;
+    std::vector<TextureRequest> textureRequests;
+    bool isLoadFailed = false;
+
+    void drawMesh(const ModelMeshEntry& mesh, size_t instanceOffset, size_t instanceCount) const;
+};
+
+// The vertices and indices of all models in one vertex array, so that the meshes of different models can be
+// drawn together. The texture layer of every vertex is a separate attribute, set when its texture arrives
+class GeometryArena {
+public:
+    void init(size_t initialVertexCapacity, size_t initialIndexCapacity);
+    // copy the vertices and indices into the arena, returns where they start
+    void append(const ModelVertex* vertices, unsigned int newVertexCount, const unsigned int* indices, unsigned int newIndexCount,
+        unsigned int& firstVertex, unsigned int& firstIndex);
+    // The ranges of a mesh that is no longer drawn, for later appends. Released ranges at the end shorten the arena,
+    // and the buffers shrink once a quarter of them is left
+    void release(unsigned int firstVertex, unsigned int releasedVertexCount, unsigned int firstIndex, unsigned int releasedIndexCount);
+    void setLayer(unsigned int firstVertex, unsigned int count, unsigned short layer);
+
+    unsigned int getVertexArray() const { return VAO; }
+
+private:
+    unsigned int VAO = 0;
+    unsigned int VBO = 0;
+    unsigned int EBO = 0;
+    unsigned int layerBuffer = 0;
+    // in vertices and indices
+    size_t initialVertexCapacity = 0;
+    size_t vertexCapacity = 0;
+    size_t vertexCount = 0;
+    size_t initialIndexCapacity = 0;
+    size_t indexCapacity = 0;
+    size_t indexCount = 0;
+    // released ranges below vertexCount and indexCount, offset to count
+    std::map<size_t, size_t> freeVertices;
+    std::map<size_t, size_t> freeIndices;
+    // the vertices and indices of the meshes in the arena, which count their own memory
+    size_t usedVertices = 0;
+    size_t usedIndices = 0;
+    // counts the memory of the buffers that no mesh uses
+    ResourceHandle resource = 0;
+
+    void reallocate(size_t newVertexCapacity, size_t newIndexCapacity);
+    void setAttributes();
+    void updateResource();
+};
+
+// The diffuse textures of all models as the layers of one array texture, scaled to TEXTURE_LAYER_SIZE.
+// Layer 0 is the grey placeholder
+class TextureArray {
+public:
+    void init(unsigned int initialLayerCapacity);
+    // a new layer for a texture, a freed one if there is one; the array grows when it is full
+    unsigned int addLayer();
+    // The layer can be given to the next texture; layer 0 is never freed. Free layers at the end shorten the array,
+    // and it shrinks once a quarter of it is left
+    void freeLayer(unsigned int layer);
+    // the mipmaps of every layer, after the level 0 of a layer changed
+    void generateMipmaps();
+
+    unsigned int getTexture() const { return texture; }
+
+private:
+    unsigned int texture = 0;
+    unsigned int layerCount = 0;
+    unsigned int initialLayerCapacity = 0;
+    unsigned int layerCapacity = 0;
+    std::vector<unsigned int> freeLayers;
+    // counts the memory of the layers without a texture resource, the placeholder among them
+    ResourceHandle resource = 0;
+
+    unsigned int allocate(unsigned int capacity);
+    // a new texture of the capacity with the layers below layerCount copied
+    void reallocate(unsigned int capacity);
+    void updateResource();
+};
+
+// Keeps the GPU resources of the scene and counts their memory per category. Every user holds a reference on a
+// resource; a texture or mesh with the contents of a loaded one gets a reference on that instead of a copy.
+// Resources without references stay loaded in case they are needed again, and when the GPU memory is over the
+// budget the ones released longest ago are freed; a resource without contents to find it by goes with its last
+// reference. The sky, the shadow maps and the render targets have a single owner, which destroys them.
+// The texture array and the geometry arena count what they allocate beyond their textures and meshes, so the
+// total is the memory really allocated; freeing a texture or mesh only lowers it when the array or arena shrinks
+// (see TextureArray::freeLayer and GeometryArena::release)
+class ResourceManager {
+public:
+    // "budgetBytes" 0 is no budget
+    void init(size_t budgetBytes);
+
+    // A new resource with one reference. A "contentHash" other than 0 finds it again, and "freeResource" frees
+    // it on the GL thread; a resource without it is only counted
+    ResourceHandle create(const std::string& name, MemoryCategory category, unsigned long long contentHash, size_t gpuBytes,
+        size_t cpuBytes, std::function<void()> freeResource, ResourceLocation location = ResourceLocation());
+    // a new reference on the resource of the category with these contents, 0 if none is loaded
+    ResourceHandle acquire(MemoryCategory category, unsigned long long contentHash);
+    void addRef(ResourceHandle handle);
+    // GL thread
+    void release(ResourceHandle handle);
+    // free the resource now, whoever references it
+    void destroy(ResourceHandle handle);
+    // the resource got new storage, a shadow map of another resolution for example
+    void resize(ResourceHandle handle, size_t gpuBytes, size_t cpuBytes);
+
+    // GL thread: free resources without references, the least recently used first, until the GPU memory is
+    // within the budget
+    void enforceBudget();
+    // GL thread, before the context goes away
+    void destroyAll();
+
+    ResourceLocation getLocation(ResourceHandle handle) const;
+    size_t getGpuBytes() const;
+    size_t getCpuBytes() const;
+    // resources, references and memory of every category
+    void writeReport(std::ostream& out) const;
+
+private:
+    struct Entry {
+        std::string name;
+        MemoryCategory category = MEMORY_TEXTURE;
+        unsigned long long contentHash = 0;
+        size_t gpuBytes = 0;
+        size_t cpuBytes = 0;
+        int refCount = 0;
+        // value of useClock when it was last created, acquired or released
+        unsigned long long lastUsed = 0;
+        ResourceLocation location;
+        std::function<void()> freeResource;
+    };
+
+    std::unordered_map<ResourceHandle, Entry> entries;
+    std::unordered_map<unsigned long long, ResourceHandle> byContent[MEMORY_CATEGORY_COUNT];
+    ResourceHandle nextHandle = 1;
+    unsigned long long useClock = 0;
+    size_t categoryGpuBytes[MEMORY_CATEGORY_COUNT] = {};
+    size_t categoryCpuBytes[MEMORY_CATEGORY_COUNT] = {};
+    size_t budget = 0;
+    // loads that found their contents already loaded, and resources freed for the budget
+    size_t sharedCount = 0;
+    size_t evictedCount = 0;
+    bool isOverBudgetReported = false;
+};
+
+// the layout read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    unsigned int count;
+    unsigned int instanceCount;
+    unsigned int firstIndex;
+    int baseVertex;
+    unsigned int baseInstance;
+};
+
+// The draws of the arena, collected until the shader or the render target changes and then submitted at once:
+// one glMultiDrawElementsIndirect on GL 4.3, one instanced draw per command on GL 3.3
+class DrawBatch {
+public:
+    void init();
+    void add(const ModelMeshEntry& mesh, size_t instanceOffset, size_t instanceCount);
+    void flush();
+
+private:
+    std::vector<DrawElementsIndirectCommand> commands;
+    unsigned int indirectBuffer = 0;
+    bool isIndirect = false;
+
+    void bindInstances(size_t offset) const;
+};
+
+// Streaming buffer for the per-instance model matrices. It is written front to back during a frame and
+// orphaned when it is full or a new frame begins, so the draws still in flight keep their data
+class InstanceBuffer {
+public:
+    void init(size_t capacity);
+    void beginFrame();
+    // copy the matrices into the buffer, returns their offset in bytes
+    size_t append(const glm::mat4* transforms, size_t count);
+
+    unsigned int getBuffer() const { return buffer; }
+
+private:
+    unsigned int buffer = 0;
+    // in bytes
+    size_t capacity = 0;
+    size_t offset = 0;
+};
+
+// The instances of the scene besides the player: traffic cars and track-side signs
+struct SceneInstances {
+    std::vector<glm::mat4> cars;
+    std::vector<glm::mat4> stopSigns;
+};
+
+// Fixed set of worker threads running jobs in the order they were submitted
+class ThreadPool {
+public:
+    ~ThreadPool() { if (!threads.empty()) stop(); }
+
+    void start(unsigned int threadCount);
+    // jobs that have not started yet are dropped
+    void stop();
+    void submit(std::function<void()> job);
+
+private:
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+
+    void run();
+};
+
+// Kinds of decoded assets waiting for the GL thread
+enum AssetUploadType {
+    ASSET_UPLOAD_MODEL,
+    ASSET_UPLOAD_TEXTURE,
+    ASSET_UPLOAD_CUBEMAP_FACE
+};
+
+struct StbiDeleter {
+    void operator()(unsigned char* pixels) const { stbi_image_free(pixels); }
+};
+
+// An asset decoded by a worker: the sections of a model, or the pixels of a texture or of a cubemap face
+struct AssetUpload {
+    AssetUploadType type = ASSET_UPLOAD_MODEL;
+    // file name for the startup timings, texture path for the error message
+    std::string name;
+    std::chrono::steady_clock::time_point requested;
+    bool isDecoded = false;
+
+    // model: the mapped cache file, or the sections converted from the OBJ
+    CachedModel* model = nullptr;
+    std::string directory;
+    ModelCacheHeader header = {};
+    std::unique_ptr<MappedFile> cache;
+    std::vector<unsigned char> sections;
+    bool isConverted = false;
+    // a track tile, loaded while driving and not part of the startup
+    bool isStreamed = false;
+
+    // texture and cubemap face: the decoded image, or a texture scaled to the size of a layer
+    int face = 0;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::unique_ptr<unsigned char, StbiDeleter> pixels;
+    std::vector<unsigned char> scaledPixels;
+    // texture: hash of the scaled pixels, the same image under another path shares the layer
+    unsigned long long contentHash = 0;
+
+    const unsigned char* getSections() const { return cache ? cache->getData() + sizeof(ModelCacheHeader) : sections.data(); }
+    const unsigned char* getPixels() const { return pixels ? pixels.get() : scaledPixels.data(); }
+};
+
+// A texture of the texture array: its resource once it is uploaded, the number of requests for it, and the
+// vertices that use it until it has a layer
+struct TextureSlot {
+    ResourceHandle resource = 0;
+    unsigned short layer = 0;
+    int users = 0;
+    std::vector<std::pair<unsigned int, unsigned int>> waitingVertices;
+};
+
+// Decodes models and images on a thread pool. The GL thread uploads them from a bounded queue within
+// a time budget per frame, and draws placeholders until then
+class AssetLoader {
+public:
+    ~AssetLoader() { stop(); }
+
+    void start(unsigned int threadCount);
+    void stop();
+
+    void loadModel(CachedModel& model, const std::string& path);
+    // A tile of the track tiles. The compressed sections stay mapped until the model is loaded; its textures
+    // are relative to "directory"
+    void loadTrackTile(CachedModel& model, const TrackTileEntry& tile, const unsigned char* compressed, const std::string& directory);
+    // replaces cubemapTexture once all six faces are uploaded
+    void loadCubemap(const std::vector<std::string>& faces);
+    // Texture the vertices with the image of the path. They show the placeholder layer until the image is
+    // decoded and uploaded to a layer of its own
+    void requestTexture(const std::string& path, unsigned int firstVertex, unsigned int vertexCount);
+    // One request less; the texture is released with the last one. The vertices of the request no longer wait for
+    // it, the arena may give them to another model
+    void releaseTexture(const std::string& path, unsigned int firstVertex, unsigned int vertexCount);
+
+    // GL thread: upload decoded assets until the budget is used up, at least one per call
+    void update(double budgetMs);
+    // GL thread: wait for every requested asset and upload it
+    void finishAll();
+
+private:
+    // decoded assets waiting for the GL thread; a full queue makes the workers wait,
+    // so that decoding cannot run arbitrarily far ahead of the uploads
+    static const size_t UPLOAD_QUEUE_CAPACITY = 8;
+
+    ThreadPool pool;
+    std::deque<AssetUpload> uploads;
+    std::mutex uploadMutex;
+    std::condition_variable uploadNotFull;
+    std::condition_variable uploadNotEmpty;
+    bool stopping = false;
+    // requested and not yet uploaded
+    std::atomic<int> outstanding{ 0 };
+    bool isStartupRecorded = false;
+
+    // used on the GL thread only
+    std::map<std::string, TextureSlot> textures;
+    unsigned int pixelBuffer = 0;
+    unsigned int cubemapLoading = 0;
+    int cubemapFacesLeft = 0;
+    size_t cubemapBytes = 0;
+    std::chrono::steady_clock::time_point cubemapRequested;
+
+    void push(AssetUpload&& upload);
+    void finishUpload(AssetUpload& upload);
+    void uploadPixels(GLenum target, const AssetUpload& upload, unsigned int layer = 0);
+};
+
+// Loads the tiles of the track around the car and along its way, and releases the ones it left behind.
+// The tiles decode on the asset loader and upload within its budget per frame; a few load at the same time,
+// the nearest first, so a tile near the car never waits behind tiles far ahead
+class TrackStreamer {
+public:
+    // The tiles of the track at "trackPath", cut again from the model when they are missing or were cut from
+    // another version of the OBJ
+    bool open(const std::string& trackPath, const ModelCacheHeader& header, const unsigned char* sections);
+    // GL thread, releases every tile
+    void close();
+    bool isOpen() const { return !tiles.empty(); }
+
+    // GL thread: request and release tiles for the car at "position"; true if tiles were requested
+    bool update(const glm::vec3& position, float deltaTime);
+    void draw(const DrawView& view) const;
+
+    size_t getTileCount() const { return tiles.size(); }
+    size_t getLoadedCount() const;
+
+private:
+    struct Tile {
+        TrackTileEntry entry;
+        // requested, until it is released
+        std::unique_ptr<CachedModel> model;
+        // failed loads; at TRACK_TILE_MAX_ATTEMPTS the tile is not requested again
+        int failures = 0;
+    };
+
+    MappedFile file;
+    std::vector<Tile> tiles;
+    std::string directory;
+    // smoothed velocity of the car, for the prefetch
+    glm::vec3 velocity = glm::vec3(0.0f);
+    glm::vec3 lastPosition = glm::vec3(0.0f);
+    bool hasPosition = false;
+
+    bool read(const std::string& path, unsigned long long sourceHash);
+};
+
+// Output format of the frame capture
+enum CaptureFormat {
+    CAPTURE_PNG,
+    // RGBA rows from top to bottom, nothing else
+    CAPTURE_RAW
+};
+
+// Picks the render scale and the shadow quality that keep the GPU time of a frame within the budget.
+// Over budget the resolution goes down first and the shadows after it, under budget they come back in the
+// opposite order; after every change the controller waits until the new setting shows in the timings
+class ResolutionController {
+public:
+    void init(double frameBudgetMs);
+    // GPU time of a finished frame; true when the scale or the shadow level changed
+    bool update(double gpuMs);
+    float getScale() const { return scale; }
+    // every level halves the resolution of the shadow cascades
+    int getShadowLevel() const { return shadowLevel; }
+
+private:
+    double budgetMs = 0.0;
+    double averageMs = 0.0;
+    int averagedFrames = 0;
+    float scale = 1.0f;
+    int shadowLevel = 0;
+};
+
+// Number of input-to-present latencies kept for the report
+const size_t LATENCY_HISTORY_FRAMES = 1024;
+
+// Holds every frame back to the frame cap, and measures how long input takes to reach the screen.
+// A wait sleeps most of the remaining time and spins the rest, since a sleep can overshoot by a scheduler quantum
+class FramePacer {
+public:
+    // 0 frames per second: no cap, only the latency is measured
+    void init(double maxFps);
+    void wait();
+    // input arrived that the next presented frame is the first to react to, seconds since the start of the session
+    void markInput(double seconds);
+    // The frame has been handed to the driver; a timestamp query tells when the GPU was done with it, the earliest
+    // it can be shown. The GL time of the query is converted to the session clock with an offset measured from both
+    void framePresented();
+    void finish();
+
+    TimingSummary latencySummary(size_t frames) const;
+
+private:
+    struct PresentedFrame {
+        unsigned int query = 0;
+        double inputTime = 0.0;
+    };
+
+    std::chrono::steady_clock::duration period{ 0 };
+    std::chrono::steady_clock::time_point deadline;
+    // oldest input not shown yet, negative when there is none
+    double inputTime = -1.0;
+    std::deque<PresentedFrame> presentedFrames;
+    RingBuffer<double, LATENCY_HISTORY_FRAMES> latencies;
+    // session seconds minus GL seconds, and when that was measured
+    double clockOffset = 0.0;
+    double clockCalibrated = -1.0;
+
+    void collect(bool isWaiting);
+};
+
+// Handle of a resource of the render graph, valid until the graph is reset
+typedef int RenderResource;
+
+// How a pass starts on a resource it renders to: with what the passes before it left there, or cleared
+enum RenderLoadOp {
+    RENDER_LOAD,
+    RENDER_CLEAR
+};
+
+// The frame as a list of passes that declare the resources they read and write, built again every frame.
+// Passes whose results nobody reads are culled, the rest run in the order of their dependencies, and textures
+// that only live within the frame come from a pool, where textures of the same format whose uses do not overlap
+// share their memory. The graph binds the framebuffer, viewport, shader and depth function of each pass, but only
+// where they differ from the pass before, clears what the pass asks for and flushes the draw batch after it.
+// OpenGL orders framebuffer writes before later texture reads by itself, so the passes need no explicit barriers
+class RenderGraph {
+public:
+    // drop the passes and resources of the last frame; the pooled textures are kept
+    void reset();
+
+    // A framebuffer owned outside the graph, with the buffers a clear affects. The passes writing an output
+    // (the window) are never culled
+    RenderResource importFramebuffer(const char* name, unsigned int framebuffer, int width, int height, GLbitfield attachments, bool isOutput);
+    // a texture that lives only in this frame
+    RenderResource createTexture(const char* name, int width, int height, GLenum internalFormat);
+
+    int addPass(const char* name, ProfilePass profilePass, std::function<void()> execute);
+    void read(int pass, RenderResource resource);
+    void write(int pass, RenderResource resource, RenderLoadOp load = RENDER_LOAD);
+    void setShader(int pass, const ShaderProgram* shader);
+    void setDepthFunc(int pass, GLenum depthFunc);
+    // draw into the lower left width x height of the targets instead of all of them
+    void setViewport(int pass, int width, int height);
+
+    void compile();
+    void execute();
+
+    // during execute: a framebuffer to blit from, or the texture to sample
+    unsigned int getFramebuffer(RenderResource resource);
+    unsigned int getTexture(RenderResource resource) const;
+
+    int getExecutedPassCount() const { return (int)order.size(); }
+    int getCulledPassCount() const { return (int)(passes.size() - order.size()); }
+    size_t getPooledTextureCount() const { return pool.size(); }
+
+private:
+    enum ResourceKind {
+        RESOURCE_FRAMEBUFFER,
+        RESOURCE_TEXTURE
+    };
+
+    struct Resource {
+        const char* name = "";
+        ResourceKind kind = RESOURCE_TEXTURE;
+        int width = 0;
+        int height = 0;
+        // imported
+        unsigned int framebuffer = 0;
+        GLbitfield attachments = 0;
+        bool isOutput = false;
+        // transient: the pooled texture it uses in this frame, and its first and last pass in the order
+        GLenum internalFormat = 0;
+        int pooled = -1;
+        int firstUse = -1;
+        int lastUse = -1;
+    };
+
+    struct Pass {
+        const char* name = "";
+        ProfilePass profilePass = PROFILE_PASS_COUNT;
+        std::function<void()> execute;
+        std::vector<RenderResource> reads;
+        std::vector<std::pair<RenderResource, RenderLoadOp>> writes;
+        const ShaderProgram* shader = nullptr;
+        GLenum depthFunc = GL_LESS;
+        int viewportWidth = 0;
+        int viewportHeight = 0;
+        bool isCulled = false;
+    };
+
+    struct PooledTexture {
+        unsigned int texture = 0;
+        int width = 0;
+        int height = 0;
+        GLenum internalFormat = 0;
+        // last pass in this frame's order that uses it
+        int busyUntil = -1;
+        long long lastUsedFrame = 0;
+        ResourceHandle resource = 0;
+    };
+
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    // indices of the passes that are not culled, in execution order
+    std::vector<int> order;
+    std::vector<PooledTexture> pool;
+    // framebuffers of the texture attachments (color, depth)
+    std::map<std::pair<unsigned int, unsigned int>, unsigned int> framebuffers;
+    long long frame = 0;
+
+    // the state the last pass left, to skip what does not change
+    unsigned int boundFramebuffer = 0;
+    int viewportWidth = 0;
+    int viewportHeight = 0;
+    const ShaderProgram* boundShader = nullptr;
+    GLenum depthFunc = GL_LESS;
+
+    void cull();
+    void sort();
+    void allocate();
+    void bindTarget(const Pass& pass);
+    unsigned int getTextureFramebuffer(unsigned int color, unsigned int depth);
+};
+
+// Renders the frames into an offscreen framebuffer of any size and writes every frame to a file.
+// The pixels are read into a ring of pixel buffers with a fence each, so the read back of a frame is only mapped
+// once the GPU is done with it; the files are encoded and written by worker threads
+class FrameCapture {
+public:
+    bool init(const std::string& directory, int width, int height, CaptureFormat format);
+    bool isActive() const { return framebuffer != 0; }
+    unsigned int getFramebuffer() const { return framebuffer; }
+
+    // queue the read back of the frame just rendered and show it in the window
+    void endFrame(int destinationWidth, int destinationHeight);
+    // wait for every frame to be read back and written
+    void finish();
+
+    long long getFrameCount() const { return frameCount; }
+
+private:
+    static const int RING_SIZE = 3;
+    // frames read back but not yet written; more make the GL thread wait for the encoders
+    static const int MAX_PENDING_WRITES = 8;
+
+    struct Slot {
+        unsigned int pixelBuffer = 0;
+        GLsync fence = 0;
+        long long frame = 0;
+    };
+
+    std::string directory;
+    int width = 0;
+    int height = 0;
+    CaptureFormat format = CAPTURE_PNG;
+    unsigned int framebuffer = 0;
+    unsigned int colorBuffer = 0;
+    unsigned int depthBuffer = 0;
+    // the buffers above and the pixel buffers, counted by the resource manager
+    ResourceHandle resource = 0;
+    Slot slots[RING_SIZE];
+    int nextSlot = 0;
+    long long frameCount = 0;
+
+    ThreadPool encoders;
+    std::mutex writeMutex;
+    std::condition_variable writeDone;
+    int pendingWrites = 0;
+
+    void readSlot(Slot& slot);
+};
+
+// The part of the car state that is needed for rendering, captured after every simulation tick
+struct CarState {
+    glm::vec3 midValPosition = glm::vec3(0.0f);
+    float yaw = 0.0f;
+    float delayYaw = 0.0f;
+    float midValYaw = 0.0f;
+    // normal of the track below the car, the car leans with it
+    glm::vec3 groundNormal = glm::vec3(0.0f, 1.0f, 0.0f);
+};
+
+// Four triangles in structure-of-arrays layout: the first vertex and the two edges from it, one lane per triangle.
+// Unused lanes have zero edges and never hit
+struct alignas(16) TrianglePacket {
+    float v0[3][4];
+    float edge1[3][4];
+    float edge2[3][4];
+};
+
+// Node of a bounding volume hierarchy. The children of an inner node are next to each other from "first" on,
+// a leaf has "count" triangles in the packet "first"
+struct BvhNode {
+    glm::vec3 boundsMin;
+    unsigned int first;
+    glm::vec3 boundsMax;
+    unsigned int count;
+};
+
+struct TrackHit {
+    float distance = 0.0f;
+    glm::vec3 point = glm::vec3(0.0f);
+    // facing the ray
+    glm::vec3 normal = glm::vec3(0.0f, 1.0f, 0.0f);
+};
+
+// Bounding volume hierarchy over triangles with at most four triangles per leaf. Read-only once built,
+// so any number of threads can query it at the same time
+class TriangleBvh {
+public:
+    void build(const std::vector<glm::vec3>& triangles);
+    // nearest hit within maxDistance along the normalized direction
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, TrackHit& hit) const;
+    // The same for up to RAY_PACKET_SIZE rays with one direction, in a single traversal; "found" tells which hit
+    void raycast(const glm::vec3* origins, int rayCount, const glm::vec3& direction, float maxDistance, TrackHit* hits, bool* found) const;
+
+    size_t getTriangleCount() const { return triangleCount; }
+    size_t getMemoryBytes() const { return nodes.capacity() * sizeof(BvhNode) + packets.capacity() * sizeof(TrianglePacket); }
+
+private:
+    std::vector<BvhNode> nodes;
+    std::vector<TrianglePacket> packets;
+    size_t triangleCount = 0;
+};
+
+// The surface of the race track: the ground the cars drive on and the walls that stop them. Both are built from
+// level 0 of the track model, and the triangles are split by how steep they are
+class TrackCollision {
+public:
+    bool build(const ModelCacheHeader& header, const unsigned char* sections);
+    bool isEmpty() const { return ground.getTriangleCount() == 0 && walls.getTriangleCount() == 0; }
+
+    // highest ground below the point (within TRACK_PROBE_HEIGHT above it)
+    bool groundAt(const glm::vec3& position, TrackHit& hit) const;
+    // groundAt for many points, RAY_PACKET_SIZE of them per traversal; "found" tells which have ground below them
+    void groundAt(const glm::vec3* positions, size_t count, TrackHit* hits, bool* found) const;
+    // Whether a car moving from one point to another in the xz plane runs into a wall. The car is a capsule
+    // standing on the ground at the start, tested with rays from its bottom and top and from both of its sides
+    bool sweepCar(const glm::vec3& from, const glm::vec3& to, TrackHit* contact) const;
+
+    size_t getGroundTriangleCount() const { return ground.getTriangleCount(); }
+    size_t getWallTriangleCount() const { return walls.getTriangleCount(); }
+    size_t getMemoryBytes() const { return ground.getMemoryBytes() + walls.getMemoryBytes(); }
+
+private:
+    TriangleBvh ground;
+    TriangleBvh walls;
+};
+
+// Depth of the occluders as seen from one view, rasterized on the CPU at a low resolution, and a pyramid in which
+// every texel holds the farthest depth of the 2x2 texels below it. A box is hidden when it is behind the farthest
+// occluder depth everywhere it covers on screen
+class OcclusionBuffer {
+public:
+    // the width is rounded up to a multiple of 4, the rasterizer fills 4 pixels at once
+    void init(int bufferWidth, int bufferHeight);
+    void render(const glm::mat4& viewProjMatrix, const std::vector<glm::vec3>& triangles);
+    // false only when the box is completely behind the occluders; boxes crossing the near plane are visible
+    bool isBoxVisible(const glm::vec3& center, const glm::vec3& extent) const;
+
+private:
+    int width = 0;
+    int height = 0;
+    glm::mat4 viewProj = glm::mat4(1.0f);
+    // level 0 is the depth buffer, in [0, 1] with 1 the far plane
+    std::vector<std::vector<float>> levels;
+    std::vector<std::pair<int, int>> levelSizes;
+
+    // a triangle in clip space that is in front of the near plane
+    void rasterize(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+    void buildPyramid();
+};
+
+// Rasterizes the occluders for the camera and for every shadow cascade on worker threads, while the GL thread
+// renders the static shadow layers. A pass waits for the buffer of its view only right before it draws.
+// A caster hidden from the light behind an occluder is inside the occluder's shadow, so it is skipped as well
+class OcclusionCuller {
+public:
+    ~OcclusionCuller() { stop(); }
+
+    void start(int cascadeCount, unsigned int threadCount);
+    void stop();
+    // triangles in world space
+    void setOccluders(std::vector<glm::vec3> triangles);
+    size_t getOccluderTriangleCount() const { return occluders.size() / 3; }
+
+    void beginFrame(const glm::mat4& cameraViewProj, const glm::mat4* lightSpaceMatrices, int renderedCascades);
+    // the buffer of a view of this frame, nullptr when occlusion culling is off
+    const OcclusionBuffer* getCamera() { return waitFor(0); }
+    const OcclusionBuffer* getCascade(int cascade) { return waitFor(1 + cascade); }
+
+private:
+    ThreadPool workers;
+    std::vector<glm::vec3> occluders;
+    // view 0 is the camera, view 1 + i the cascade i
+    std::vector<OcclusionBuffer> buffers;
+    std::vector<char> isRendered;
+    std::vector<char> isDone;
+    std::mutex mutex;
+    std::condition_variable done;
+    bool isStarted = false;
+
+    const OcclusionBuffer* waitFor(int view);
+    void waitAll();
+};
+
+// Bins the lights of the frame into a grid of froxels, CLUSTER_COUNT_X x CLUSTER_COUNT_Y tiles of the screen and
+// CLUSTER_COUNT_Z slices of the view depth on a log scale. The workers bin while the shadows render, one range of
+// slices each, and the main pass uploads three texture buffers: the lights, the offset and count of the list of
+// every cluster, and the lists. The fragment shader only loops over the lights of its own cluster
+class LightClusters {
+public:
+    ~LightClusters() { stop(); }
+
+    void start(unsigned int threadCount);
+    void stop();
+
+    // the lights of this frame, binned for the view
+    void beginFrame(std::vector<Light> frameLights, const glm::mat4& view, const glm::mat4& projection);
+    // GL thread, before the main pass draws: wait for the bins, upload and bind them
+    void upload();
+
+    size_t getLightCount() const { return lights.size(); }
+    // the light lists of all clusters together
+    size_t getIndexCount() const { return indexCount; }
+
+private:
+    // the clusters of a range of slices, in the order x, y, z; "grid" holds the offset in "indices" and the count
+    struct Slices {
+        int firstSlice = 0;
+        int sliceCount = 0;
+        std::vector<unsigned int> grid;
+        std::vector<unsigned int> indices;
+    };
+    // the clusters a light covers within a range of slices, empty when maxZ < minZ
+    struct Bounds {
+        int minX, minY, maxX, maxY, minZ, maxZ;
+    };
+
+    ThreadPool workers;
+    std::vector<Light> lights;
+    std::vector<Slices> slices;
+    glm::mat4 view = glm::mat4(1.0f);
+    glm::mat4 projection = glm::mat4(1.0f);
+    std::mutex mutex;
+    std::condition_variable done;
+    int pending = 0;
+    bool isStarted = false;
+    size_t indexCount = 0;
+
+    // lights, grid, lists
+    unsigned int buffers[3] = {};
+    unsigned int textures[3] = {};
+
+    void bin(Slices& range);
+    void waitAll();
+};
+
+// The traffic cars in structure-of-arrays layout, so that one tick of all of them is a few vectorized loops.
+// Every car drives a circle: its direction turns by a fixed angle per tick, and the shown position and direction
+// follow the real ones with a delay, like the player car
+class CarFleet {
+public:
+    void init(int carCount, float ringRadius);
+    // one SIM_TIMESTEP for every car
+    void tick(long long tick);
+
+    size_t getCount() const { return count; }
+    // the delayed position, on the ground
+    glm::vec3 getMidValPosition(size_t i) const { return glm::vec3(midValX[i], height[i], midValZ[i]); }
+    // the delayed direction, in the xz plane
+    glm::vec2 getMidValDirection(size_t i) const { return glm::vec2(midValDirectionX[i], midValDirectionZ[i]); }
+
+private:
+    size_t count = 0;
+    std::vector<float> positionX, positionZ;
+    std::vector<float> directionX, directionZ;
+    // distance per tick, and the cosine and sine of the angle the direction turns per tick
+    std::vector<float> stepDistance, turnCos, turnSin;
+    std::vector<float> midValX, midValZ, midValDirectionX, midValDirectionZ;
+    // ground height, refreshed for a part of the cars every tick
+    std::vector<float> height;
+
+    void tickScalar(size_t begin, size_t end);
+    void followGround(long long tick);
+};
+
+// The traffic of one tick, as the renderer needs it
+struct TrafficState {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> directions;
+};
+
+// Everything the renderer needs from one tick of the simulation
+struct WorldSnapshot {
+    long long tick = 0;
+    // when the tick was due, the renderer interpolates by it
+    std::chrono::steady_clock::time_point time;
+    CarState car;
+    TrafficState traffic;
+    Camera camera;
+    FixedCamera fixedCamera = FixedCamera(glm::vec3(0.0f));
+    bool isCameraFixed = false;
+};
+
+// Lock-free handoff from one writer thread to one reader thread. The writer fills its buffer and publishes it,
+// the reader takes the newest published buffer; neither ever waits for the other
+template <typename T>
+class TripleBuffer {
+public:
+    T& getWriteBuffer() { return buffers[writeIndex]; }
+    void publish() { writeIndex = middle.exchange(writeIndex | FRESH_BIT, std::memory_order_acq_rel) & INDEX_MASK; }
+
+    // take the newest buffer, false when nothing was published since the last call
+    bool update()
+    {
+        if ((middle.load(std::memory_order_relaxed) & FRESH_BIT) == 0)
+            return false;
+        readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+    const T& getReadBuffer() const { return buffers[readIndex]; }
+
+private:
+    static const unsigned int INDEX_MASK = 3;
+    static const unsigned int FRESH_BIT = 4;
+
+    T buffers[3];
+    // the buffer between writer and reader, with FRESH_BIT when the writer published it
+    std::atomic<unsigned int> middle{ 1 };
+    unsigned int writeIndex = 0;
+    unsigned int readIndex = 2;
+};
+
+// function declaration
+GLFWwindow* windowInit();
+GLFWwindow* createWindow();
+bool init();
+bool hasMultiDrawIndirect();
+bool hasProgramBinary();
+void depthMapFBOInit();
+void resizeShadowMaps(int level);
+void frameConstantsInit();
+bool parseShadowResolution(const char* arg);
+void skyboxInit();
+double elapsedMs(std::chrono::steady_clock::time_point start);
+TimingSummary summarizeTimings(std::vector<double> values);
+
+void setDeltaTime();
+void changeLightPosAsTime();
+void updateFixedCamera(Camera& camera, FixedCamera& fixedCamera, const CarState& carState);
+void updateShadowCascades(const glm::mat4& viewMatrix, const glm::mat4& projMatrix);
+void updateFrameConstants();
+void invalidateStaticShadows();
+void invalidateStaticShadows(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+Frustum makeFrustum(const glm::mat4& viewProjMatrix);
+DrawView makePerspectiveView(const glm::mat4& viewMatrix, const glm::mat4& projMatrix, float lodBias);
+DrawView makeOrthographicView(const glm::mat4& lightSpaceMatrix, float halfSize, float lodBias);
+void transformBox(const glm::mat4& modelMatrix, const glm::vec3& boundsMin, const glm::vec3& boundsMax, glm::vec3& center, glm::vec3& extent);
+bool isBoxVisible(const Frustum& frustum, const glm::vec3& center, const glm::vec3& extent);
+unsigned int selectLod(const DrawView& view, const glm::vec3& center, float radius, unsigned int lodCount);
+
+// fixed timestep simulation
+void simulateTick(const SimInput& input);
+void advanceSimulation(const SimInput& input);
+void startSimulationThread();
+void stopSimulationThread();
+void runSimulationThread();
+void publishSnapshot(std::chrono::steady_clock::time_point time);
+void updateFromSnapshots();
+SimInput scriptedInput(long long tick);
+SimInput processInputEvents(const SimInput& sampled);
+void applyInputEvent(const InputEvent& event);
+void queueInputEvent(InputEventType type, float x, float y);
+bool inputLogInit();
+void writeVarint(std::ostream& out, unsigned long long value);
+bool readVarint(std::istream& in, unsigned long long& value);
+void writeFloat(std::ostream& out, float value);
+bool readFloat(std::istream& in, float& value);
+int runHeadless(long long ticks);
+CarState captureCarState(Car& car, const CarState& previous);
+CarState interpolateCarState(const CarState& from, const CarState& to, float alpha);
+void captureTraffic(const CarFleet& fleet, TrafficState& traffic);
+void updateTrafficInstances(const TrafficState& from, const TrafficState& to, float alpha);
+
+// track collision
+bool loadTrackCollision(const std::string& path, bool isRendering);
+bool intersectPacket(const TrianglePacket& packet, const glm::vec3& origin, const glm::vec3& direction, float& distance, int& lane);
+bool isRayInBox(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance);
+void setPacketHit(const TrianglePacket& packet, int lane, const glm::vec3& origin, const glm::vec3& direction, float distance, TrackHit& hit);
+
+// occlusion culling
+std::vector<glm::vec3> selectOccluders(const ModelCacheHeader& header, const unsigned char* sections);
+
+// model cache
+bool getModelSource(const std::string& path, ModelSource& source);
+unsigned long long hashBytes(const unsigned char* data, size_t size);
+bool convertModel(const std::string& path, ModelData& data);
+void convertModelNode(const aiNode* node, const aiScene* scene, ModelData& data);
+bool writeModelCache(const std::string& cachePath, const ModelData& data, const ModelSource& source, unsigned long long sourceHash);
+bool isModelCacheValid(const ModelCacheHeader& header, const unsigned char* sections, size_t fileSize);
+void appendModelMesh(ModelData& data, const ModelMeshEntry& mesh);
+void computeMeshBounds(const ModelData& data, ModelMeshEntry& mesh);
+void generateModelLods(ModelData& data);
+ModelCacheHeader makeModelCacheHeader(const ModelData& data);
+int buildModelCaches();
+bool readModel(const std::string& path, AssetUpload& upload);
+bool decodeImage(const std::string& path, AssetUpload& upload);
+bool decodeTextureLayer(const std::string& path, AssetUpload& upload);
+std::vector<unsigned char> scaleImage(const unsigned char* pixels, int width, int height, int size);
+unsigned int createPlaceholderTexture(GLenum target, const unsigned char color[3]);
+
+// render graph
+bool isDepthFormat(GLenum internalFormat);
+
+// frame pacing
+void latchViewCamera(GLFWwindow* window);
+void setViewConstants();
+void markKeyInput(unsigned int keys);
+double sessionSeconds();
+
+// dynamic resolution
+void updateRenderSize();
+
+// track streaming
+void appendModelSections(const ModelData& data, std::vector<unsigned char>& sections);
+bool writeTrackTiles(const std::string& path, const ModelCacheHeader& header, const unsigned char* sections);
+void buildTrackTile(const ModelCacheHeader& header, const unsigned char* sections, const std::vector<unsigned int>& meshes, ModelData& tile);
+std::vector<unsigned char> lzCompress(const unsigned char* data, size_t size);
+bool lzDecompress(const unsigned char* data, size_t size, unsigned char* out, size_t outSize);
+float distanceXZ(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& point);
+
+// clustered lighting
+std::vector<Light> collectLights();
+void addCarLights(std::vector<Light>& lights, const glm::vec3& position, const glm::vec3& forward);
+int clusterSlice(float depth);
+
+// resource manager
+std::function<void()> textureDeleter(unsigned int texture);
+size_t textureFormatBytes(GLenum internalFormat);
+double toMegabytes(size_t bytes);
+bool takeFreeRange(std::map<size_t, size_t>& ranges, size_t count, size_t& offset);
+void addFreeRange(std::map<size_t, size_t>& ranges, size_t offset, size_t count);
+size_t trimFreeTail(std::map<size_t, size_t>& ranges, size_t end);
+
+// frame capture
+bool parseCaptureSize(const char* text, int& width, int& height);
+bool writePng(const std::string& path, const unsigned char* pixels, int width, int height);
+unsigned int pngCrc32(unsigned int crc, const unsigned char* data, size_t size);
+
+// use "&" for better performance
+void renderLight();
+bool selectMainShader();
+bool checkShaderInterface(const ShaderProgram* program, const char* path, bool usesFrameConstants, bool usesInstances, bool usesLayer);
+void renderCarAndCamera(CachedModel& carModel, CachedModel& cameraModel, const DrawView& view);
+void renderCar(CachedModel& model, glm::mat4 modelMatrix, const CarState& carState, const DrawView& view);
+void renderCamera(CachedModel& model, glm::mat4 modelMatrix, const CarState& carState, const DrawView& view);
+void renderTrafficCars(CachedModel& model, const DrawView& view);
+void renderStopSigns(CachedModel& model, const DrawView& view);
+void renderRaceTrack(CachedModel& model, const DrawView& view);
+void sceneInit(int carCount, int stopSignCount);
+glm::mat4 carModelMatrix(const glm::vec3& position, float yaw);
+void renderSkyBox();
+
+void framebuffer_size_callback(GLFWwindow* window, int width, int height);
+void mouse_callback(GLFWwindow* window, double xpos, double ypos);
+void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+SimInput handleKeyInput(GLFWwindow* window);
+void applySimInput(const SimInput& input, float deltaTime);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+
+// ------------------------------------------
+// global variable
+// ------------------------------------------
+
+// window size
+const unsigned int SCR_WIDTH = 1280;
+const unsigned int SCR_HEIGHT = 720;
+
+// Number of cascades the view frustum is split into for shadow mapping
+const int SHADOW_CASCADE_COUNT = 4;
+// Resolution of each cascade (affects the jaggedness of shadows), the near cascades get the most texels
+unsigned int shadowCascadeResolution[SHADOW_CASCADE_COUNT] = { 2048, 2048, 1024, 1024 };
+// Shadows are only generated up to this distance from the camera
+const float SHADOW_DISTANCE = 200.0f;
+// Weight of the logarithmic split against the uniform split of the cascades
+const float SHADOW_SPLIT_LAMBDA = 0.75f;
+// Extra depth of each cascade towards the light, so that casters outside the view frustum still cast shadows
+const float SHADOW_CASTER_MARGIN = 100.0f;
+// The cascade i is bound to GL_TEXTURE12 + i
+const int SHADOW_TEXTURE_UNIT = 12;
+// The static shadow layer extends this fraction of the cascade size beyond each side of the cascade
+const float SHADOW_STATIC_GUARD_BAND = 0.125f;
+// The radius of a cascade is one of these many sizes per doubling, so that zooming only renders the static layer
+// again when it passes a size
+const float SHADOW_RADIUS_STEPS_PER_OCTAVE = 4.0f;
+
+// models loaded at startup, relative to the root of the project
+const char* const CAR_MODEL_PATH = "asset/models/obj/Lamborghini/Lamborghini.obj";
+const char* const CAMERA_MODEL_PATH = "asset/models/obj/camera-cube/camera-cube.obj";
+const char* const RACE_TRACK_MODEL_PATH = "asset/models/obj/race-track/race-track.obj";
+const char* const STOP_SIGN_MODEL_PATH = "asset/models/obj/StopSign/StopSign.obj";
+const char* const MODEL_PATHS[] = { CAR_MODEL_PATH, CAMERA_MODEL_PATH, RACE_TRACK_MODEL_PATH, STOP_SIGN_MODEL_PATH };
+
+// "RCMD" and the version of the cache layout; a cache with another version is converted again
+const char MODEL_CACHE_MAGIC[4] = { 'R', 'C', 'M', 'D' };
+const unsigned int MODEL_CACHE_VERSION = 3;
+const char* const MODEL_CACHE_EXTENSION = ".rcmodel";
+// Meshes larger than this (in x or z, in model space) are split into chunks on a grid of this size
+const float MODEL_CHUNK_SIZE = 20.0f;
+
+// The track is drawn from tiles of this size, a multiple of the chunk size, stored next to the OBJ in
+// "<obj>.rctiles"; "--no-track-streaming" loads the whole model instead
+const float TRACK_TILE_SIZE = 60.0f;
+const char TRACK_TILES_MAGIC[4] = { 'R', 'C', 'T', 'L' };
+const unsigned int TRACK_TILES_VERSION = 1;
+const char* const TRACK_TILES_EXTENSION = ".rctiles";
+// Tiles closer than this to the car, or to where it is TRACK_PREFETCH_SECONDS later at its current velocity,
+// are loaded; the ones farther than TRACK_UNLOAD_FACTOR times that from both are released
+const float TRACK_STREAM_RADIUS = 150.0f;
+const float TRACK_PREFETCH_SECONDS = 2.0f;
+const float TRACK_UNLOAD_FACTOR = 1.5f;
+// share of the measured velocity taken into the prefetch velocity per frame
+const float TRACK_VELOCITY_SMOOTHING = 0.1f;
+// tiles decoding at the same time
+const int TRACK_STREAM_MAX_LOADS = 4;
+// a tile that failed to load this often is left out of the track
+const int TRACK_TILE_MAX_ATTEMPTS = 3;
+// Matches of the tile compression are at least this long and at most LZ_MAX_OFFSET bytes back; the compressor
+// finds them in a table of 2^LZ_HASH_BITS entries
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_MAX_OFFSET = 65535;
+const int LZ_HASH_BITS = 16;
+
+// The vertices of level of detail i are clustered on a grid with MODEL_LOD_GRID[i] cells along the largest side
+// of the model
+const float MODEL_LOD_GRID[MODEL_LOD_COUNT] = { 0.0f, 96.0f, 48.0f, 20.0f };
+// Level i is drawn while the bounding sphere of the mesh covers at least this fraction of the viewport height
+const float MODEL_LOD_SCREEN_SIZE[MODEL_LOD_COUNT] = { 0.25f, 0.1f, 0.04f, 0.0f };
+// The shadow maps use coarser levels than the camera
+const float SHADOW_LOD_BIAS = 2.0f;
+
+// reset every frame, shown in the title bar with the profiler overlay
+CullingStats cullingStats;
+
+// The model matrix of an instance is a vertex attribute, its columns use the locations 7 to 10
+const unsigned int INSTANCE_ATTRIBUTE_LOCATION = 7;
+// initial size of the instance buffer in bytes, it grows when a single draw needs more
+const size_t INSTANCE_BUFFER_CAPACITY = 4 * 1024 * 1024;
+InstanceBuffer instanceBuffer;
+
+// all models and their textures, drawn with one batch per pass
+GeometryArena geometryArena;
+const size_t ARENA_VERTEX_CAPACITY = 1 << 20;
+const size_t ARENA_INDEX_CAPACITY = 3 << 20;
+TextureArray textureArray;
+// The texture layer of a vertex is an integer attribute at this location
+const unsigned int LAYER_ATTRIBUTE_LOCATION = 3;
+// width and height of every layer; larger images are scaled down, smaller ones up
+const int TEXTURE_LAYER_SIZE = 1024;
+const unsigned int TEXTURE_LAYER_CAPACITY = 8;
+// memory of a layer with its mipmaps
+const size_t TEXTURE_LAYER_BYTES = (size_t)TEXTURE_LAYER_SIZE * TEXTURE_LAYER_SIZE * 4 * 4 / 3;
+DrawBatch drawBatch;
+
+// traffic cars and Stop cards of the scene, set by "--cars" and "--signs"
+SceneInstances sceneInstances;
+int trafficCarCount = 0;
+int stopSignCount = 1;
+// The instances are placed on lanes around this circle (the original Stop card stays where it was)
+const float SCENE_RING_RADIUS = 60.0f;
+
+// decodes the models and textures in the background, uploaded within this time per frame
+AssetLoader assetLoader;
+const double ASSET_UPLOAD_BUDGET_MS = 2.0;
+// shown until the real textures arrive
+const unsigned char PLACEHOLDER_TEXTURE_COLOR[3] = { 128, 128, 128 };
+const unsigned char PLACEHOLDER_SKY_COLOR[3] = { 135, 170, 215 };
+
+// textures, meshes, shadow maps and render targets of the scene, counted per category. "--memory-budget <MB>"
+// frees textures and meshes no model uses once the GPU memory is over it; without it they stay loaded
+ResourceManager gpuResources;
+double memoryBudgetMb = 0.0;
+
+// tiles of the race track around the car
+TrackStreamer trackStreamer;
+bool isTrackStreaming = true;
+
+// Whether it is in wireframe mode
+bool isPolygonMode = false;
+
+// per-pass timings of the frames, shown as overlay and written to "<profileOutput>.csv/.json" on exit
+FrameProfiler profiler;
+bool isProfilerOverlay = false;
+
+// every shader permutation in use; linked programs are cached in SHADER_CACHE_DIRECTORY, one file per
+// permutation, source and driver
+ShaderLibrary shaderLibrary;
+const char* const SHADER_CACHE_DIRECTORY = "shader/cache";
+const char SHADER_CACHE_MAGIC[4] = { 'R', 'C', 'S', 'P' };
+const unsigned int SHADER_CACHE_VERSION = 1;
+// The main shader is compiled for the shadow settings instead of branching on them per fragment:
+// PCF kernel of shadowFilterSize x shadowFilterSize texels ("--shadow-filter 1|3|5"), no shadows at all with "O"
+int shadowFilterSize = 3;
+bool isShadowEnabled = true;
+ShaderProgram* mainShader = nullptr;
+std::string profileOutput;
+
+// "--benchmark": hidden window, scripted drive with a fixed step per frame, percentiles written to stdout
+bool isBenchmark = false;
+long long benchmarkFrames = 1000;
+// frames rendered before measuring, so that shader compilation and first uploads are not counted
+const long long BENCHMARK_WARMUP_FRAMES = 60;
+// simulated time per benchmark frame, independent of how fast the machine renders
+const float BENCHMARK_FRAME_TIME = 1.0f / 60.0f;
+
+// "--capture <directory> [frames]": hidden window, the benchmark drive (or a replay) with a fixed step per frame,
+// every frame written to "<directory>/frame_000000.png"
+bool isCapture = false;
+long long captureFrames = 600;
+std::string captureDirectory;
+int captureWidth = 1920;
+int captureHeight = 1080;
+CaptureFormat captureFormat = CAPTURE_PNG;
+FrameCapture frameCapture;
+
+// size of the window in pixels, kept up to date by framebuffer_size_callback
+int windowWidth = SCR_WIDTH;
+int windowHeight = SCR_HEIGHT;
+// size of the image the main pass renders: the window scaled by the resolution controller, or the capture
+int renderWidth = SCR_WIDTH;
+int renderHeight = SCR_HEIGHT;
+
+// passes of the frame, built again every frame; its pool keeps the textures of the frame between frames
+RenderGraph renderGraph;
+// pooled textures no frame has used for this many frames are deleted, after a resize for example
+const long long RENDER_GRAPH_POOL_FRAMES = 3;
+
+// "--fps-cap <n>" limits the frame rate (most useful with "--no-vsync"); the pacer also measures the input latency
+double frameCap = 0.0;
+bool isVsync = true;
+FramePacer framePacer;
+// keys held at the last sample, a change counts as input for the latency
+unsigned int latchedKeys = 0;
+// the pacer sleeps until this long before the deadline and spins the rest
+const double FRAME_PACER_SPIN_MS = 1.5;
+// seconds between the measurements of the GL clock against the session clock
+const double FRAME_PACER_CALIBRATION_SECONDS = 1.0;
+
+// The resolution controller scales the scene between DYNAMIC_RESOLUTION_MIN_SCALE and the window size to keep
+// the GPU time within "--frame-budget <ms>"; "--no-dynamic-resolution" always renders at the window size
+bool isDynamicResolution = true;
+double frameBudgetMs = 14.0;
+ResolutionController resolutionController;
+long long lastMeasuredFrame = -1;
+const float DYNAMIC_RESOLUTION_MIN_SCALE = 0.5f;
+// the scale moves in steps of this size, smaller changes are not worth the blur of the new size
+const float DYNAMIC_RESOLUTION_STEP = 1.0f / 32.0f;
+// below this share of the budget the controller raises the quality again
+const double DYNAMIC_RESOLUTION_HEADROOM = 0.8;
+// frames averaged before a decision, the timer queries lag a few frames behind
+const int DYNAMIC_RESOLUTION_SETTLE_FRAMES = 20;
+// shadow cascades get at most 1 / 2^n of their resolution, but not below SHADOW_MIN_RESOLUTION
+const int SHADOW_QUALITY_LEVELS = 3;
+const unsigned int SHADOW_MIN_RESOLUTION = 256;
+
+// Y-axis unit vector of the world coordinate system
+glm::vec3 WORLD_UP(0.0f, 1.0f, 0.0f);
+
+// The largest triangles of the track hide what is behind them from the camera and from the light. They are parts of
+// the real surface, so they never hide more than the track itself; "--no-occlusion" tests only the frustum
+OcclusionCuller occlusionCuller;
+bool isOcclusionCulling = true;
+// resolution of the depth buffers of the camera and of each cascade
+const int OCCLUSION_CAMERA_WIDTH = 256;
+const int OCCLUSION_CAMERA_HEIGHT = 144;
+const int OCCLUSION_CASCADE_SIZE = 128;
+// at most this many occluder triangles, the largest first, none smaller than the area (square meters)
+const size_t OCCLUDER_TRIANGLE_BUDGET = 4096;
+const float OCCLUDER_MIN_AREA = 2.0f;
+
+// Headlights, tail lights and "--lamps <n>" lamps along the track, shaded per cluster; "--no-clustered-lights",
+// or a light_and_shadow.fs without the "clusterGrid" sampler, shades the sun alone
+LightClusters lightClusters;
+bool isClusteredLighting = true;
+int lampCount = 0;
+const int CLUSTER_COUNT_X = 16;
+const int CLUSTER_COUNT_Y = 9;
+const int CLUSTER_COUNT_Z = 24;
+// the first slice ends at CLUSTER_NEAR, the last one holds everything beyond CLUSTER_FAR
+const float CLUSTER_NEAR = 1.0f;
+const float CLUSTER_FAR = 400.0f;
+// lights beyond this many in a frame are dropped
+const size_t MAX_FRAME_LIGHTS = 4096;
+// The light texture buffer is bound to GL_TEXTURE9, the cluster grid to 10 and the light lists to 11
+const int CLUSTER_TEXTURE_UNIT = 9;
+// lights of a car in its own frame: forward, up and to the side
+const glm::vec3 HEADLIGHT_OFFSET(2.0f, 0.6f, 0.7f);
+const glm::vec3 TAIL_LIGHT_OFFSET(-2.1f, 0.7f, 0.6f);
+const glm::vec3 HEADLIGHT_COLOR(4.0f, 3.8f, 3.2f);
+const glm::vec3 TAIL_LIGHT_COLOR(2.0f, 0.1f, 0.05f);
+const float HEADLIGHT_RANGE = 40.0f;
+const float TAIL_LIGHT_RANGE = 6.0f;
+// cosines of the half angles of the headlight cones, and how far they point down
+const float HEADLIGHT_COS_INNER = 0.95f;
+const float HEADLIGHT_COS_OUTER = 0.85f;
+const float HEADLIGHT_PITCH = 0.08f;
+// the lamps stand on both sides of the ring of the scene
+const glm::vec3 LAMP_COLOR(3.0f, 2.6f, 1.8f);
+const float LAMP_RANGE = 20.0f;
+const float LAMP_HEIGHT = 6.0f;
+const float LAMP_RING_OFFSET = 12.0f;
+
+// car
+Car car(glm::vec3(0.0f, 0.05f, 0.0f));
+
+// ground and walls of the race track, used by the simulation
+TrackCollision trackCollision;
+// height of the car above the ground
+const float CAR_GROUND_CLEARANCE = 0.05f;
+// the ground is searched from this height above the car down, so that the car can drive up slopes
+const float TRACK_PROBE_HEIGHT = 10.0f;
+// rays that go through the hierarchy together in the batched queries; neighboring points share most of their nodes
+const int RAY_PACKET_SIZE = 8;
+// Triangles whose normal is closer to horizontal than this are walls, the others are ground
+const float TRACK_WALL_NORMAL_Y = 0.5f;
+// capsule of the car for the wall tests
+const float CAR_COLLISION_RADIUS = 0.8f;
+const float CAR_COLLISION_HEIGHT = 1.2f;
+
+// camera
+glm::vec3 cameraPos(0.0f, 2.0f, 5.0f);
+Camera camera(cameraPos);
+FixedCamera fixedCamera(cameraPos);
+bool isCameraFixed = false;
+// the fixed camera and the camera mode of the frame being rendered
+FixedCamera viewFixedCamera(cameraPos);
+bool isViewCameraFixed = false;
+
+// The camera actually used for rendering: the simulated camera interpolated between the last two ticks
+Camera viewCamera(cameraPos);
+
+// Lighting related properties
+glm::vec3 lightPos(-1.0f, 1.0f, -1.0f);
+glm::vec3 lightDirection = glm::normalize(lightPos);
+
+// depth maps of the shadow cascades
+ShadowCascade shadowCascades[SHADOW_CASCADE_COUNT];
+static_assert(SHADOW_CASCADE_COUNT == 4, "FrameConstants holds exactly four cascades");
+
+// Matrices and lighting of the current frame, uploaded once into frameConstantsUBO
+FrameConstants frameConstants;
+unsigned int frameConstantsUBO;
+
+// Set the mouse to the center of the screen
+float lastX = SCR_WIDTH / 2.0f;
+float lastY = SCR_HEIGHT / 2.0f;
+bool firstMouse = true;
+
+// timing is used to balance the speed changes caused by different computer rendering levels
+float deltaTime = 0.0f;
+float lastFrame = 0.0f;
+
+// The simulation advances in fixed steps, so the behavior of the car does not depend on the frame rate
+const float SIM_TIMESTEP = 1.0f / 120.0f;
+// Upper limit of ticks per frame, so that a long stall does not make the simulation fall further and further behind
+const int MAX_SIM_TICKS_PER_FRAME = 10;
+// Time that has been rendered but not yet simulated
+float simAccumulator = 0.0f;
+// Number of ticks simulated so far
+long long simTick = 0;
+
+// Input events from the callbacks, applied and recorded on the next tick
+std::vector<InputEvent> pendingInputEvents;
+// guards pendingInputEvents, which the simulation thread takes
+std::mutex pendingInputMutex;
+
+// The simulation runs on its own thread unless "--no-sim-thread" is given or it is a benchmark,
+// which steps the simulation once per frame to drive the same path on every machine
+bool isSimThread = true;
+std::thread simThread;
+std::atomic<bool> isSimStopping{ false };
+// keys sampled by the main thread, the only one allowed to ask GLFW
+std::atomic<unsigned int> sampledKeys{ 0 };
+// newest tick of the simulation thread, and the two newest taken by the renderer
+TripleBuffer<WorldSnapshot> worldSnapshots;
+WorldSnapshot previousSnapshot;
+WorldSnapshot currentSnapshot;
+// Events of the tick being simulated
+std::vector<InputEvent> tickEvents;
+// keys currently pressed as seen by the simulation
+unsigned int simKeys = 0;
+// start of the session, for the timestamps of the events
+std::chrono::steady_clock::time_point sessionStart = std::chrono::steady_clock::now();
+
+// input recording and replay
+InputLog inputLog;
+std::string recordPath;
+std::string replayPath;
+
+// Car and camera state of the previous and the current tick, interpolated when rendering
+CarState previousCarState;
+CarState currentCarState;
+glm::vec3 previousCameraPos = cameraPos;
+glm::vec3 currentCameraPos = cameraPos;
+// Car state of this frame, between previousCarState and currentCarState
+CarState renderCarState;
+
+// traffic cars driving around the ring, ticked with the player car
+CarFleet trafficFleet;
+TrafficState previousTraffic;
+TrafficState currentTraffic;
+// speed of the traffic in units per second, each car drives between 80% and 120% of it
+const float CAR_FLEET_SPEED = 12.0f;
+// fraction of the distance to the real position and direction the delayed ones catch up per tick
+const float CAR_FLEET_SMOOTHING = 0.1f;
+// the ground height of every car is refreshed once in this many ticks
+const int CAR_FLEET_GROUND_INTERVAL = 16;
+
+// skybox
+unsigned int cubemapTexture;
+ResourceHandle cubemapResource = 0;
+unsigned int skyboxVAO, skyboxVBO;
+
+
+// skybox vertex data
+const float skyboxVertices[] = {
+    // positions
+    -1.0f, 1.0f, -1.0f,
+    -1.0f, -1.0f, -1.0f,
+    1.0f, -1.0f, -1.0f,
+    1.0f, -1.0f, -1.0f,
+    1.0f, 1.0f, -1.0f,
+    -1.0f, 1.0f, -1.0f,
+
+    -1.0f, -1.0f, 1.0f,
+    -1.0f, -1.0f, -1.0f,
+    -1.0f, 1.0f, -1.0f,
+    -1.0f, 1.0f, -1.0f,
+    -1.0f, 1.0f, 1.0f,
+    -1.0f, -1.0f, 1.0f,
+
+    1.0f, -1.0f, -1.0f,
+    1.0f, -1.0f, 1.0f,
+    1.0f, 1.0f, 1.0f,
+    1.0f, 1.0f, 1.0f,
+    1.0f, 1.0f, -1.0f,
+    1.0f, -1.0f, -1.0f,
+
+    -1.0f, -1.0f, 1.0f,
+    -1.0f, 1.0f, 1.0f,
+    1.0f, 1.0f, 1.0f,
+    1.0f, 1.0f, 1.0f,
+    1.0f, -1.0f, 1.0f,
+    -1.0f, -1.0f, 1.0f,
+
+    -1.0f, 1.0f, -1.0f,
+    1.0f, 1.0f, -1.0f,
+    1.0f, 1.0f, 1.0f,
+    1.0f, 1.0f, 1.0f,
+    -1.0f, 1.0f, 1.0f,
+    -1.0f, 1.0f, -1.0f,
+
+    -1.0f, -1.0f, -1.0f,
+    -1.0f, -1.0f, 1.0f,
+    1.0f, -1.0f, -1.0f,
+    1.0f, -1.0f, -1.0f,
+    -1.0f, -1.0f, 1.0f,
+    1.0f, -1.0f, 1.0f
+};
+
+// face data of the skybox
+const vector<std::string> faces{
+    FileSystem::getPath("asset/textures/skybox/right.tga"),
+    FileSystem::getPath("asset/textures/skybox/left.tga"),
+    FileSystem::getPath("asset/textures/skybox/top.tga"),
+    FileSystem::getPath("asset/textures/skybox/bottom.tga"),
+    FileSystem::getPath("asset/textures/skybox/front.tga"),
+    FileSystem::getPath("asset/textures/skybox/back.tga")
+};
+
+// ------------------------------------------
+//main function
+// ------------------------------------------
+
+int main(int argc, char** argv)
+{
+    // ------------------------------
+    // command line
+    // ------------------------------
+
+    bool isHeadless = false;
+    long long headlessTicks = 0;
+    for (int i = 1; i < argc; i++) {
+        // "--headless [ticks]" runs only the simulation, without window and OpenGL context
+        if (strcmp(argv[i], "--headless") == 0) {
+            isHeadless = true;
+            if (i + 1 < argc && atoll(argv[i + 1]) > 0)
+                headlessTicks = atoll(argv[++i]);
+        }
+        // "--record <file>" writes the input of every tick, "--replay <file>" plays it back instead of the keyboard
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        // "--benchmark [frames]" renders a scripted drive offscreen and reports frame time percentiles
+        if (strcmp(argv[i], "--benchmark") == 0) {
+            isBenchmark = true;
+            if (i + 1 < argc && atoll(argv[i + 1]) > 0)
+                benchmarkFrames = atoll(argv[++i]);
+        }
+        // "--profile <name>" writes the per-pass timings to <name>.csv and <name>.json on exit
+        if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profileOutput = argv[++i];
+        }
+        // "--no-sim-thread" runs the simulation on the main thread, between the frames
+        if (strcmp(argv[i], "--no-sim-thread") == 0) {
+            isSimThread = false;
+        }
+        // "--shadow-filter <1|3|5>" sets the PCF kernel the main shader is compiled with
+        if (strcmp(argv[i], "--shadow-filter") == 0 && i + 1 < argc) {
+            shadowFilterSize = atoi(argv[++i]);
+            if (shadowFilterSize != 1 && shadowFilterSize != 3 && shadowFilterSize != 5) {
+                std::cout << "Invalid shadow filter: " << argv[i] << std::endl;
+                return -1;
+            }
+        }
+        // "--build-model-cache" converts every model into its binary cache and exits
+        if (strcmp(argv[i], "--build-model-cache") == 0) {
+            return buildModelCaches();
+        }
+        // "--cars <n>" adds traffic cars, "--signs <n>" places n Stop cards along the track
+        if (strcmp(argv[i], "--cars") == 0 && i + 1 < argc) {
+            trafficCarCount = std::max(0, atoi(argv[++i]));
+        }
+        if (strcmp(argv[i], "--signs") == 0 && i + 1 < argc) {
+            stopSignCount = std::max(0, atoi(argv[++i]));
+        }
+        // "--frame-budget <ms>" is the GPU time per frame the resolution controller aims for
+        if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc) {
+            frameBudgetMs = atof(argv[++i]);
+            if (frameBudgetMs <= 0.0) {
+                std::cout << "Invalid frame budget: " << argv[i] << std::endl;
+                return -1;
+            }
+        }
+        if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+            memoryBudgetMb = atof(argv[++i]);
+            if (memoryBudgetMb <= 0.0) {
+                std::cout << "Invalid memory budget: " << argv[i] << std::endl;
+                return -1;
+            }
+        }
+        if (strcmp(argv[i], "--lamps") == 0 && i + 1 < argc) {
+            lampCount = std::max(0, atoi(argv[++i]));
+        }
+        if (strcmp(argv[i], "--no-clustered-lights") == 0) {
+            isClusteredLighting = false;
+        }
+        if (strcmp(argv[i], "--no-track-streaming") == 0) {
+            isTrackStreaming = false;
+        }
+        // "--no-occlusion" draws everything inside the frustum, also what the track hides
+        if (strcmp(argv[i], "--no-occlusion") == 0) {
+            isOcclusionCulling = false;
+        }
+        if (strcmp(argv[i], "--no-dynamic-resolution") == 0) {
+            isDynamicResolution = false;
+        }
+        // "--fps-cap <n>" paces the frames to at most n per second, "--no-vsync" stops waiting for the display
+        if (strcmp(argv[i], "--fps-cap") == 0 && i + 1 < argc) {
+            frameCap = atof(argv[++i]);
+            if (frameCap < 0.0) {
+                std::cout << "Invalid frame cap: " << argv[i] << std::endl;
+                return -1;
+            }
+        }
+        if (strcmp(argv[i], "--no-vsync") == 0) {
+            isVsync = false;
+        }
+        // "--capture <directory> [frames]" writes every frame of the scripted drive (or of a replay) to a file,
+        // "--capture-size 1920x1080" and "--capture-format png|raw" choose the image
+        if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            isCapture = true;
+            captureDirectory = argv[++i];
+            if (i + 1 < argc && atoll(argv[i + 1]) > 0)
+                captureFrames = atoll(argv[++i]);
+        }
+        if (strcmp(argv[i], "--capture-size") == 0 && i + 1 < argc) {
+            if (!parseCaptureSize(argv[++i], captureWidth, captureHeight)) {
+                std::cout << "Invalid capture size: " << argv[i] << std::endl;
+                return -1;
+            }
+        }
+        if (strcmp(argv[i], "--capture-format") == 0 && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format != "png" && format != "raw") {
+                std::cout << "Invalid capture format: " << format << std::endl;
+                return -1;
+            }
+            captureFormat = format == "png" ? CAPTURE_PNG : CAPTURE_RAW;
+        }
+        // "--shadow-resolution 2048,2048,1024,1024" sets the resolution of every cascade
+        if (strcmp(argv[i], "--shadow-resolution") == 0 && i + 1 < argc) {
+            if (!parseShadowResolution(argv[++i])) {
+                std::cout << "Invalid shadow resolution: " << argv[i] << std::endl;
+                return -1;
+            }
+        }
+    }
+
+    if (isHeadless)
+        return runHeadless(headlessTicks);
+
+    // ------------------------------
+    //initialization
+    // ------------------------------
+
+    // window initialization
+    GLFWwindow* window = windowInit();
+
+    //OpenGL initialization
+    bool isInit = init();
+    if (window == NULL || !isInit) {
+        return -1;
+    }
+    // timer queries of the profiler
+    profiler.init();
+    // worker threads for the assets, the main thread keeps the GL context
+    unsigned int cores = std::thread::hardware_concurrency();
+    assetLoader.start(cores > 1 ? cores - 1 : 1);
+    gpuResources.init((size_t)(memoryBudgetMb * 1024.0 * 1024.0));
+    // FBO configuration of Depth Map
+    depthMapFBOInit();
+    // skybox configuration
+    skyboxInit();
+    // uniform buffer of the per-frame constants
+    frameConstantsInit();
+    // model matrices of the instanced draws
+    instanceBuffer.init(INSTANCE_BUFFER_CAPACITY);
+    // shared buffers and textures of all models, and the batch that draws them
+    geometryArena.init(ARENA_VERTEX_CAPACITY, ARENA_INDEX_CAPACITY);
+    textureArray.init(TEXTURE_LAYER_CAPACITY);
+    drawBatch.init();
+    // ground and walls of the track, before the scene is placed on it; its largest triangles are the occluders
+    occlusionCuller.start(SHADOW_CASCADE_COUNT, 2);
+    if (isClusteredLighting)
+        lightClusters.start(2);
+    if (!loadTrackCollision(FileSystem::getPath(RACE_TRACK_MODEL_PATH), true))
+        std::cout << "No track collision, the car drives on a plane" << std::endl;
+    profiler.recordStartup("track collision", elapsedMs(sessionStart));
+    // traffic and track-side signs
+    sceneInit(trafficCarCount, stopSignCount);
+
+    // ------------------------------
+    // model loading
+    // -------------------------------
+
+    // The models are decoded in the background while the shaders compile and the first frames are drawn
+    CachedModel carModel(FileSystem::getPath(CAR_MODEL_PATH));
+    CachedModel cameraModel(FileSystem::getPath(CAMERA_MODEL_PATH));
+    // a streamed track is drawn tile by tile, the whole model is only loaded without tiles
+    CachedModel raceTrackModel;
+    if (!trackStreamer.isOpen())
+        assetLoader.loadModel(raceTrackModel, FileSystem::getPath(RACE_TRACK_MODEL_PATH));
+    CachedModel stopSignModel(FileSystem::getPath(STOP_SIGN_MODEL_PATH));
+
+    // ------------------------------
+     // build and compile the shader
+     // ------------------------------
+
+    auto loadStart = std::chrono::steady_clock::now();
+     // shader that adds lighting and shadows to all objects, in the permutation of the shadow settings
+    if (!selectMainShader())
+        return -1;
+    // The depth-only permutation of the same shader generates depth information from the angle of the sun's parallel light
+    ShaderProgram* depthShader = shaderLibrary.get("shader/light_and_shadow.vs", "shader/light_and_shadow.fs", { "DEPTH_ONLY" });
+    // skybox shader
+    ShaderProgram* skyboxShader = shaderLibrary.get("shader/skybox.vs", "shader/skybox.fs", {});
+    if (depthShader == nullptr || skyboxShader == nullptr)
+        return -1;
+    if (!checkShaderInterface(depthShader, "shader/light_and_shadow.vs", false, true, false)
+        || !checkShaderInterface(skyboxShader, "shader/skybox.vs", true, false, false))
+        return -1;
+    profiler.recordStartup("shaders", elapsedMs(loadStart));
+
+    // ---------------------------------
+      // shader texture configuration
+      // ---------------------------------
+
+    skyboxShader->use();
+    skyboxShader->setInt("skybox", 0);
+
+    // The capture renders into its own framebuffer, in the size of the images
+    if (isCapture) {
+        if (!frameCapture.init(captureDirectory, captureWidth, captureHeight, captureFormat))
+            return -1;
+        renderWidth = captureWidth;
+        renderHeight = captureHeight;
+        isCameraFixed = true;
+        assetLoader.finishAll();
+    }
+
+    // The benchmark always looks at the car from the camera fixed behind it
+    if (isBenchmark) {
+        isCameraFixed = true;
+        // every measured frame has to fit into the history of the profiler
+        benchmarkFrames = std::min(benchmarkFrames, (long long)PROFILE_HISTORY_FRAMES - BENCHMARK_WARMUP_FRAMES);
+        // measure the complete scene, not the loading
+        assetLoader.finishAll();
+    }
+
+    // the first frame interpolates from the initial state
+    currentCarState = captureCarState(car, currentCarState);
+    previousCarState = currentCarState;
+    captureTraffic(trafficFleet, currentTraffic);
+    previousTraffic = currentTraffic;
+    if (!inputLogInit())
+        return -1;
+    lastFrame = glfwGetTime();
+    // every frame of the benchmark and of the capture advances the simulation by the same step, and renders
+    // the same number of pixels
+    if (isBenchmark || isCapture) {
+        isSimThread = false;
+        isDynamicResolution = false;
+        frameCap = 0.0;
+    }
+    resolutionController.init(frameBudgetMs);
+    framePacer.init(frameCap);
+    if (isSimThread)
+        startSimulationThread();
+
+    // ---------------------------------
+    // loop rendering
+    // ---------------------------------
+
+
+    while (!glfwWindowShouldClose(window)) {
+        // A minimized window is 0x0 and shows nothing, so nothing is rendered until it is restored; the capture
+        // renders into its own framebuffer
+        if ((windowWidth == 0 || windowHeight == 0) && !isCapture) {
+            glfwWaitEvents();
+            continue;
+        }
+        // wait before the input is sampled, not after, so the wait does not age the input
+        framePacer.wait();
+        profiler.beginFrame();
+        cullingStats = CullingStats();
+        instanceBuffer.beginFrame();
+        profiler.beginPass(PROFILE_INPUT);
+
+        // Calculate the length of a frame to make the frame drawing speed even
+        setDeltaTime();
+        // Change light source position over time
+                // changeLightPosAsTime();
+
+                // listen for keystrokes
+        SimInput input = isBenchmark || (isCapture && !inputLog.isReplaying()) ? scriptedInput(simTick) : handleKeyInput(window);
+        markKeyInput(input.keys);
+
+        if (isSimThread) {
+            // the simulation thread ticks on its own, this frame shows its newest state
+            sampledKeys = input.keys;
+            updateFromSnapshots();
+        }
+        else {
+            // Run as many fixed ticks as the elapsed time requires, then interpolate the rest
+            advanceSimulation(input);
+        }
+        profiler.endPass(PROFILE_INPUT);
+
+        // models and textures that finished decoding since the last frame
+        profiler.beginPass(PROFILE_UPLOAD);
+        // Tiles of the track around the car and ahead of it. The benchmark and the capture wait for them,
+        // so that every run draws the same
+        if (trackStreamer.update(renderCarState.midValPosition, deltaTime) && (isBenchmark || isCapture))
+            assetLoader.finishAll();
+        assetLoader.update(ASSET_UPLOAD_BUDGET_MS);
+        gpuResources.enforceBudget();
+        profiler.endPass(PROFILE_UPLOAD);
+
+        // size of this frame, before the projection is built for it
+        updateRenderSize();
+
+        // Camera matrices, shadow cascades and lighting of this frame, shared by all passes
+        updateFrameConstants();
+        // the workers rasterize the occluders of every view while the static layers render
+        occlusionCuller.beginFrame(frameConstants.projection * frameConstants.view, frameConstants.lightSpaceMatrices,
+            isShadowEnabled ? SHADOW_CASCADE_COUNT : 0);
+        // and bin the lights
+        if (isClusteredLighting)
+            lightClusters.beginFrame(collectLights(), frameConstants.view, frameConstants.projection);
+
+        // ---------------------------------
+        // passes of the frame, and what they read and write
+        // ---------------------------------
+
+        renderGraph.reset();
+        RenderResource windowTarget = renderGraph.importFramebuffer("window", 0, windowWidth, windowHeight,
+            GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, true);
+
+        // Render the entire scene from the light source, once per cascade. Without shadows nothing reads the
+        // cascades, and the graph culls their passes
+        RenderResource cascadeMaps[SHADOW_CASCADE_COUNT];
+        for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+            ShadowCascade& cascade = shadowCascades[i];
+            RenderResource staticMap = renderGraph.importFramebuffer("static shadow", cascade.staticDepthMapFBO,
+                cascade.staticResolution, cascade.staticResolution, GL_DEPTH_BUFFER_BIT, false);
+            cascadeMaps[i] = renderGraph.importFramebuffer("shadow cascade", cascade.depthMapFBO,
+                cascade.resolution, cascade.resolution, GL_DEPTH_BUFFER_BIT, false);
+
+            // The track and the Stop card never move, they are only rendered again when the static layer is invalid
+            if (cascade.isStaticDirty) {
+                int staticPass = renderGraph.addPass("static shadow", PROFILE_SHADOW, [&, i]() {
+                    ShadowCascade& cascade = shadowCascades[i];
+                    depthShader->setLightSpaceMatrix(cascade.staticLightSpaceMatrix);
+                    // the static layer has the texel size of the cascade
+                    float staticHalfSize = cascade.radius * cascade.staticResolution / cascade.resolution;
+                    DrawView staticView = makeOrthographicView(cascade.staticLightSpaceMatrix, staticHalfSize, SHADOW_LOD_BIAS);
+                    renderRaceTrack(raceTrackModel, staticView);
+                    renderStopSigns(stopSignModel, staticView);
+                    cascade.isStaticDirty = false;
+                });
+                renderGraph.setShader(staticPass, depthShader);
+                renderGraph.write(staticPass, staticMap, RENDER_CLEAR);
+            }
+
+            int cascadePass = renderGraph.addPass("shadow cascade", PROFILE_SHADOW, [&, i, staticMap]() {
+                ShadowCascade& cascade = shadowCascades[i];
+                // Copy the part of the static layer covered by the cascade, it has the same texel size and depth range
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, renderGraph.getFramebuffer(staticMap));
+                glBlitFramebuffer(
+                    cascade.staticOffsetX, cascade.staticOffsetY,
+                    cascade.staticOffsetX + cascade.resolution, cascade.staticOffsetY + cascade.resolution,
+                    0, 0, cascade.resolution, cascade.resolution,
+                    GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+                // Use the depth shader to render the moving objects on top of it
+                depthShader->setLightSpaceMatrix(cascade.lightSpaceMatrix);
+                DrawView cascadeView = makeOrthographicView(cascade.lightSpaceMatrix, cascade.radius, SHADOW_LOD_BIAS);
+                cascadeView.occlusion = occlusionCuller.getCascade(i);
+                renderCarAndCamera(carModel, cameraModel, cascadeView);
+                renderTrafficCars(carModel, cascadeView);
+            });
+            renderGraph.setShader(cascadePass, depthShader);
+            renderGraph.read(cascadePass, staticMap);
+            renderGraph.write(cascadePass, cascadeMaps[i]);
+        }
+
+        // The scene is rendered into the capture, into the lower left render size of textures of the window size
+        // that is scaled up to the window, or directly into the window. The textures keep their size while the
+        // dynamic resolution changes the render size, so they stay in the pool
+        std::vector<RenderResource> sceneTargets;
+        if (frameCapture.isActive()) {
+            sceneTargets.push_back(renderGraph.importFramebuffer("capture", frameCapture.getFramebuffer(), renderWidth, renderHeight,
+                GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, false));
+        }
+        else if (renderWidth != windowWidth || renderHeight != windowHeight) {
+            sceneTargets.push_back(renderGraph.createTexture("scene color", windowWidth, windowHeight, GL_RGBA8));
+            sceneTargets.push_back(renderGraph.createTexture("scene depth", windowWidth, windowHeight, GL_DEPTH_COMPONENT24));
+        }
+        else {
+            sceneTargets.push_back(windowTarget);
+        }
+
+        // ---------------------------------
+        // model rendering
+        // ---------------------------------
+
+        int mainPass = renderGraph.addPass("main", PROFILE_MAIN, [&]() {
+            // the newest mouse movement and simulation state, just before the camera is used
+            if (!isBenchmark && !isCapture)
+                latchViewCamera(window);
+
+            // Set lighting related properties
+            renderLight();
+
+            // only what the camera can see
+            DrawView cameraView = makePerspectiveView(frameConstants.view, frameConstants.projection, 1.0f);
+            cameraView.occlusion = occlusionCuller.getCamera();
+
+            // Use shader to render car and Camera (hierarchical model)
+            renderCarAndCamera(carModel, cameraModel, cameraView);
+            renderTrafficCars(carModel, cameraView);
+
+            // Render the Stop cards
+            renderStopSigns(stopSignModel, cameraView);
+
+            // render the track
+            renderRaceTrack(raceTrackModel, cameraView);
+        });
+        renderGraph.setShader(mainPass, mainShader);
+        renderGraph.setViewport(mainPass, renderWidth, renderHeight);
+        for (RenderResource target : sceneTargets)
+            renderGraph.write(mainPass, target, RENDER_CLEAR);
+        for (int i = 0; isShadowEnabled && i < SHADOW_CASCADE_COUNT; i++)
+            renderGraph.read(mainPass, cascadeMaps[i]);
+
+        // Finally render the skybox, where the depth is still 1.0
+        int skyboxPass = renderGraph.addPass("skybox", PROFILE_SKYBOX, []() {
+            renderSkyBox();
+        });
+        renderGraph.setShader(skyboxPass, skyboxShader);
+        renderGraph.setDepthFunc(skyboxPass, GL_LEQUAL);
+        renderGraph.setViewport(skyboxPass, renderWidth, renderHeight);
+        for (RenderResource target : sceneTargets)
+            renderGraph.write(skyboxPass, target);
+
+        // read the frame back without waiting for it, or scale it up, and show it in the window
+        if (frameCapture.isActive()) {
+            int capturePass = renderGraph.addPass("capture", PROFILE_PASS_COUNT, []() {
+                frameCapture.endFrame(windowWidth, windowHeight);
+            });
+            renderGraph.read(capturePass, sceneTargets[0]);
+            renderGraph.write(capturePass, windowTarget);
+        }
+        else if (sceneTargets[0] != windowTarget) {
+            RenderResource sceneColor = sceneTargets[0];
+            int upscalePass = renderGraph.addPass("upscale", PROFILE_PASS_COUNT, [sceneColor]() {
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, renderGraph.getFramebuffer(sceneColor));
+                glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+            });
+            renderGraph.read(upscalePass, sceneColor);
+            renderGraph.write(upscalePass, windowTarget);
+        }
+
+        // The overlay shows the average of the last frames
+        if (isProfilerOverlay) {
+            int overlayPass = renderGraph.addPass("profiler overlay", PROFILE_PASS_COUNT, []() {
+                profiler.drawOverlay(windowWidth, windowHeight);
+            });
+            renderGraph.write(overlayPass, windowTarget);
+        }
+
+        renderGraph.compile();
+        renderGraph.execute();
+
+        // the title bar shows the numbers of the overlay
+        if (isProfilerOverlay) {
+            if (profiler.getFrame() % 30 == 0) {
+                std::string culling = " | meshes " + std::to_string(cullingStats.drawn) + " drawn, " + std::to_string(cullingStats.culled)
+                    + " culled, " + std::to_string(cullingStats.occluded) + " occluded, " + std::to_string(cullingStats.triangles) + " triangles, " + std::to_string(cullingStats.drawCalls)
+                    + " draw calls | " + std::to_string(renderWidth) + "x" + std::to_string(renderHeight) + ", shadows 1/"
+                    + std::to_string(1 << resolutionController.getShadowLevel()) + " | passes " + std::to_string(renderGraph.getExecutedPassCount())
+                    + ", " + std::to_string(renderGraph.getCulledPassCount()) + " culled | memory "
+                    + std::to_string((int)round(toMegabytes(gpuResources.getGpuBytes()))) + " MB";
+                if (isClusteredLighting) {
+                    culling += " | lights " + std::to_string(lightClusters.getLightCount()) + ", "
+                        + std::to_string(lightClusters.getIndexCount()) + " in clusters";
+                }
+                if (trackStreamer.isOpen())
+                    culling += " | tiles " + std::to_string(trackStreamer.getLoadedCount()) + "/" + std::to_string(trackStreamer.getTileCount());
+                TimingSummary latency = framePacer.latencySummary(60);
+                if (latency.max > 0.0)
+                    culling += " | input latency " + std::to_string((int)round(latency.p50)) + " ms";
+                glfwSetWindowTitle(window, (u8"Race car game | " + profiler.summary(60) + culling).c_str());
+            }
+        }
+
+        profiler.beginPass(PROFILE_SWAP);
+        // swap buffers and investigate IO events (key pressed, mouse movement, etc.)
+        glfwSwapBuffers(window);
+        framePacer.framePresented();
+
+        // poll for events
+        glfwPollEvents();
+        profiler.endPass(PROFILE_SWAP);
+        profiler.endFrame();
+        if (profiler.getFrame() == 1)
+            profiler.recordStartup("first frame", elapsedMs(sessionStart));
+
+        if (isBenchmark && profiler.getFrame() >= BENCHMARK_WARMUP_FRAMES + benchmarkFrames)
+            glfwSetWindowShouldClose(window, true);
+        if (isCapture && frameCapture.getFrameCount() >= captureFrames)
+            glfwSetWindowShouldClose(window, true);
+        // A replay ends with the log
+        long long shownTick = isSimThread ? currentSnapshot.tick : simTick;
+        if (inputLog.isReplaying() && shownTick >= inputLog.getEndTick())
+            glfwSetWindowShouldClose(window, true);
+    }
+    if (isSimThread)
+        stopSimulationThread();
+    inputLog.finish(simTick);
+    framePacer.finish();
+    occlusionCuller.stop();
+    lightClusters.stop();
+    // the last frames are still in the pixel buffers and the encoders
+    if (frameCapture.isActive())
+        frameCapture.finish();
+
+    // report the measured frames of the benchmark
+    if (isBenchmark) {
+        profiler.finish();
+        profiler.writeBenchmark(std::cout, BENCHMARK_WARMUP_FRAMES);
+    }
+
+    // write the timings of the last frames
+    if (!profileOutput.empty()) {
+        if (!isBenchmark)
+            profiler.finish();
+        profiler.writeCsv(profileOutput + ".csv");
+        profiler.writeJson(profileOutput + ".json");
+    }
+
+    // stop decoding before the models go away
+    assetLoader.stop();
+    trackStreamer.close();
+    // what the scene used, then free all of it while the context is still there
+    gpuResources.writeReport(std::cout);
+    mainShader = nullptr;
+    shaderLibrary.clear();
+    gpuResources.destroyAll();
+
+    // close glfw
+    glfwTerminate();
+    return 0;
+}
+
+// ------------------------------------------------------
+// other functions
+// ------------------------------------------------------
+
+
+// ---------------------------------
+// initialize
+// ---------------------------------
+
+GLFWwindow* windowInit()
+{
+    // The benchmark and the capture render into a hidden window. Without an X11 or Wayland display, GLFW 3.4 runs on
+    // its null platform and the context comes from EGL (surfaceless), or from OSMesa where EGL has no device
+    bool isDisplayless = false;
+#ifdef GLFW_PLATFORM_NULL
+    if ((isBenchmark || isCapture) && getenv("DISPLAY") == NULL && getenv("WAYLAND_DISPLAY") == NULL) {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+        isDisplayless = true;
+    }
+#endif
+    // initialize configuration
+    if (!glfwInit()) {
+        std::cout << "Failed to initialize GLFW";
+        if (isBenchmark || isCapture)
+            std::cout << " (without a display, GLFW 3.4 is needed, or run the benchmark or the capture under xvfb-run)";
+        std::cout << std::endl;
+        return NULL;
+    }
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (isBenchmark || isCapture)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    // create window; GL 4.3 draws the batches with glMultiDrawElementsIndirect, 3.3 is enough for the rest
+    GLFWwindow* window = createWindow();
+#ifdef GLFW_PLATFORM_NULL
+    if (window == NULL && isDisplayless) {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        window = createWindow();
+    }
+    if (window != NULL && isDisplayless)
+        std::cout << "[GL]no display, rendering through "
+            << (glfwGetWindowAttrib(window, GLFW_CONTEXT_CREATION_API) == GLFW_OSMESA_CONTEXT_API ? "OSMesa" : "EGL") << std::endl;
+#endif
+    if (window == NULL) {
+        std::cout << "Failed to create GLFW window" << std::endl;
+        glfwTerminate();
+        if (!isBenchmark && !isCapture)
+            system("pause");
+        return NULL;
+    }
+    glfwMakeContextCurrent(window);
+    // in pixels, which differ from screen coordinates on high DPI displays
+    glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+    // The benchmark measures the rendering, not the refresh rate of the monitor; without vsync the pacer caps the frames
+    if (isBenchmark || isCapture || !isVsync)
+        glfwSwapInterval(0);
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetCursorPosCallback(window, mouse_callback);
+    glfwSetScrollCallback(window, scroll_callback);
+    // Callback to monitor the key press (a key will only trigger an event once)
+    glfwSetKeyCallback(window, key_callback);
+
+    // Make GLFW capture the user's mouse
+    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+    return window;
+}
+
+// the newest of the context versions the game runs on, with the hints set so far
+GLFWwindow* createWindow()
+{
+    const int versions[2][2] = { { 4, 3 }, { 3, 3 } };
+    for (const auto& version : versions) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+        GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, u8"Race car game", NULL, NULL);
+        if (window != NULL)
+            return window;
+    }
+    return NULL;
+}
+
+bool init()
+{
+    // Load all OpenGL function pointers
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+        std::cout << "Failed to initialize GLAD" << std::endl;
+        system("pause");
+        return false;
+    }
+
+#ifndef USE_MULTI_DRAW_INDIRECT
+    std::cout << "[GL]glad was generated without GL 4.3 or GL_ARB_multi_draw_indirect, every draw of a batch is a call of its own" << std::endl;
+#endif
+#ifndef USE_PROGRAM_BINARY
+    std::cout << "[GL]glad was generated without GL 4.1 or GL_ARB_get_program_binary, the shaders are compiled on every start" << std::endl;
+#endif
+
+    // Configure global openGL state
+    glEnable(GL_DEPTH_TEST);
+
+    return true;
+}
+
+// the context has the features, either in its version or as extensions
+bool hasMultiDrawIndirect()
+{
+#ifdef GL_VERSION_4_3
+    if (GLAD_GL_VERSION_4_3)
+        return true;
+#endif
+#if defined(GL_ARB_multi_draw_indirect) && defined(GL_ARB_base_instance)
+    if (GLAD_GL_ARB_multi_draw_indirect && GLAD_GL_ARB_base_instance)
+        return true;
+#endif
+    return false;
+}
+
+bool hasProgramBinary()
+{
+#ifdef GL_VERSION_4_1
+    if (GLAD_GL_VERSION_4_1)
+        return true;
+#endif
+#ifdef GL_ARB_get_program_binary
+    if (GLAD_GL_ARB_get_program_binary)
+        return true;
+#endif
+    return false;
+}
+
+
+// depth map configuration, one depth texture and framebuffer per cascade
+void depthMapFBOInit()
+{
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        ShadowCascade& cascade = shadowCascades[i];
+
+        glGenFramebuffers(1, &cascade.depthMapFBO);
+
+        // create depth texture, its storage is allocated by resizeShadowMaps
+        glGenTextures(1, &cascade.depthMap);
+        glBindTexture(GL_TEXTURE_2D, cascade.depthMap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        float borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+
+        // Use the generated depth texture as the depth buffer of the framebuffer
+        glBindFramebuffer(GL_FRAMEBUFFER, cascade.depthMapFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, cascade.depthMap, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        // The static layer is only ever copied from, it needs no filtering or border
+        glGenFramebuffers(1, &cascade.staticDepthMapFBO);
+        glGenTextures(1, &cascade.staticDepthMap);
+        glBindTexture(GL_TEXTURE_2D, cascade.staticDepthMap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, cascade.staticDepthMapFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, cascade.staticDepthMap, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        // the storage is counted by resizeShadowMaps
+        unsigned int textures[2] = { cascade.depthMap, cascade.staticDepthMap };
+        unsigned int framebuffers[2] = { cascade.depthMapFBO, cascade.staticDepthMapFBO };
+        cascade.resource = gpuResources.create("shadow cascade " + std::to_string(i), MEMORY_SHADOW_MAP, 0, 0, 0,
+            [textures, framebuffers]() {
+                glDeleteTextures(2, textures);
+                glDeleteFramebuffers(2, framebuffers);
+            });
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    resizeShadowMaps(0);
+}
+
+// Allocate the depth textures of every cascade at 1 / 2^level of the configured resolution.
+// The framebuffers keep their attachments, only the storage of the textures is replaced
+void resizeShadowMaps(int level)
+{
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        ShadowCascade& cascade = shadowCascades[i];
+        cascade.resolution = std::max(shadowCascadeResolution[i] >> level, std::min(shadowCascadeResolution[i], SHADOW_MIN_RESOLUTION));
+        cascade.staticResolution = cascade.resolution + 2 * (unsigned int)(cascade.resolution * SHADOW_STATIC_GUARD_BAND);
+
+        glBindTexture(GL_TEXTURE_2D, cascade.depthMap);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, cascade.resolution, cascade.resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glBindTexture(GL_TEXTURE_2D, cascade.staticDepthMap);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, cascade.staticResolution, cascade.staticResolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        // the static layer was placed on the texel grid of the old resolution, so it is placed again
+        cascade.staticRadius = 0.0f;
+        cascade.isStaticDirty = true;
+        gpuResources.resize(cascade.resource, textureFormatBytes(GL_DEPTH_COMPONENT)
+            * ((size_t)cascade.resolution * cascade.resolution + (size_t)cascade.staticResolution * cascade.staticResolution), 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Parse a comma separated list with the resolution of every cascade
+bool parseShadowResolution(const char* arg)
+{
+    unsigned int resolution[SHADOW_CASCADE_COUNT];
+    const char* p = arg;
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        char* end;
+        long value = strtol(p, &end, 10);
+        if (end == p || value < 64 || value > 16384)
+            return false;
+        resolution[i] = (unsigned int)value;
+        p = (*end == ',') ? end + 1 : end;
+    }
+    if (*p != '\0')
+        return false;
+
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+        shadowCascadeResolution[i] = resolution[i];
+    return true;
+}
+
+// uniform buffer configuration, bound once to the binding point shared by all shaders
+void frameConstantsInit()
+{
+    glGenBuffers(1, &frameConstantsUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameConstantsUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameConstants), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_CONSTANTS_BINDING, frameConstantsUBO);
+}
+
+// skybox configuration
+void skyboxInit()
+{
+    // skybox VAO
+    glGenVertexArrays(1, &skyboxVAO);
+    glGenBuffers(1, &skyboxVBO);
+    glBindVertexArray(skyboxVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+
+
+    // texture loading, the sky has a single color until the faces arrive
+    cubemapTexture = createPlaceholderTexture(GL_TEXTURE_CUBE_MAP, PLACEHOLDER_SKY_COLOR);
+    cubemapResource = gpuResources.create("skybox placeholder", MEMORY_SKYBOX, 0, 6 * 4, 0, textureDeleter(cubemapTexture));
+    assetLoader.loadCubemap(faces);
+}
+
+
+// ---------------------------------
+// time related function
+// ---------------------------------
+
+// Calculate the duration of a frame
+void setDeltaTime()
+{
+    float currentFrame = glfwGetTime();
+    deltaTime = currentFrame - lastFrame;
+    lastFrame = currentFrame;
+
+    // every benchmark and capture run simulates exactly the same path, however fast the machine is
+    if (isBenchmark || isCapture)
+        deltaTime = BENCHMARK_FRAME_TIME;
+}
+
+// ---------------------------------
+// fixed timestep simulation
+// ---------------------------------
+
+// Advance the whole simulation by exactly one SIM_TIMESTEP; uses neither GLFW nor OpenGL
+void simulateTick(const SimInput& input)
+{
+    previousCarState = currentCarState;
+    previousCameraPos = currentCameraPos;
+
+    // The events of a tick come either from the live input or from the replayed log
+    applySimInput(processInputEvents(input), SIM_TIMESTEP);
+    car.UpdateDelayYaw();
+    car.UpdateDelayPosition();
+    currentCarState = captureCarState(car, currentCarState);
+
+    trafficFleet.tick(simTick);
+    std::swap(previousTraffic, currentTraffic);
+    captureTraffic(trafficFleet, currentTraffic);
+
+    // When switching to camera fixed, the camera follows the car on every tick
+    if (isCameraFixed) {
+        // Automatically gradually restore Zoom to default
+        camera.ZoomRecover();
+        updateFixedCamera(camera, fixedCamera, currentCarState);
+    }
+    currentCameraPos = camera.Position;
+
+    simTick++;
+}
+
+// Consume the frame time in fixed ticks and prepare the interpolated state used for rendering
+void advanceSimulation(const SimInput& input)
+{
+    simAccumulator += deltaTime;
+
+    int ticks = 0;
+    while (simAccumulator >= SIM_TIMESTEP && ticks < MAX_SIM_TICKS_PER_FRAME) {
+        simulateTick(input);
+        simAccumulator -= SIM_TIMESTEP;
+        ticks++;
+    }
+    // Drop the time that could not be caught up instead of accumulating an ever growing debt
+    if (simAccumulator > SIM_TIMESTEP)
+        simAccumulator = SIM_TIMESTEP;
+
+    float alpha = simAccumulator / SIM_TIMESTEP;
+    renderCarState = interpolateCarState(previousCarState, currentCarState, alpha);
+    updateTrafficInstances(previousTraffic, currentTraffic, alpha);
+
+    // The mouse changes the orientation of the camera directly, only the position needs to be interpolated
+    viewCamera = camera;
+    viewCamera.Position = glm::mix(previousCameraPos, currentCameraPos, alpha);
+    viewFixedCamera = fixedCamera;
+    isViewCameraFixed = isCameraFixed;
+    if (isCameraFixed)
+        updateFixedCamera(viewCamera, viewFixedCamera, renderCarState);
+}
+
+// From here on the simulation thread owns the car, the cameras and the input log; the main thread only
+// samples the keys, queues the events and reads the snapshots
+void startSimulationThread()
+{
+    publishSnapshot(std::chrono::steady_clock::now());
+    worldSnapshots.update();
+    previousSnapshot = worldSnapshots.getReadBuffer();
+    currentSnapshot = previousSnapshot;
+
+    isSimStopping = false;
+    simThread = std::thread(runSimulationThread);
+}
+
+void stopSimulationThread()
+{
+    isSimStopping = true;
+    if (simThread.joinable())
+        simThread.join();
+}
+
+// Tick at the fixed rate in real time, however long the frames take
+void runSimulationThread()
+{
+    auto step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(SIM_TIMESTEP));
+    auto due = std::chrono::steady_clock::now();
+    while (!isSimStopping) {
+        // A replay stops at the end of the log, the renderer closes the window when it sees the last tick
+        if (inputLog.isReplaying() && simTick >= inputLog.getEndTick()) {
+            std::this_thread::sleep_for(step);
+            continue;
+        }
+
+        SimInput input;
+        input.keys = sampledKeys;
+        simulateTick(input);
+        due += step;
+        publishSnapshot(due);
+
+        // like the single-threaded loop, time that cannot be caught up is dropped
+        auto now = std::chrono::steady_clock::now();
+        if (now - due > MAX_SIM_TICKS_PER_FRAME * step)
+            due = now;
+        std::this_thread::sleep_until(due);
+    }
+}
+
+void publishSnapshot(std::chrono::steady_clock::time_point time)
+{
+    WorldSnapshot& snapshot = worldSnapshots.getWriteBuffer();
+    snapshot.tick = simTick;
+    snapshot.time = time;
+    snapshot.car = currentCarState;
+    snapshot.traffic = currentTraffic;
+    snapshot.camera = camera;
+    snapshot.fixedCamera = fixedCamera;
+    snapshot.isCameraFixed = isCameraFixed;
+    worldSnapshots.publish();
+}
+
+// The renderer stays one tick behind the simulation thread and interpolates between the two newest snapshots
+void updateFromSnapshots()
+{
+    if (worldSnapshots.update()) {
+        previousSnapshot = currentSnapshot;
+        currentSnapshot = worldSnapshots.getReadBuffer();
+    }
+
+    float alpha = 1.0f;
+    if (currentSnapshot.time > previousSnapshot.time) {
+        auto renderTime = std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<float>(SIM_TIMESTEP));
+        alpha = std::chrono::duration<float>(renderTime - previousSnapshot.time).count()
+            / std::chrono::duration<float>(currentSnapshot.time - previousSnapshot.time).count();
+        alpha = glm::clamp(alpha, 0.0f, 1.0f);
+    }
+    renderCarState = interpolateCarState(previousSnapshot.car, currentSnapshot.car, alpha);
+    updateTrafficInstances(previousSnapshot.traffic, currentSnapshot.traffic, alpha);
+
+    viewCamera = currentSnapshot.camera;
+    viewCamera.Position = glm::mix(previousSnapshot.camera.Position, currentSnapshot.camera.Position, alpha);
+    viewFixedCamera = currentSnapshot.fixedCamera;
+    isViewCameraFixed = currentSnapshot.isCameraFixed;
+    if (isViewCameraFixed)
+        updateFixedCamera(viewCamera, viewFixedCamera, renderCarState);
+}
+
+// Input used when there is no keyboard: drive forward and keep turning left, so the car goes round in circles
+SimInput scriptedInput(long long tick)
+{
+    SimInput input;
+    input.keys = INPUT_CAR_FORWARD;
+    if (tick % 240 < 180)
+        input.keys |= INPUT_CAR_LEFT;
+    return input;
+}
+
+// Run the simulation without window and OpenGL context, as fast as possible
+int runHeadless(long long ticks)
+{
+    if (!loadTrackCollision(FileSystem::getPath(RACE_TRACK_MODEL_PATH), false))
+        std::cout << "No track collision, the car drives on a plane" << std::endl;
+    trafficFleet.init(trafficCarCount, SCENE_RING_RADIUS);
+    currentCarState = captureCarState(car, currentCarState);
+    previousCarState = currentCarState;
+    if (!inputLogInit())
+        return -1;
+
+    // A replay runs exactly as many ticks as were recorded
+    if (ticks <= 0)
+        ticks = inputLog.isReplaying() ? inputLog.getEndTick() : 120 * 60 * 10;
+
+    auto start = std::chrono::steady_clock::now();
+    for (long long i = 0; i < ticks; i++) {
+        simulateTick(scriptedInput(simTick));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    glm::vec3 position = currentCarState.midValPosition;
+    std::cout << "[HEADLESS]" << ticks << " ticks (" << ticks * SIM_TIMESTEP << " s simulated) in "
+        << seconds << " s, " << (seconds > 0.0 ? ticks / seconds : 0.0) << " ticks/s" << std::endl;
+    std::cout << "[HEADLESS]car position (" << position.x << ", " << position.y << ", " << position.z
+        << ") yaw " << currentCarState.yaw << std::endl;
+    if (trafficFleet.getCount() > 0) {
+        std::cout << "[HEADLESS]" << trafficFleet.getCount() << " traffic cars, "
+            << (seconds > 0.0 ? ticks * trafficFleet.getCount() / seconds : 0.0) << " car ticks/s" << std::endl;
+    }
+    inputLog.finish(simTick);
+    return 0;
+}
+
+// ---------------------------------
+// track collision
+// ---------------------------------
+
+// Runs before the models are loaded, so the asset loader finds the cache written here. The collision and the
+// occluders are always built from the whole track, streamed or not; only a rendering run needs the occluders and
+// the tiles, so the headless simulation writes no tile file
+bool loadTrackCollision(const std::string& path, bool isRendering)
+{
+    auto start = std::chrono::steady_clock::now();
+    AssetUpload upload;
+    if (!readModel(path, upload) || !trackCollision.build(upload.header, upload.getSections()))
+        return false;
+    if (isRendering && isOcclusionCulling)
+        occlusionCuller.setOccluders(selectOccluders(upload.header, upload.getSections()));
+    gpuResources.create("track collision", MEMORY_COLLISION, 0, 0, trackCollision.getMemoryBytes(), nullptr);
+    if (isRendering && isTrackStreaming && !trackStreamer.open(path, upload.header, upload.getSections()))
+        std::cout << "No track tiles, the whole track is loaded" << std::endl;
+
+    std::cout << "[TRACK]" << trackCollision.getGroundTriangleCount() << " ground and " << trackCollision.getWallTriangleCount()
+        << " wall triangles in " << elapsedMs(start) << " ms" << std::endl;
+    return true;
+}
+
+bool TrackCollision::build(const ModelCacheHeader& header, const unsigned char* sections)
+{
+    const ModelVertex* vertices = (const ModelVertex*)sections;
+    const unsigned int* indices = (const unsigned int*)(sections + header.vertexCount * sizeof(ModelVertex));
+    const ModelMeshEntry* meshes = (const ModelMeshEntry*)(indices + header.indexCount);
+
+    std::vector<glm::vec3> groundTriangles;
+    std::vector<glm::vec3> wallTriangles;
+    for (unsigned int i = 0; i < header.meshCount; i++) {
+        const ModelMeshEntry& mesh = meshes[i];
+        for (unsigned int j = 0; j + 2 < mesh.indexCount; j += 3) {
+            glm::vec3 a = vertices[mesh.baseVertex + indices[mesh.firstIndex + j]].position;
+            glm::vec3 b = vertices[mesh.baseVertex + indices[mesh.firstIndex + j + 1]].position;
+            glm::vec3 c = vertices[mesh.baseVertex + indices[mesh.firstIndex + j + 2]].position;
+            glm::vec3 normal = glm::cross(b - a, c - a);
+            float length = glm::length(normal);
+            if (length == 0.0f)
+                continue;
+
+            std::vector<glm::vec3>& triangles = fabs(normal.y / length) < TRACK_WALL_NORMAL_Y ? wallTriangles : groundTriangles;
+            triangles.push_back(a);
+            triangles.push_back(b);
+            triangles.push_back(c);
+        }
+    }
+    ground.build(groundTriangles);
+    walls.build(wallTriangles);
+    return true;
+}
+
+bool TrackCollision::groundAt(const glm::vec3& position, TrackHit& hit) const
+{
+    glm::vec3 origin = position + glm::vec3(0.0f, TRACK_PROBE_HEIGHT, 0.0f);
+    return ground.raycast(origin, glm::vec3(0.0f, -1.0f, 0.0f), std::numeric_limits<float>::max(), hit);
+}
+
+void TrackCollision::groundAt(const glm::vec3* positions, size_t count, TrackHit* hits, bool* found) const
+{
+    glm::vec3 origins[RAY_PACKET_SIZE];
+    for (size_t first = 0; first < count; first += RAY_PACKET_SIZE) {
+        int rayCount = (int)std::min(count - first, (size_t)RAY_PACKET_SIZE);
+        for (int i = 0; i < rayCount; i++)
+            origins[i] = positions[first + i] + glm::vec3(0.0f, TRACK_PROBE_HEIGHT, 0.0f);
+        ground.raycast(origins, rayCount, glm::vec3(0.0f, -1.0f, 0.0f), std::numeric_limits<float>::max(), hits + first, found + first);
+    }
+}
+
+bool TrackCollision::sweepCar(const glm::vec3& from, const glm::vec3& to, TrackHit* contact) const
+{
+    glm::vec3 move(to.x - from.x, 0.0f, to.z - from.z);
+    float length = glm::length(move);
+    if (length == 0.0f || walls.getTriangleCount() == 0)
+        return false;
+    glm::vec3 direction = move / length;
+    glm::vec3 side(-direction.z, 0.0f, direction.x);
+
+    TrackHit ground;
+    float base = groundAt(from, ground) ? ground.point.y : from.y;
+    const float heights[2] = { base + 0.25f * CAR_COLLISION_HEIGHT, base + CAR_COLLISION_HEIGHT };
+    const float offsets[3] = { -CAR_COLLISION_RADIUS, 0.0f, CAR_COLLISION_RADIUS };
+    for (float height : heights) {
+        for (float offset : offsets) {
+            glm::vec3 origin = glm::vec3(from.x, height, from.z) + side * offset;
+            TrackHit hit;
+            if (walls.raycast(origin, direction, length + CAR_COLLISION_RADIUS, hit)) {
+                if (contact != nullptr)
+                    *contact = hit;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Median split on the longest axis of the triangle centers, until a node has at most four triangles
+void TriangleBvh::build(const std::vector<glm::vec3>& triangles)
+{
+    nodes.clear();
+    packets.clear();
+    triangleCount = triangles.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    std::vector<unsigned int> order(triangleCount);
+    std::vector<glm::vec3> centers(triangleCount);
+    for (size_t i = 0; i < triangleCount; i++) {
+        order[i] = (unsigned int)i;
+        centers[i] = (triangles[3 * i] + triangles[3 * i + 1] + triangles[3 * i + 2]) / 3.0f;
+    }
+
+    // node and the range of "order" it covers
+    struct BuildRange {
+        unsigned int node;
+        unsigned int begin;
+        unsigned int end;
+    };
+    std::vector<BuildRange> ranges;
+    nodes.push_back(BvhNode());
+    ranges.push_back({ 0, 0, (unsigned int)triangleCount });
+    while (!ranges.empty()) {
+        BuildRange range = ranges.back();
+        ranges.pop_back();
+
+        glm::vec3 boundsMin, boundsMax, centerMin, centerMax;
+        for (unsigned int i = range.begin; i < range.end; i++) {
+            for (int k = 0; k < 3; k++) {
+                const glm::vec3& vertex = triangles[3 * order[i] + k];
+                bool isFirst = i == range.begin && k == 0;
+                boundsMin = isFirst ? vertex : glm::min(boundsMin, vertex);
+                boundsMax = isFirst ? vertex : glm::max(boundsMax, vertex);
+            }
+            const glm::vec3& center = centers[order[i]];
+            centerMin = i == range.begin ? center : glm::min(centerMin, center);
+            centerMax = i == range.begin ? center : glm::max(centerMax, center);
+        }
+        nodes[range.node].boundsMin = boundsMin;
+        nodes[range.node].boundsMax = boundsMax;
+
+        unsigned int count = range.end - range.begin;
+        if (count <= 4) {
+            TrianglePacket packet = {};
+            for (unsigned int lane = 0; lane < count; lane++) {
+                const glm::vec3* vertex = &triangles[3 * order[range.begin + lane]];
+                for (int axis = 0; axis < 3; axis++) {
+                    packet.v0[axis][lane] = vertex[0][axis];
+                    packet.edge1[axis][lane] = vertex[1][axis] - vertex[0][axis];
+                    packet.edge2[axis][lane] = vertex[2][axis] - vertex[0][axis];
+                }
+            }
+            nodes[range.node].first = (unsigned int)packets.size();
+            nodes[range.node].count = count;
+            packets.push_back(packet);
+            continue;
+        }
+
+        glm::vec3 extent = centerMax - centerMin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        unsigned int middle = range.begin + count / 2;
+        std::nth_element(order.begin() + range.begin, order.begin() + middle, order.begin() + range.end,
+            [&centers, axis](unsigned int a, unsigned int b) { return centers[a][axis] < centers[b][axis]; });
+
+        unsigned int first = (unsigned int)nodes.size();
+        nodes[range.node].first = first;
+        nodes[range.node].count = 0;
+        nodes.push_back(BvhNode());
+        nodes.push_back(BvhNode());
+        ranges.push_back({ first, range.begin, middle });
+        ranges.push_back({ first + 1, middle, range.end });
+    }
+}
+
+bool TriangleBvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, TrackHit& hit) const
+{
+    if (nodes.empty())
+        return false;
+
+    // the slab test works with the infinities of axis-aligned directions
+    glm::vec3 inverseDirection = 1.0f / direction;
+    float nearest = maxDistance;
+    const TrianglePacket* hitPacket = nullptr;
+    int hitLane = 0;
+
+    // The depth of a median split tree is the logarithm of the triangle count
+    unsigned int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const BvhNode& node = nodes[stack[--top]];
+        if (!isRayInBox(node, origin, inverseDirection, nearest))
+            continue;
+
+        if (node.count > 0) {
+            int lane;
+            if (intersectPacket(packets[node.first], origin, direction, nearest, lane)) {
+                hitPacket = &packets[node.first];
+                hitLane = lane;
+            }
+            continue;
+        }
+        stack[top++] = node.first;
+        stack[top++] = node.first + 1;
+    }
+    if (hitPacket == nullptr)
+        return false;
+
+    setPacketHit(*hitPacket, hitLane, origin, direction, nearest, hit);
+    return true;
+}
+
+// A node is visited once for all rays that reach it, and its triangles are tested against each of them with the
+// packet test. Every ray sees the nodes in the order and with the pruning of the single ray query, so the hits
+// are the same
+void TriangleBvh::raycast(const glm::vec3* origins, int rayCount, const glm::vec3& direction, float maxDistance,
+    TrackHit* hits, bool* found) const
+{
+    float nearest[RAY_PACKET_SIZE];
+    const TrianglePacket* hitPackets[RAY_PACKET_SIZE];
+    int hitLanes[RAY_PACKET_SIZE];
+    for (int i = 0; i < rayCount; i++) {
+        nearest[i] = maxDistance;
+        hitPackets[i] = nullptr;
+        hitLanes[i] = 0;
+        found[i] = false;
+    }
+    if (nodes.empty())
+        return;
+
+    glm::vec3 inverseDirection = 1.0f / direction;
+    // a node with the rays that reached its parent, one bit per ray
+    struct StackEntry {
+        unsigned int node;
+        unsigned int rays;
+    };
+    StackEntry stack[64];
+    int top = 0;
+    stack[top++] = { 0, (1u << rayCount) - 1 };
+    while (top > 0) {
+        StackEntry entry = stack[--top];
+        const BvhNode& node = nodes[entry.node];
+        unsigned int rays = 0;
+        for (int i = 0; i < rayCount; i++) {
+            if ((entry.rays & (1u << i)) && isRayInBox(node, origins[i], inverseDirection, nearest[i]))
+                rays |= 1u << i;
+        }
+        if (rays == 0)
+            continue;
+
+        if (node.count > 0) {
+            const TrianglePacket& packet = packets[node.first];
+            for (int i = 0; i < rayCount; i++) {
+                int lane;
+                if ((rays & (1u << i)) && intersectPacket(packet, origins[i], direction, nearest[i], lane)) {
+                    hitPackets[i] = &packet;
+                    hitLanes[i] = lane;
+                }
+            }
+            continue;
+        }
+        stack[top++] = { node.first, rays };
+        stack[top++] = { node.first + 1, rays };
+    }
+
+    for (int i = 0; i < rayCount; i++) {
+        if (hitPackets[i] != nullptr) {
+            setPacketHit(*hitPackets[i], hitLanes[i], origins[i], direction, nearest[i], hits[i]);
+            found[i] = true;
+        }
+    }
+}
+
+// Slab test: whether the ray enters the box before maxDistance
+bool isRayInBox(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance)
+{
+    glm::vec3 t0 = (node.boundsMin - origin) * inverseDirection;
+    glm::vec3 t1 = (node.boundsMax - origin) * inverseDirection;
+    glm::vec3 tMin = glm::min(t0, t1);
+    glm::vec3 tMax = glm::max(t0, t1);
+    float enter = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+    float exit = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, maxDistance));
+    // NaN bounds from a zero offset times an infinite inverse are not culled
+    return !(enter > exit);
+}
+
+// The hit on the triangle in "lane" of the packet, with its normal facing the ray
+void setPacketHit(const TrianglePacket& packet, int lane, const glm::vec3& origin, const glm::vec3& direction, float distance, TrackHit& hit)
+{
+    glm::vec3 edge1(packet.edge1[0][lane], packet.edge1[1][lane], packet.edge1[2][lane]);
+    glm::vec3 edge2(packet.edge2[0][lane], packet.edge2[1][lane], packet.edge2[2][lane]);
+    hit.distance = distance;
+    hit.point = origin + direction * distance;
+    hit.normal = glm::normalize(glm::cross(edge1, edge2));
+    if (glm::dot(hit.normal, direction) > 0.0f)
+        hit.normal = -hit.normal;
+}
+
+// Moller-Trumbore against the four triangles of the packet. Returns the lane of the nearest hit closer
+// than "distance" and updates the distance
+bool intersectPacket(const TrianglePacket& packet, const glm::vec3& origin, const glm::vec3& direction, float& distance, int& lane)
+{
+#ifdef USE_SSE2
+    auto dot = [](__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+    };
+    auto crossComponent = [](__m128 a1, __m128 b2, __m128 a2, __m128 b1) {
+        return _mm_sub_ps(_mm_mul_ps(a1, b2), _mm_mul_ps(a2, b1));
+    };
+
+    __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+    __m128 e1x = _mm_load_ps(packet.edge1[0]), e1y = _mm_load_ps(packet.edge1[1]), e1z = _mm_load_ps(packet.edge1[2]);
+    __m128 e2x = _mm_load_ps(packet.edge2[0]), e2y = _mm_load_ps(packet.edge2[1]), e2z = _mm_load_ps(packet.edge2[2]);
+
+    // p = direction x edge2
+    __m128 px = crossComponent(dy, e2z, dz, e2y);
+    __m128 py = crossComponent(dz, e2x, dx, e2z);
+    __m128 pz = crossComponent(dx, e2y, dy, e2x);
+    __m128 det = dot(e1x, e1y, e1z, px, py, pz);
+    __m128 inverseDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    __m128 tx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_load_ps(packet.v0[0]));
+    __m128 ty = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_load_ps(packet.v0[1]));
+    __m128 tz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_load_ps(packet.v0[2]));
+    __m128 u = _mm_mul_ps(dot(tx, ty, tz, px, py, pz), inverseDet);
+
+    // q = t x edge1
+    __m128 qx = crossComponent(ty, e1z, tz, e1y);
+    __m128 qy = crossComponent(tz, e1x, tx, e1z);
+    __m128 qz = crossComponent(tx, e1y, ty, e1x);
+    __m128 v = _mm_mul_ps(dot(dx, dy, dz, qx, qy, qz), inverseDet);
+    __m128 t = _mm_mul_ps(dot(e2x, e2y, e2z, qx, qy, qz), inverseDet);
+
+    // parallel rays and the empty lanes have a zero determinant
+    __m128 zero = _mm_setzero_ps();
+    __m128 mask = _mm_cmpneq_ps(det, zero);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, zero));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(distance)));
+    int hits = _mm_movemask_ps(mask);
+    if (hits == 0)
+        return false;
+
+    alignas(16) float distances[4];
+    _mm_store_ps(distances, t);
+    for (int i = 0; i < 4; i++) {
+        if ((hits & (1 << i)) && distances[i] < distance) {
+            distance = distances[i];
+            lane = i;
+        }
+    }
+    return true;
+#else
+    bool isHit = false;
+    for (int i = 0; i < 4; i++) {
+        glm::vec3 edge1(packet.edge1[0][i], packet.edge1[1][i], packet.edge1[2][i]);
+        glm::vec3 edge2(packet.edge2[0][i], packet.edge2[1][i], packet.edge2[2][i]);
+        glm::vec3 p = glm::cross(direction, edge2);
+        float det = glm::dot(edge1, p);
+        if (det == 0.0f)
+            continue;
+        glm::vec3 toOrigin = origin - glm::vec3(packet.v0[0][i], packet.v0[1][i], packet.v0[2][i]);
+        float u = glm::dot(toOrigin, p) / det;
+        glm::vec3 q = glm::cross(toOrigin, edge1);
+        float v = glm::dot(direction, q) / det;
+        float t = glm::dot(edge2, q) / det;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < distance) {
+            distance = t;
+            lane = i;
+            isHit = true;
+        }
+    }
+    return isHit;
+#endif
+}
+
+// ---------------------------------
+// traffic fleet
+// ---------------------------------
+
+// The cars start evenly spread over two lanes of the ring and drive counterclockwise at different speeds
+void CarFleet::init(int carCount, float ringRadius)
+{
+    count = (size_t)std::max(carCount, 0);
+    for (std::vector<float>* values : { &positionX, &positionZ, &directionX, &directionZ, &stepDistance, &turnCos, &turnSin,
+        &midValX, &midValZ, &midValDirectionX, &midValDirectionZ, &height })
+        values->assign(count, 0.0f);
+
+    std::vector<glm::vec3> positions(count);
+    for (size_t i = 0; i < count; i++) {
+        float angle = glm::radians(360.0f * i / count);
+        float radius = ringRadius + ((i & 1) ? 2.0f : -2.0f);
+        // a fixed spread of speeds, the same on every run
+        float speed = CAR_FLEET_SPEED * (0.8f + 0.4f * ((i * 37) % 100) / 100.0f);
+        float turn = speed * SIM_TIMESTEP / radius;
+
+        positionX[i] = midValX[i] = radius * cos(angle);
+        positionZ[i] = midValZ[i] = radius * sin(angle);
+        directionX[i] = midValDirectionX[i] = -sin(angle);
+        directionZ[i] = midValDirectionZ[i] = cos(angle);
+        stepDistance[i] = speed * SIM_TIMESTEP;
+        turnCos[i] = cos(turn);
+        turnSin[i] = sin(turn);
+        positions[i] = glm::vec3(positionX[i], CAR_GROUND_CLEARANCE, positionZ[i]);
+    }
+
+    // stand on the track where there is one
+    std::vector<TrackHit> grounds(count);
+    std::unique_ptr<bool[]> isOnGround(new bool[count]);
+    trackCollision.groundAt(positions.data(), count, grounds.data(), isOnGround.get());
+    for (size_t i = 0; i < count; i++)
+        height[i] = isOnGround[i] ? grounds[i].point.y + CAR_GROUND_CLEARANCE : CAR_GROUND_CLEARANCE;
+}
+
+// Turn the direction, move along it and let the delayed values follow. The direction is kept at unit length with
+// one Newton step of 1 / sqrt(length^2) around 1, which needs neither a square root nor a division. All three paths
+// round after every multiply and add, without fused multiply-adds, so a replay gives the same cars on every CPU
+void CarFleet::tick(long long tick)
+{
+    size_t i = 0;
+#ifdef USE_AVX2
+    {
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 threeHalves = _mm256_set1_ps(1.5f);
+        const __m256 smoothing = _mm256_set1_ps(CAR_FLEET_SMOOTHING);
+        for (; i + 8 <= count; i += 8) {
+            __m256 c = _mm256_loadu_ps(&turnCos[i]);
+            __m256 s = _mm256_loadu_ps(&turnSin[i]);
+            __m256 dx = _mm256_loadu_ps(&directionX[i]);
+            __m256 dz = _mm256_loadu_ps(&directionZ[i]);
+            __m256 nx = _mm256_sub_ps(_mm256_mul_ps(dx, c), _mm256_mul_ps(dz, s));
+            __m256 nz = _mm256_add_ps(_mm256_mul_ps(dx, s), _mm256_mul_ps(dz, c));
+            __m256 lengthSquared = _mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(nz, nz));
+            __m256 scale = _mm256_sub_ps(threeHalves, _mm256_mul_ps(half, lengthSquared));
+            nx = _mm256_mul_ps(nx, scale);
+            nz = _mm256_mul_ps(nz, scale);
+
+            __m256 step = _mm256_loadu_ps(&stepDistance[i]);
+            __m256 x = _mm256_add_ps(_mm256_loadu_ps(&positionX[i]), _mm256_mul_ps(nx, step));
+            __m256 z = _mm256_add_ps(_mm256_loadu_ps(&positionZ[i]), _mm256_mul_ps(nz, step));
+
+            __m256 mx = _mm256_loadu_ps(&midValX[i]);
+            __m256 mz = _mm256_loadu_ps(&midValZ[i]);
+            __m256 mdx = _mm256_loadu_ps(&midValDirectionX[i]);
+            __m256 mdz = _mm256_loadu_ps(&midValDirectionZ[i]);
+            _mm256_storeu_ps(&midValX[i], _mm256_add_ps(mx, _mm256_mul_ps(_mm256_sub_ps(x, mx), smoothing)));
+            _mm256_storeu_ps(&midValZ[i], _mm256_add_ps(mz, _mm256_mul_ps(_mm256_sub_ps(z, mz), smoothing)));
+            _mm256_storeu_ps(&midValDirectionX[i], _mm256_add_ps(mdx, _mm256_mul_ps(_mm256_sub_ps(nx, mdx), smoothing)));
+            _mm256_storeu_ps(&midValDirectionZ[i], _mm256_add_ps(mdz, _mm256_mul_ps(_mm256_sub_ps(nz, mdz), smoothing)));
+            _mm256_storeu_ps(&directionX[i], nx);
+            _mm256_storeu_ps(&directionZ[i], nz);
+            _mm256_storeu_ps(&positionX[i], x);
+            _mm256_storeu_ps(&positionZ[i], z);
+        }
+    }
+#endif
+#ifdef USE_SSE2
+    {
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 threeHalves = _mm_set1_ps(1.5f);
+        const __m128 smoothing = _mm_set1_ps(CAR_FLEET_SMOOTHING);
+        for (; i + 4 <= count; i += 4) {
+            __m128 c = _mm_loadu_ps(&turnCos[i]);
+            __m128 s = _mm_loadu_ps(&turnSin[i]);
+            __m128 dx = _mm_loadu_ps(&directionX[i]);
+            __m128 dz = _mm_loadu_ps(&directionZ[i]);
+            __m128 nx = _mm_sub_ps(_mm_mul_ps(dx, c), _mm_mul_ps(dz, s));
+            __m128 nz = _mm_add_ps(_mm_mul_ps(dx, s), _mm_mul_ps(dz, c));
+            __m128 lengthSquared = _mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(nz, nz));
+            __m128 scale = _mm_sub_ps(threeHalves, _mm_mul_ps(half, lengthSquared));
+            nx = _mm_mul_ps(nx, scale);
+            nz = _mm_mul_ps(nz, scale);
+
+            __m128 step = _mm_loadu_ps(&stepDistance[i]);
+            __m128 x = _mm_add_ps(_mm_loadu_ps(&positionX[i]), _mm_mul_ps(nx, step));
+            __m128 z = _mm_add_ps(_mm_loadu_ps(&positionZ[i]), _mm_mul_ps(nz, step));
+
+            __m128 mx = _mm_loadu_ps(&midValX[i]);
+            __m128 mz = _mm_loadu_ps(&midValZ[i]);
+            __m128 mdx = _mm_loadu_ps(&midValDirectionX[i]);
+            __m128 mdz = _mm_loadu_ps(&midValDirectionZ[i]);
+            _mm_storeu_ps(&midValX[i], _mm_add_ps(mx, _mm_mul_ps(_mm_sub_ps(x, mx), smoothing)));
+            _mm_storeu_ps(&midValZ[i], _mm_add_ps(mz, _mm_mul_ps(_mm_sub_ps(z, mz), smoothing)));
+            _mm_storeu_ps(&midValDirectionX[i], _mm_add_ps(mdx, _mm_mul_ps(_mm_sub_ps(nx, mdx), smoothing)));
+            _mm_storeu_ps(&midValDirectionZ[i], _mm_add_ps(mdz, _mm_mul_ps(_mm_sub_ps(nz, mdz), smoothing)));
+            _mm_storeu_ps(&directionX[i], nx);
+            _mm_storeu_ps(&directionZ[i], nz);
+            _mm_storeu_ps(&positionX[i], x);
+            _mm_storeu_ps(&positionZ[i], z);
+        }
+    }
+#endif
+    tickScalar(i, count);
+    followGround(tick);
+}
+
+// the same as the vector paths, for the cars left over
+void CarFleet::tickScalar(size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; i++) {
+        float nx = directionX[i] * turnCos[i] - directionZ[i] * turnSin[i];
+        float nz = directionX[i] * turnSin[i] + directionZ[i] * turnCos[i];
+        float scale = 1.5f - 0.5f * (nx * nx + nz * nz);
+        directionX[i] = nx * scale;
+        directionZ[i] = nz * scale;
+        positionX[i] += directionX[i] * stepDistance[i];
+        positionZ[i] += directionZ[i] * stepDistance[i];
+
+        midValX[i] += (positionX[i] - midValX[i]) * CAR_FLEET_SMOOTHING;
+        midValZ[i] += (positionZ[i] - midValZ[i]) * CAR_FLEET_SMOOTHING;
+        midValDirectionX[i] += (directionX[i] - midValDirectionX[i]) * CAR_FLEET_SMOOTHING;
+        midValDirectionZ[i] += (directionZ[i] - midValDirectionZ[i]) * CAR_FLEET_SMOOTHING;
+    }
+}
+
+// A ray per car and tick would cost more than the whole kinematics, so every tick takes the next part of the cars
+void CarFleet::followGround(long long tick)
+{
+    if (trackCollision.isEmpty())
+        return;
+    for (size_t i = (size_t)(tick % CAR_FLEET_GROUND_INTERVAL); i < count; i += CAR_FLEET_GROUND_INTERVAL) {
+        TrackHit ground;
+        if (trackCollision.groundAt(glm::vec3(midValX[i], height[i], midValZ[i]), ground))
+            height[i] = ground.point.y + CAR_GROUND_CLEARANCE;
+    }
+}
+
+// ---------------------------------
+// occlusion culling
+// ---------------------------------
+
+// The occluders are the largest triangles of the track: few enough to rasterize every frame, and they cover the
+// walls, stands and roofs that hide the most
+std::vector<glm::vec3> selectOccluders(const ModelCacheHeader& header, const unsigned char* sections)
+{
+    const ModelVertex* vertices = (const ModelVertex*)sections;
+    const unsigned int* indices = (const unsigned int*)(sections + header.vertexCount * sizeof(ModelVertex));
+    const ModelMeshEntry* meshes = (const ModelMeshEntry*)(indices + header.indexCount);
+
+    std::vector<std::pair<float, unsigned int>> candidates;
+    std::vector<glm::vec3> corners;
+    for (unsigned int i = 0; i < header.meshCount; i++) {
+        const ModelMeshEntry& mesh = meshes[i];
+        for (unsigned int j = 0; j + 2 < mesh.indexCount; j += 3) {
+            glm::vec3 a = vertices[mesh.baseVertex + indices[mesh.firstIndex + j]].position;
+            glm::vec3 b = vertices[mesh.baseVertex + indices[mesh.firstIndex + j + 1]].position;
+            glm::vec3 c = vertices[mesh.baseVertex + indices[mesh.firstIndex + j + 2]].position;
+            float area = glm::length(glm::cross(b - a, c - a)) / 2.0f;
+            if (area < OCCLUDER_MIN_AREA)
+                continue;
+            candidates.push_back(std::make_pair(area, (unsigned int)corners.size()));
+            corners.push_back(a);
+            corners.push_back(b);
+            corners.push_back(c);
+        }
+    }
+
+    size_t count = std::min(candidates.size(), OCCLUDER_TRIANGLE_BUDGET);
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+        [](const std::pair<float, unsigned int>& a, const std::pair<float, unsigned int>& b) { return a.first > b.first; });
+    std::vector<glm::vec3> triangles;
+    triangles.reserve(count * 3);
+    for (size_t i = 0; i < count; i++)
+        triangles.insert(triangles.end(), corners.begin() + candidates[i].second, corners.begin() + candidates[i].second + 3);
+    return triangles;
+}
+
+void OcclusionBuffer::init(int bufferWidth, int bufferHeight)
+{
+    width = (bufferWidth + 3) & ~3;
+    height = bufferHeight;
+    levels.clear();
+    levelSizes.clear();
+    int levelWidth = width, levelHeight = height;
+    while (true) {
+        levels.push_back(std::vector<float>((size_t)levelWidth * levelHeight, 1.0f));
+        levelSizes.push_back(std::make_pair(levelWidth, levelHeight));
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+        levelWidth = std::max(1, (levelWidth + 1) / 2);
+        levelHeight = std::max(1, (levelHeight + 1) / 2);
+    }
+}
+
+void OcclusionBuffer::render(const glm::mat4& viewProjMatrix, const std::vector<glm::vec3>& triangles)
+{
+    viewProj = viewProjMatrix;
+    std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+
+    for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+        glm::vec4 clip[3];
+        // distance to the near plane in clip space, z + w
+        float nearDistance[3];
+        int inFront = 0;
+        for (int j = 0; j < 3; j++) {
+            clip[j] = viewProj * glm::vec4(triangles[i + j], 1.0f);
+            nearDistance[j] = clip[j].z + clip[j].w;
+            inFront += nearDistance[j] > 0.0f;
+        }
+        if (inFront == 0)
+            continue;
+        if (inFront == 3) {
+            rasterize(clip[0], clip[1], clip[2]);
+            continue;
+        }
+
+        // Cut the part behind the near plane off: a triangle or a quad remains
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int j = 0; j < 3; j++) {
+            int k = (j + 1) % 3;
+            if (nearDistance[j] > 0.0f)
+                polygon[count++] = clip[j];
+            if ((nearDistance[j] > 0.0f) != (nearDistance[k] > 0.0f)) {
+                float t = nearDistance[j] / (nearDistance[j] - nearDistance[k]);
+                polygon[count++] = clip[j] + (clip[k] - clip[j]) * t;
+            }
+        }
+        rasterize(polygon[0], polygon[1], polygon[2]);
+        if (count == 4)
+            rasterize(polygon[0], polygon[2], polygon[3]);
+    }
+    buildPyramid();
+}
+
+// Fills the pixels whose centers are inside the triangle, four at a time, with the nearest depth
+void OcclusionBuffer::rasterize(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+{
+    // screen position in pixels and depth in [0, 1]
+    float x[3], y[3], z[3];
+    const glm::vec4* corners[3] = { &a, &b, &c };
+    for (int i = 0; i < 3; i++) {
+        // the clipping leaves points on the near plane, where w can be 0 for an orthographic-like matrix
+        float w = std::max(corners[i]->w, 1e-6f);
+        x[i] = (corners[i]->x / w * 0.5f + 0.5f) * width;
+        y[i] = (corners[i]->y / w * 0.5f + 0.5f) * height;
+        z[i] = glm::clamp(corners[i]->z / w * 0.5f + 0.5f, 0.0f, 1.0f);
+    }
+
+    // Both windings are occluders; swapping two corners makes the area positive
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (fabs(area) < 1e-8f)
+        return;
+    if (area < 0.0f) {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(z[1], z[2]);
+        area = -area;
+    }
+
+    int minX = std::max(0, (int)floor(std::min({ x[0], x[1], x[2] })));
+    int maxX = std::min(width - 1, (int)floor(std::max({ x[0], x[1], x[2] })));
+    int minY = std::max(0, (int)floor(std::min({ y[0], y[1], y[2] })));
+    int maxY = std::min(height - 1, (int)floor(std::max({ y[0], y[1], y[2] })));
+    if (minX > maxX || minY > maxY)
+        return;
+    minX &= ~3;
+
+    // edge i is opposite corner i: e = ex * px + ey * py + e0, positive inside; depth is a plane in screen space
+    float edgeX[3], edgeY[3], edgeC[3];
+    for (int i = 0; i < 3; i++) {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        edgeX[i] = y[j] - y[k];
+        edgeY[i] = x[k] - x[j];
+        edgeC[i] = x[j] * y[k] - x[k] * y[j];
+    }
+    float depthX = (edgeX[0] * z[0] + edgeX[1] * z[1] + edgeX[2] * z[2]) / area;
+    float depthY = (edgeY[0] * z[0] + edgeY[1] * z[1] + edgeY[2] * z[2]) / area;
+    float depthC = (edgeC[0] * z[0] + edgeC[1] * z[1] + edgeC[2] * z[2]) / area;
+
+    std::vector<float>& depth = levels[0];
+    for (int py = minY; py <= maxY; py++) {
+        float centerY = py + 0.5f;
+        float* row = depth.data() + (size_t)py * width;
+#ifdef USE_SSE2
+        __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        __m128 zero = _mm_setzero_ps();
+        __m128 rowEdge[3];
+        for (int i = 0; i < 3; i++)
+            rowEdge[i] = _mm_set1_ps(edgeY[i] * centerY + edgeC[i]);
+        __m128 rowDepth = _mm_set1_ps(depthY * centerY + depthC);
+        for (int px = minX; px <= maxX; px += 4) {
+            __m128 centerX = _mm_add_ps(_mm_set1_ps((float)px), offsets);
+            __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeX[0]), centerX), rowEdge[0]), zero);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeX[1]), centerX), rowEdge[1]), zero));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeX[2]), centerX), rowEdge[2]), zero));
+            if (_mm_movemask_ps(inside) == 0)
+                continue;
+            __m128 pixelDepth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depthX), centerX), rowDepth);
+            __m128 stored = _mm_loadu_ps(row + px);
+            __m128 nearest = _mm_min_ps(stored, pixelDepth);
+            _mm_storeu_ps(row + px, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, stored)));
+        }
+#else
+        for (int px = minX; px <= maxX; px++) {
+            float centerX = px + 0.5f;
+            if (edgeX[0] * centerX + edgeY[0] * centerY + edgeC[0] < 0.0f
+                || edgeX[1] * centerX + edgeY[1] * centerY + edgeC[1] < 0.0f
+                || edgeX[2] * centerX + edgeY[2] * centerY + edgeC[2] < 0.0f)
+                continue;
+            row[px] = std::min(row[px], depthX * centerX + depthY * centerY + depthC);
+        }
+#endif
+    }
+}
+
+void OcclusionBuffer::buildPyramid()
+{
+    for (size_t level = 1; level < levels.size(); level++) {
+        const std::vector<float>& below = levels[level - 1];
+        int belowWidth = levelSizes[level - 1].first, belowHeight = levelSizes[level - 1].second;
+        int levelWidth = levelSizes[level].first, levelHeight = levelSizes[level].second;
+        for (int y = 0; y < levelHeight; y++) {
+            int y0 = 2 * y, y1 = std::min(2 * y + 1, belowHeight - 1);
+            for (int x = 0; x < levelWidth; x++) {
+                int x0 = 2 * x, x1 = std::min(2 * x + 1, belowWidth - 1);
+                levels[level][(size_t)y * levelWidth + x] = std::max(
+                    std::max(below[(size_t)y0 * belowWidth + x0], below[(size_t)y0 * belowWidth + x1]),
+                    std::max(below[(size_t)y1 * belowWidth + x0], below[(size_t)y1 * belowWidth + x1]));
+            }
+        }
+    }
+}
+
+bool OcclusionBuffer::isBoxVisible(const glm::vec3& center, const glm::vec3& extent) const
+{
+    // screen rectangle and nearest depth of the corners
+    float minX = 1.0f, maxX = -1.0f, minY = 1.0f, maxY = -1.0f, minDepth = 1.0f;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner(center.x + (i & 1 ? extent.x : -extent.x), center.y + (i & 2 ? extent.y : -extent.y),
+            center.z + (i & 4 ? extent.z : -extent.z));
+        glm::vec4 clip = viewProj * glm::vec4(corner, 1.0f);
+        if (clip.w <= 1e-6f || clip.z < -clip.w)
+            return true;
+        float ndcX = clip.x / clip.w, ndcY = clip.y / clip.w;
+        minX = std::min(minX, ndcX);
+        maxX = std::max(maxX, ndcX);
+        minY = std::min(minY, ndcY);
+        maxY = std::max(maxY, ndcY);
+        minDepth = std::min(minDepth, clip.z / clip.w * 0.5f + 0.5f);
+    }
+    if (minX > maxX || minY > maxY)
+        return true;
+
+    // A texel counts as covered when its center is, so an occluder may end up to half a texel short of the texels
+    // it fills; the rectangle grows by a texel on each side to also test the texels next to the edge
+    int x0 = glm::clamp((int)floor((minX * 0.5f + 0.5f) * width) - 1, 0, width - 1);
+    int x1 = glm::clamp((int)floor((maxX * 0.5f + 0.5f) * width) + 1, 0, width - 1);
+    int y0 = glm::clamp((int)floor((minY * 0.5f + 0.5f) * height) - 1, 0, height - 1);
+    int y1 = glm::clamp((int)floor((maxY * 0.5f + 0.5f) * height) + 1, 0, height - 1);
+
+    // the level on which the rectangle covers at most 4x4 texels
+    size_t level = 0;
+    while (level + 1 < levels.size() && std::max(x1 - x0, y1 - y0) >> level >= 4)
+        level++;
+    int levelWidth = levelSizes[level].first;
+    const std::vector<float>& depth = levels[level];
+    for (int y = y0 >> level; y <= y1 >> level; y++) {
+        for (int x = x0 >> level; x <= x1 >> level; x++) {
+            if (minDepth <= depth[(size_t)y * levelWidth + x])
+                return true;
+        }
+    }
+    return false;
+}
+
+void OcclusionCuller::start(int cascadeCount, unsigned int threadCount)
+{
+    buffers.resize(1 + cascadeCount);
+    buffers[0].init(OCCLUSION_CAMERA_WIDTH, OCCLUSION_CAMERA_HEIGHT);
+    for (int i = 0; i < cascadeCount; i++)
+        buffers[1 + i].init(OCCLUSION_CASCADE_SIZE, OCCLUSION_CASCADE_SIZE);
+    isRendered.assign(buffers.size(), 0);
+    isDone.assign(buffers.size(), 1);
+    workers.start(threadCount);
+    isStarted = true;
+}
+
+void OcclusionCuller::stop()
+{
+    if (!isStarted)
+        return;
+    waitAll();
+    workers.stop();
+    isStarted = false;
+}
+
+void OcclusionCuller::setOccluders(std::vector<glm::vec3> triangles)
+{
+    waitAll();
+    occluders = std::move(triangles);
+    std::cout << "[OCCLUSION]" << getOccluderTriangleCount() << " occluder triangles" << std::endl;
+}
+
+void OcclusionCuller::beginFrame(const glm::mat4& cameraViewProj, const glm::mat4* lightSpaceMatrices, int renderedCascades)
+{
+    // the buffers of the last frame can only be overwritten once nothing reads them
+    waitAll();
+    std::fill(isRendered.begin(), isRendered.end(), 0);
+    if (!isStarted || occluders.empty())
+        return;
+
+    // the cascades are needed first
+    for (int view = 1; view <= (int)buffers.size(); view++) {
+        int index = view % (int)buffers.size();
+        if (index > renderedCascades)
+            continue;
+        glm::mat4 viewProj = index == 0 ? cameraViewProj : lightSpaceMatrices[index - 1];
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            isRendered[index] = 1;
+            isDone[index] = 0;
+        }
+        workers.submit([this, index, viewProj]() {
+            buffers[index].render(viewProj, occluders);
+            std::lock_guard<std::mutex> lock(mutex);
+            isDone[index] = 1;
+            done.notify_all();
+        });
+    }
+}
+
+const OcclusionBuffer* OcclusionCuller::waitFor(int view)
+{
+    if (view >= (int)isRendered.size() || !isRendered[view])
+        return nullptr;
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this, view] { return isDone[view] != 0; });
+    return &buffers[view];
+}
+
+void OcclusionCuller::waitAll()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return std::all_of(isDone.begin(), isDone.end(), [](char value) { return value != 0; }); });
+}
+
+// ---------------------------------
+// input events, recording and replay
+// ---------------------------------
+
+// Open the log given on the command line; a replay also restores the camera mode it was recorded with
+bool inputLogInit()
+{
+    if (!replayPath.empty() && !inputLog.startReplay(replayPath, isCameraFixed)) {
+        std::cout << "Failed to read input log: " << replayPath << std::endl;
+        return false;
+    }
+    if (!recordPath.empty() && !inputLog.startRecording(recordPath, isCameraFixed)) {
+        std::cout << "Failed to write input log: " << recordPath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Called from the GLFW callbacks, the event takes effect on the next tick
+void queueInputEvent(InputEventType type, float x, float y)
+{
+    // During a replay the live input has no effect on the simulation
+    if (inputLog.isReplaying())
+        return;
+
+    InputEvent event;
+    event.type = type;
+    event.time = (float)sessionSeconds();
+    event.x = x;
+    event.y = y;
+    // the first frame presented after the event shows it
+    framePacer.markInput(sessionSeconds());
+    std::lock_guard<std::mutex> lock(pendingInputMutex);
+    pendingInputEvents.push_back(event);
+}
+
+// Collect, record and apply the events of the current tick, returns the keys pressed during the tick
+SimInput processInputEvents(const SimInput& sampled)
+{
+    tickEvents.clear();
+    if (inputLog.isReplaying()) {
+        inputLog.eventsForTick(simTick, tickEvents);
+    }
+    else {
+        if (sampled.keys != simKeys) {
+            InputEvent event;
+            event.type = INPUT_EVENT_KEYS;
+            event.time = (float)(elapsedMs(sessionStart) / 1000.0);
+            event.keys = sampled.keys;
+            tickEvents.push_back(event);
+        }
+        std::lock_guard<std::mutex> lock(pendingInputMutex);
+        tickEvents.insert(tickEvents.end(), pendingInputEvents.begin(), pendingInputEvents.end());
+        pendingInputEvents.clear();
+    }
+
+    for (InputEvent& event : tickEvents) {
+        event.tick = simTick;
+        applyInputEvent(event);
+        if (inputLog.isRecording())
+            inputLog.record(event);
+    }
+
+    SimInput input;
+    input.keys = simKeys;
+    return input;
+}
+
+void applyInputEvent(const InputEvent& event)
+{
+    switch (event.type) {
+    case INPUT_EVENT_KEYS:
+        simKeys = event.keys;
+        break;
+    case INPUT_EVENT_MOUSE:
+        if (!isCameraFixed)
+            camera.ProcessMouseMovement(event.x, event.y);
+        break;
+    case INPUT_EVENT_SCROLL:
+        camera.ProcessMouseScroll(event.y);
+        break;
+    case INPUT_EVENT_TOGGLE_CAMERA: {
+        isCameraFixed = !isCameraFixed;
+        string info = isCameraFixed ? "ÇÐ»»Îª¹Ì¶¨ÊÓ½Ç" : "ÇÐ»»Îª×ÔÓÉÊÓ½Ç";
+        std::cout << "[CAMERA]" << info << std::endl;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Unsigned LEB128, small numbers (tick deltas, key bits) take a single byte
+void writeVarint(std::ostream& out, unsigned long long value)
+{
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        out.put((char)(value ? byte | 0x80 : byte));
+    } while (value);
+}
+
+bool readVarint(std::istream& in, unsigned long long& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = in.get();
+        if (byte == EOF)
+            return false;
+        value |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// The floats are stored bit for bit, so that the replay applies exactly the recorded offsets
+void writeFloat(std::ostream& out, float value)
+{
+    out.write((const char*)&value, sizeof(value));
+}
+
+bool readFloat(std::istream& in, float& value)
+{
+    return (bool)in.read((char*)&value, sizeof(value));
+}
+
+// header: "RCIN", version, timestep, flags (bit 0: fixed camera)
+bool InputLog::startRecording(const std::string& path, bool isCameraFixed)
+{
+    out.open(path, std::ios::binary);
+    if (!out)
+        return false;
+
+    out.write("RCIN", 4);
+    out.put((char)VERSION);
+    writeFloat(out, SIM_TIMESTEP);
+    out.put((char)(isCameraFixed ? 1 : 0));
+    recording = true;
+    return true;
+}
+
+// event: type, tick delta, microseconds delta, payload of the type
+void InputLog::record(const InputEvent& event)
+{
+    long long microseconds = (long long)(event.time * 1.0e6);
+    out.put((char)event.type);
+    writeVarint(out, event.tick - lastTick);
+    writeVarint(out, microseconds > lastMicroseconds ? microseconds - lastMicroseconds : 0);
+    lastTick = event.tick;
+    lastMicroseconds = std::max(microseconds, lastMicroseconds);
+
+    switch (event.type) {
+    case INPUT_EVENT_KEYS:
+        writeVarint(out, event.keys);
+        break;
+    case INPUT_EVENT_MOUSE:
+        writeFloat(out, event.x);
+        writeFloat(out, event.y);
+        break;
+    case INPUT_EVENT_SCROLL:
+        writeFloat(out, event.y);
+        break;
+    default:
+        break;
+    }
+}
+
+void InputLog::finish(long long tick)
+{
+    if (!recording)
+        return;
+
+    InputEvent end;
+    end.type = INPUT_EVENT_END;
+    end.tick = tick;
+    end.time = (float)(lastMicroseconds / 1.0e6);
+    record(end);
+    out.close();
+    recording = false;
+    std::cout << "[INPUT]recorded " << tick << " ticks" << std::endl;
+}
+
+bool InputLog::startReplay(const std::string& path, bool& isCameraFixed)
+{
+    std::ifstream in(path, std::ios::binary);
+    char magic[4];
+    float timestep;
+    if (!in.read(magic, 4) || memcmp(magic, "RCIN", 4) != 0 || in.get() != VERSION || !readFloat(in, timestep))
+        return false;
+    // The same input only gives the same trajectory with the same timestep
+    if (timestep != SIM_TIMESTEP) {
+        std::cout << "[INPUT]log was recorded with a timestep of " << timestep << " s" << std::endl;
+        return false;
+    }
+    int flags = in.get();
+    if (flags == EOF)
+        return false;
+    isCameraFixed = (flags & 1) != 0;
+
+    long long tick = 0;
+    long long microseconds = 0;
+    for (;;) {
+        int type = in.get();
+        unsigned long long tickDelta, microsecondsDelta;
+        if (type == EOF || type > INPUT_EVENT_END || !readVarint(in, tickDelta) || !readVarint(in, microsecondsDelta))
+            return false;
+        tick += tickDelta;
+        microseconds += microsecondsDelta;
+
+        InputEvent event;
+        event.type = (InputEventType)type;
+        event.tick = tick;
+        event.time = (float)(microseconds / 1.0e6);
+        unsigned long long keys = 0;
+        bool isValid = true;
+        switch (event.type) {
+        case INPUT_EVENT_KEYS:
+            isValid = readVarint(in, keys);
+            event.keys = (unsigned int)keys;
+            break;
+        case INPUT_EVENT_MOUSE:
+            isValid = readFloat(in, event.x) && readFloat(in, event.y);
+            break;
+        case INPUT_EVENT_SCROLL:
+            isValid = readFloat(in, event.y);
+            break;
+        default:
+            break;
+        }
+        if (!isValid)
+            return false;
+
+        if (event.type == INPUT_EVENT_END) {
+            endTick = event.tick;
+            break;
+        }
+        events.push_back(event);
+    }
+
+    replaying = true;
+    std::cout << "[INPUT]replaying " << events.size() << " events over " << endTick << " ticks" << std::endl;
+    return true;
+}
+
+void InputLog::eventsForTick(long long tick, std::vector<InputEvent>& tickEvents)
+{
+    while (nextEvent < events.size() && events[nextEvent].tick <= tick)
+        tickEvents.push_back(events[nextEvent++]);
+}
+
+// The ground is searched from above the height of the previous state
+CarState captureCarState(Car& car, const CarState& previous)
+{
+    CarState state;
+    state.midValPosition = car.getMidValPosition();
+    state.yaw = car.getYaw();
+    state.delayYaw = car.getDelayYaw();
+    state.midValYaw = car.getMidValYaw();
+
+    // The car itself drives on a plane, it follows the ground of the track when there is one
+    TrackHit ground;
+    glm::vec3 probe = state.midValPosition;
+    probe.y = std::max(probe.y, previous.midValPosition.y);
+    if (trackCollision.groundAt(probe, ground)) {
+        state.midValPosition.y = ground.point.y + CAR_GROUND_CLEARANCE;
+        state.groundNormal = ground.normal;
+    }
+    return state;
+}
+
+CarState interpolateCarState(const CarState& from, const CarState& to, float alpha)
+{
+    CarState state;
+    state.midValPosition = glm::mix(from.midValPosition, to.midValPosition, alpha);
+    state.yaw = glm::mix(from.yaw, to.yaw, alpha);
+    state.delayYaw = glm::mix(from.delayYaw, to.delayYaw, alpha);
+    state.midValYaw = glm::mix(from.midValYaw, to.midValYaw, alpha);
+    state.groundNormal = glm::normalize(glm::mix(from.groundNormal, to.groundNormal, alpha));
+    return state;
+}
+
+void captureTraffic(const CarFleet& fleet, TrafficState& traffic)
+{
+    traffic.positions.resize(fleet.getCount());
+    traffic.directions.resize(fleet.getCount());
+    for (size_t i = 0; i < fleet.getCount(); i++) {
+        traffic.positions[i] = fleet.getMidValPosition(i);
+        traffic.directions[i] = fleet.getMidValDirection(i);
+    }
+}
+
+// The model matrices of the traffic cars of this frame
+void updateTrafficInstances(const TrafficState& from, const TrafficState& to, float alpha)
+{
+    // a snapshot from before the fleet was set up has no cars
+    size_t count = std::min(from.positions.size(), to.positions.size());
+    sceneInstances.cars.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        glm::vec3 position = glm::mix(from.positions[i], to.positions[i], alpha);
+        glm::vec2 direction = glm::mix(from.directions[i], to.directions[i], alpha);
+        sceneInstances.cars[i] = carModelMatrix(position, glm::degrees(atan2(direction.x, direction.y)));
+    }
+}
+
+// Milliseconds since start
+double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Average, percentiles (nearest rank) and maximum of a series of timings
+TimingSummary summarizeTimings(std::vector<double> values)
+{
+    TimingSummary summary;
+    if (values.empty())
+        return summary;
+
+    std::sort(values.begin(), values.end());
+    auto percentile = [&values](double p) {
+        size_t rank = (size_t)ceil(p / 100.0 * values.size());
+        return values[rank > 0 ? rank - 1 : 0];
+    };
+
+    for (double value : values)
+        summary.average += value / values.size();
+    summary.p50 = percentile(50.0);
+    summary.p95 = percentile(95.0);
+    summary.p99 = percentile(99.0);
+    summary.max = values.back();
+    return summary;
+}
+
+void changeLightPosAsTime()
+{
+    float freq = 0.1;
+    lightPos.x = 1.0 + cos(glfwGetTime() * freq) * -0.5f;
+    lightPos.z = -1.0 + sin(glfwGetTime() * freq) * 0.5f;
+    lightPos.y = 1.0 + cos(glfwGetTime() * freq) * 0.5f;
+    lightDirection = glm::normalize(lightPos);
+
+    // The shadows of the static objects depend on the light
+    invalidateStaticShadows();
+}
+
+
+// ---------------------------------
+// camera position update
+// ---------------------------------
+
+void updateFixedCamera(Camera& camera, FixedCamera& fixedCamera, const CarState& carState)
+{
+    // Process the vector coordinates of the camera relative to the vehicle coordinate system and convert it to a vector in the world coordinate system
+    float angle = glm::radians(-carState.midValYaw);
+    glm::mat4 rotateMatrix(
+        cos(angle), 0.0, sin(angle), 0.0,
+        0.0, 1.0, 0.0, 0.0,
+        -sin(angle), 0.0, cos(angle), 0.0,
+        0.0, 0.0, 0.0, 1.0);
+    glm::vec3 rotatedPosition = glm::vec3(rotateMatrix * glm::vec4(fixedCamera.getPosition(), 1.0));
+
+    camera.FixView(rotatedPosition + carState.midValPosition, fixedCamera.getYaw() + carState.midValYaw);
+}
+// ---------------------------------
+// shadow cascades
+// ---------------------------------
+
+// Split the view frustum and fit an orthographic light volume around every slice
+void updateShadowCascades(const glm::mat4& viewMatrix, const glm::mat4& projMatrix)
+{
+    // Near and far planes of the camera, recovered from the perspective matrix
+    float nearPlane = projMatrix[3][2] / (projMatrix[2][2] - 1.0f);
+    float farPlane = projMatrix[3][2] / (projMatrix[2][2] + 1.0f);
+    float shadowFar = glm::min(farPlane, SHADOW_DISTANCE);
+
+    // Corners of the whole view frustum in world space, the near corner and the far corner of each edge
+    glm::mat4 inverseViewProj = glm::inverse(projMatrix * viewMatrix);
+    glm::vec3 nearCorners[4], farCorners[4];
+    for (int i = 0; i < 4; i++) {
+        float x = (i & 1) ? 1.0f : -1.0f;
+        float y = (i & 2) ? 1.0f : -1.0f;
+        glm::vec4 nearCorner = inverseViewProj * glm::vec4(x, y, -1.0f, 1.0f);
+        glm::vec4 farCorner = inverseViewProj * glm::vec4(x, y, 1.0f, 1.0f);
+        nearCorners[i] = glm::vec3(nearCorner) / nearCorner.w;
+        farCorners[i] = glm::vec3(farCorner) / farCorner.w;
+    }
+
+    // Only the orientation of the light is used, the cascades are placed inside the light space
+    glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), -lightDirection, WORLD_UP);
+
+    float splitNear = nearPlane;
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        ShadowCascade& cascade = shadowCascades[i];
+
+        // practical split scheme: mix of the logarithmic and the uniform split
+        float p = (float)(i + 1) / SHADOW_CASCADE_COUNT;
+        float logSplit = nearPlane * pow(shadowFar / nearPlane, p);
+        float uniformSplit = nearPlane + (shadowFar - nearPlane) * p;
+        float splitFar = SHADOW_SPLIT_LAMBDA * logSplit + (1.0f - SHADOW_SPLIT_LAMBDA) * uniformSplit;
+
+        // The depth along each frustum edge is linear, so the slice corners can be interpolated
+        glm::vec3 corners[8];
+        glm::vec3 center(0.0f);
+        for (int j = 0; j < 4; j++) {
+            glm::vec3 edge = farCorners[j] - nearCorners[j];
+            corners[j] = nearCorners[j] + edge * ((splitNear - nearPlane) / (farPlane - nearPlane));
+            corners[j + 4] = nearCorners[j] + edge * ((splitFar - nearPlane) / (farPlane - nearPlane));
+            center += corners[j] + corners[j + 4];
+        }
+        center /= 8.0f;
+
+        // A bounding sphere keeps the size of the cascade constant when the camera rotates
+        float radius = 0.0f;
+        for (int j = 0; j < 8; j++)
+            radius = glm::max(radius, glm::length(corners[j] - center));
+        // Rounded up to the next size; the size one step larger is kept, so that a zoom back and forth around a
+        // step does not switch between the two
+        float step = pow(2.0f, 1.0f / SHADOW_RADIUS_STEPS_PER_OCTAVE);
+        radius = pow(2.0f, ceil(log2(radius) * SHADOW_RADIUS_STEPS_PER_OCTAVE) / SHADOW_RADIUS_STEPS_PER_OCTAVE);
+        if (cascade.radius >= radius && cascade.radius <= radius * step * 1.001f)
+            radius = cascade.radius;
+
+        // Snap the center to whole texels, so the shadow edges do not shimmer when the camera moves
+        glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+        float texelSize = 2.0f * radius / cascade.resolution;
+        lightCenter.x = floor(lightCenter.x / texelSize) * texelSize;
+        lightCenter.y = floor(lightCenter.y / texelSize) * texelSize;
+        float depth = -lightCenter.z;
+
+        // Move the static layer only when the cascade leaves it, so it does not have to be rendered again every frame
+        int guardTexels = (cascade.staticResolution - cascade.resolution) / 2;
+        float guardSize = guardTexels * texelSize;
+        if (cascade.staticRadius != radius
+            || fabs(lightCenter.x - cascade.staticCenter.x) > guardSize
+            || fabs(lightCenter.y - cascade.staticCenter.y) > guardSize
+            || fabs(depth - cascade.staticCenter.z) > SHADOW_CASTER_MARGIN / 2.0f) {
+            cascade.staticCenter = glm::vec3(lightCenter.x, lightCenter.y, depth);
+            cascade.staticRadius = radius;
+            cascade.isStaticDirty = true;
+        }
+
+        // Both layers share the depth range of the static layer, so their depth values can be combined
+        float nearDepth = cascade.staticCenter.z - radius - SHADOW_CASTER_MARGIN;
+        float farDepth = cascade.staticCenter.z + radius + SHADOW_CASTER_MARGIN;
+
+        float staticSize = radius + guardSize;
+        glm::mat4 staticProjection = glm::ortho(
+            cascade.staticCenter.x - staticSize, cascade.staticCenter.x + staticSize,
+            cascade.staticCenter.y - staticSize, cascade.staticCenter.y + staticSize,
+            nearDepth, farDepth);
+        cascade.staticLightSpaceMatrix = staticProjection * lightView;
+
+        glm::mat4 lightProjection = glm::ortho(
+            lightCenter.x - radius, lightCenter.x + radius,
+            lightCenter.y - radius, lightCenter.y + radius,
+            nearDepth, farDepth);
+        cascade.lightSpaceMatrix = lightProjection * lightView;
+        cascade.staticOffsetX = guardTexels + (int)round((lightCenter.x - cascade.staticCenter.x) / texelSize);
+        cascade.staticOffsetY = guardTexels + (int)round((lightCenter.y - cascade.staticCenter.y) / texelSize);
+
+        cascade.radius = radius;
+        cascade.splitFar = splitFar;
+        splitNear = splitFar;
+    }
+}
+
+// The light or the static geometry changed, every cascade has to render its static layer again
+void invalidateStaticShadows()
+{
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+        shadowCascades[i].isStaticDirty = true;
+}
+
+// Only the static layers whose volume the world space box reaches into
+void invalidateStaticShadows(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        ShadowCascade& cascade = shadowCascades[i];
+        if (cascade.isStaticDirty)
+            continue;
+        // the projection is orthographic, the box in light space is the box around its corners
+        glm::vec3 lightMin(1.0f), lightMax(-1.0f);
+        for (int j = 0; j < 8; j++) {
+            glm::vec3 corner((j & 1) ? boundsMax.x : boundsMin.x, (j & 2) ? boundsMax.y : boundsMin.y, (j & 4) ? boundsMax.z : boundsMin.z);
+            glm::vec3 light = glm::vec3(cascade.staticLightSpaceMatrix * glm::vec4(corner, 1.0f));
+            lightMin = j == 0 ? light : glm::min(lightMin, light);
+            lightMax = j == 0 ? light : glm::max(lightMax, light);
+        }
+        if (lightMax.x >= -1.0f && lightMin.x <= 1.0f && lightMax.y >= -1.0f && lightMin.y <= 1.0f
+            && lightMax.z >= -1.0f && lightMin.z <= 1.0f)
+            cascade.isStaticDirty = true;
+    }
+}
+
+// Planes of the volume that the matrix maps to the clip cube (Gribb and Hartmann)
+Frustum makeFrustum(const glm::mat4& viewProjMatrix)
+{
+    glm::mat4 m = glm::transpose(viewProjMatrix);
+    Frustum frustum;
+    frustum.planes[0] = m[3] + m[0];
+    frustum.planes[1] = m[3] - m[0];
+    frustum.planes[2] = m[3] + m[1];
+    frustum.planes[3] = m[3] - m[1];
+    frustum.planes[4] = m[3] + m[2];
+    frustum.planes[5] = m[3] - m[2];
+    return frustum;
+}
+
+DrawView makePerspectiveView(const glm::mat4& viewMatrix, const glm::mat4& projMatrix, float lodBias)
+{
+    DrawView view;
+    view.frustum = makeFrustum(projMatrix * viewMatrix);
+    view.eye = glm::vec3(glm::inverse(viewMatrix)[3]);
+    view.projectionScale = projMatrix[1][1];
+    view.lodBias = lodBias;
+    return view;
+}
+
+DrawView makeOrthographicView(const glm::mat4& lightSpaceMatrix, float halfSize, float lodBias)
+{
+    DrawView view;
+    view.frustum = makeFrustum(lightSpaceMatrix);
+    view.isOrthographic = true;
+    view.projectionScale = 1.0f / halfSize;
+    view.lodBias = lodBias;
+    return view;
+}
+
+// World space box around the transformed model space box
+void transformBox(const glm::mat4& modelMatrix, const glm::vec3& boundsMin, const glm::vec3& boundsMax, glm::vec3& center, glm::vec3& extent)
+{
+    center = glm::vec3(modelMatrix * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+    glm::vec3 halfSize = (boundsMax - boundsMin) * 0.5f;
+    extent = glm::abs(glm::vec3(modelMatrix[0])) * halfSize.x
+        + glm::abs(glm::vec3(modelMatrix[1])) * halfSize.y
+        + glm::abs(glm::vec3(modelMatrix[2])) * halfSize.z;
+}
+
+// The box is outside when it is completely behind one of the planes
+bool isBoxVisible(const Frustum& frustum, const glm::vec3& center, const glm::vec3& extent)
+{
+    for (int i = 0; i < 6; i++) {
+        glm::vec3 normal = glm::vec3(frustum.planes[i]);
+        if (glm::dot(normal, center) + glm::dot(glm::abs(normal), extent) + frustum.planes[i].w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// The first level whose threshold the projected diameter of the bounding sphere reaches, as a fraction of the viewport height
+unsigned int selectLod(const DrawView& view, const glm::vec3& center, float radius, unsigned int lodCount)
+{
+    float screenSize;
+    if (view.isOrthographic) {
+        screenSize = radius * view.projectionScale;
+    }
+    else {
+        float distance = glm::length(center - view.eye);
+        // inside the sphere, it covers the whole screen
+        if (distance <= radius)
+            return 0;
+        screenSize = radius * view.projectionScale / distance;
+    }
+    screenSize /= view.lodBias;
+
+    for (unsigned int level = 0; level + 1 < lodCount; level++) {
+        if (screenSize >= MODEL_LOD_SCREEN_SIZE[level])
+            return level;
+    }
+    return lodCount - 1;
+}
+
+// ---------------------------------
+// per-frame constants
+// ---------------------------------
+
+// Compute the matrices of this frame once and upload them for all shaders and passes
+void updateFrameConstants()
+{
+    setViewConstants();
+
+    // Fit the view volume of the light source to each slice of the camera frustum
+    updateShadowCascades(frameConstants.view, frameConstants.projection);
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        frameConstants.lightSpaceMatrices[i] = shadowCascades[i].lightSpaceMatrix;
+        frameConstants.cascadePlaneDistances[i] = shadowCascades[i].splitFar;
+    }
+
+    frameConstants.lightDirection = glm::vec4(lightDirection, 0.0f);
+    float sliceScale = CLUSTER_COUNT_Z / log(CLUSTER_FAR / CLUSTER_NEAR);
+    frameConstants.clusterScale = glm::vec4((float)CLUSTER_COUNT_X / renderWidth, (float)CLUSTER_COUNT_Y / renderHeight,
+        sliceScale, -sliceScale * log(CLUSTER_NEAR));
+
+    glBindBuffer(GL_UNIFORM_BUFFER, frameConstantsUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameConstants), &frameConstants);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// ---------------------------------
+// render function
+// ---------------------------------
+
+// Set lighting related properties, the matrices and the light direction are already in the uniform buffer
+void renderLight()
+{
+    // The fragment shader picks the cascade by the view space depth of the fragment
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        glActiveTexture(GL_TEXTURE0 + SHADOW_TEXTURE_UNIT + i);
+        glBindTexture(GL_TEXTURE_2D, shadowCascades[i].depthMap);
+    }
+    // and the lights of its cluster
+    if (isClusteredLighting)
+        lightClusters.upload();
+}
+
+void renderCarAndCamera(CachedModel& carModel, CachedModel& cameraModel, const DrawView& view)
+{
+    // -------
+    // Hierarchical modeling
+
+    // model conversion
+    glm::mat4 modelMatrix = glm::mat4(1.0f);
+    modelMatrix = glm::translate(modelMatrix, renderCarState.midValPosition);
+    // lean with the slope of the track
+    glm::vec3 leanAxis = glm::cross(WORLD_UP, renderCarState.groundNormal);
+    float leanSin = glm::length(leanAxis);
+    if (leanSin > 1e-4f)
+        modelMatrix = glm::rotate(modelMatrix, atan2(leanSin, glm::dot(WORLD_UP, renderCarState.groundNormal)), leanAxis / leanSin);
+    modelMatrix = glm::rotate(modelMatrix, glm::radians(renderCarState.delayYaw / 2), WORLD_UP);
+
+    // render the car
+    renderCar(carModel, modelMatrix, renderCarState, view);
+
+    // Since mat4 is passed by value as a function parameter, there is no need to back up modelMatrix
+
+    // render camera
+    renderCamera(cameraModel, modelMatrix, renderCarState, view);
+}
+
+void renderCar(CachedModel& model, glm::mat4 modelMatrix, const CarState& carState, const DrawView& view)
+{
+    modelMatrix = glm::rotate(modelMatrix, glm::radians(carState.yaw - carState.delayYaw / 2), WORLD_UP);
+    // offset the original rotation of the model
+    modelMatrix = glm::rotate(modelMatrix, glm::radians(-90.0f), WORLD_UP);
+    // resize the model
+    modelMatrix = glm::scale(modelMatrix, glm::vec3(0.004f, 0.004f, 0.004f));
+
+    model.Draw(view, modelMatrix);
+}
+
+void renderCamera(CachedModel& model, glm::mat4 modelMatrix, const CarState& carState, const DrawView& view)
+{
+    modelMatrix = glm::rotate(modelMatrix, glm::radians(viewFixedCamera.getYaw() + carState.yaw / 2), WORLD_UP);
+    modelMatrix = glm::translate(modelMatrix, cameraPos);
+    modelMatrix = glm::scale(modelMatrix, glm::vec3(0.01f, 0.01f, 0.01f));
+
+    model.Draw(view, modelMatrix);
+}
+
+// all traffic cars in one instanced draw per mesh and level of detail
+void renderTrafficCars(CachedModel& model, const DrawView& view)
+{
+    if (!sceneInstances.cars.empty())
+        model.Draw(view, sceneInstances.cars.data(), sceneInstances.cars.size());
+}
+
+void renderStopSigns(CachedModel& model, const DrawView& view)
+{
+    if (!sceneInstances.stopSigns.empty())
+        model.Draw(view, sceneInstances.stopSigns.data(), sceneInstances.stopSigns.size());
+}
+
+void renderRaceTrack(CachedModel& model, const DrawView& view)
+{
+    if (trackStreamer.isOpen()) {
+        trackStreamer.draw(view);
+        return;
+    }
+
+    // model conversion
+    glm::mat4 modelMatrix = glm::mat4(1.0f);
+
+    model.Draw(view, modelMatrix);
+}
+
+// Model matrix of a car standing at the position with the yaw, like renderCar without the hierarchical parts
+glm::mat4 carModelMatrix(const glm::vec3& position, float yaw)
+{
+    glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), position);
+    modelMatrix = glm::rotate(modelMatrix, glm::radians(yaw - 90.0f), WORLD_UP);
+    return glm::scale(modelMatrix, glm::vec3(0.004f, 0.004f, 0.004f));
+}
+
+// The original Stop card, then the other cards alternately inside and outside of the ring, facing its center;
+// the traffic cars on two lanes of the ring, heading along it
+void sceneInit(int carCount, int stopSignCount)
+{
+    sceneInstances.cars.clear();
+    sceneInstances.stopSigns.clear();
+
+    for (int i = 0; i < stopSignCount; i++) {
+        glm::mat4 modelMatrix = glm::mat4(1.0f);
+        if (i == 0) {
+            modelMatrix = glm::translate(modelMatrix, glm::vec3(3.0f, 1.5f, -4.0f));
+            modelMatrix = glm::rotate(modelMatrix, glm::radians(-120.0f), WORLD_UP);
+        }
+        else {
+            float angle = 360.0f * i / stopSignCount;
+            float radius = SCENE_RING_RADIUS + ((i & 1) ? 8.0f : -8.0f);
+            glm::vec3 position(radius * cos(glm::radians(angle)), 1.5f, radius * sin(glm::radians(angle)));
+            modelMatrix = glm::translate(modelMatrix, position);
+            modelMatrix = glm::rotate(modelMatrix, glm::radians(-angle - 90.0f + ((i & 1) ? 0.0f : 180.0f)), WORLD_UP);
+        }
+        sceneInstances.stopSigns.push_back(modelMatrix);
+    }
+
+    // the matrices of the traffic are built every frame from the simulation
+    trafficFleet.init(carCount, SCENE_RING_RADIUS);
+}
+
+// The view and projection of the skybox come from the uniform buffer
+void renderSkyBox()
+{
+    glBindVertexArray(skyboxVAO);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glBindVertexArray(0);
+}
+
+// ---------------------------------
+// model cache
+// ---------------------------------
+
+CachedModel::CachedModel(const std::string& path)
+{
+    assetLoader.loadModel(*this, path);
+}
+
+// Runs on a worker: map the cache, or convert the OBJ and write the cache for the next start
+bool readModel(const std::string& path, AssetUpload& upload)
+{
+    std::string cachePath = path + MODEL_CACHE_EXTENSION;
+
+    ModelSource source;
+    if (!getModelSource(path, source)) {
+        std::cout << "Model not found: " << path << std::endl;
+        return false;
+    }
+
+    // The cache stays mapped until the GL thread has uploaded the buffers straight from the mapping
+    std::unique_ptr<MappedFile> cache(new MappedFile());
+    if (cache->open(cachePath) && cache->getSize() >= sizeof(ModelCacheHeader)) {
+        ModelCacheHeader header;
+        memcpy(&header, cache->getData(), sizeof(header));
+
+        bool isCurrent = false;
+        if (header.sourceSize == source.size && isModelCacheValid(header, cache->getData() + sizeof(header), cache->getSize())) {
+            // same size but another modification time (a checkout, a copy): compare the contents
+            isCurrent = header.sourceTime == source.time;
+            if (!isCurrent) {
+                MappedFile obj;
+                isCurrent = obj.open(path) && hashBytes(obj.getData(), obj.getSize()) == header.sourceHash;
+
+                // remember the new modification time, so that the next start does not hash the OBJ again
+                if (isCurrent) {
+                    header.sourceTime = source.time;
+                    std::fstream file(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+                    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                }
+            }
+        }
+
+        if (isCurrent) {
+            upload.header = header;
+            upload.cache = std::move(cache);
+            return true;
+        }
+    }
+    cache.reset();
+
+    // missing or out of date
+    ModelData data;
+    if (!convertModel(path, data))
+        return false;
+
+    unsigned long long sourceHash = 0;
+    {
+        MappedFile obj;
+        if (obj.open(path))
+            sourceHash = hashBytes(obj.getData(), obj.getSize());
+    }
+    if (!writeModelCache(cachePath, data, source, sourceHash))
+        std::cout << "Failed to write model cache: " << cachePath << std::endl;
+
+    upload.header = makeModelCacheHeader(data);
+    upload.header.sourceHash = sourceHash;
+    appendModelSections(data, upload.sections);
+    upload.isConverted = true;
+    return true;
+}
+
+// Copy the model into the arena and request the textures
+void CachedModel::upload(const ModelCacheHeader& header, const unsigned char* sections, const std::string& directory)
+{
+    const ModelVertex* vertices = (const ModelVertex*)sections;
+    const unsigned int* indices = (const unsigned int*)(sections + header.vertexCount * sizeof(ModelVertex));
+    const unsigned char* meshEntries = (const unsigned char*)(indices + header.indexCount);
+    const unsigned char* materialEntries = meshEntries + header.meshCount * header.lodCount * sizeof(ModelMeshEntry);
+    const char* strings = (const char*)(materialEntries + header.materialCount * sizeof(ModelMaterialEntry));
+
+    // A model converted from the same OBJ in the same directory shares the vertices and indices of the one loaded
+    // first. The texture layers are part of the vertices, and the textures are found relative to the directory, so
+    // the same OBJ next to other textures (another livery) gets vertices of its own
+    unsigned long long contentHash = 0;
+    if (header.sourceHash != 0) {
+        contentHash = header.sourceHash ^ (((unsigned long long)header.vertexCount << 32) | header.indexCount)
+            ^ hashBytes((const unsigned char*)directory.data(), directory.size());
+    }
+    unsigned int firstVertex, firstIndex;
+    meshResource = gpuResources.acquire(MEMORY_MESH, contentHash);
+    if (meshResource != 0) {
+        ResourceLocation location = gpuResources.getLocation(meshResource);
+        firstVertex = location.first;
+        firstIndex = location.second;
+    }
+    else {
+        geometryArena.append(vertices, header.vertexCount, indices, header.indexCount, firstVertex, firstIndex);
+        ResourceLocation location;
+        location.first = firstVertex;
+        location.second = firstIndex;
+        unsigned int vertexCount = header.vertexCount;
+        unsigned int indexCount = header.indexCount;
+        size_t gpuBytes = vertexCount * (sizeof(ModelVertex) + sizeof(unsigned short)) + indexCount * sizeof(unsigned int);
+        size_t cpuBytes = header.meshCount * header.lodCount * sizeof(ModelMeshEntry);
+        meshResource = gpuResources.create(directory, MEMORY_MESH, contentHash, gpuBytes, cpuBytes,
+            [firstVertex, vertexCount, firstIndex, indexCount]() {
+                geometryArena.release(firstVertex, vertexCount, firstIndex, indexCount);
+            }, location);
+    }
+
+    meshCount = header.meshCount;
+    lodCount = header.lodCount;
+    meshes.resize(meshCount * lodCount);
+    memcpy(meshes.data(), meshEntries, meshes.size() * sizeof(ModelMeshEntry));
+    for (unsigned int i = 0; i < meshCount; i++) {
+        boundsMin = i == 0 ? meshes[i].boundsMin : glm::min(boundsMin, meshes[i].boundsMin);
+        boundsMax = i == 0 ? meshes[i].boundsMax : glm::max(boundsMax, meshes[i].boundsMax);
+    }
+
+    for (ModelMeshEntry& mesh : meshes) {
+        // the vertices of the mesh are the ones its indices refer to
+        unsigned int vertexCount = 0;
+        for (unsigned int i = 0; i < mesh.indexCount; i++)
+            vertexCount = std::max(vertexCount, indices[mesh.firstIndex + i] + 1);
+
+        ModelMaterialEntry material;
+        memcpy(&material, materialEntries + mesh.material * sizeof(ModelMaterialEntry), sizeof(material));
+        if (material.diffuseTexture != MODEL_NO_TEXTURE && vertexCount > 0) {
+            TextureRequest request = { directory + '/' + (strings + material.diffuseTexture), firstVertex + mesh.baseVertex, vertexCount };
+            textureRequests.push_back(request);
+            assetLoader.requestTexture(request.path, request.firstVertex, request.vertexCount);
+        }
+
+        mesh.firstIndex += firstIndex;
+        mesh.baseVertex += (int)firstVertex;
+    }
+}
+
+void CachedModel::release()
+{
+    if (meshResource != 0)
+        gpuResources.release(meshResource);
+    meshResource = 0;
+    for (const TextureRequest& request : textureRequests)
+        assetLoader.releaseTexture(request.path, request.firstVertex, request.vertexCount);
+    textureRequests.clear();
+    meshes.clear();
+    meshCount = 0;
+}
+
+void CachedModel::Draw(const DrawView& view, const glm::mat4* transforms, size_t count) const
+{
+    if (meshes.empty())
+        return;
+
+    if (count == 1) {
+        size_t instanceOffset = instanceBuffer.append(transforms, 1);
+        for (unsigned int i = 0; i < meshCount; i++) {
+            // all levels of a mesh have the bounds of level 0
+            glm::vec3 center, extent;
+            transformBox(transforms[0], meshes[i].boundsMin, meshes[i].boundsMax, center, extent);
+            if (!isBoxVisible(view.frustum, center, extent)) {
+                cullingStats.culled++;
+                continue;
+            }
+            if (view.occlusion != nullptr && !view.occlusion->isBoxVisible(center, extent)) {
+                cullingStats.occluded++;
+                continue;
+            }
+            cullingStats.drawn++;
+            drawMesh(meshes[selectLod(view, center, glm::length(extent), lodCount) * meshCount + i], instanceOffset, 1);
+        }
+    }
+    else {
+        // sort the visible instances by level of detail, each level is one instanced draw per mesh
+        for (unsigned int level = 0; level < lodCount; level++)
+            lodInstances[level].clear();
+        for (size_t i = 0; i < count; i++) {
+            glm::vec3 center, extent;
+            transformBox(transforms[i], boundsMin, boundsMax, center, extent);
+            if (!isBoxVisible(view.frustum, center, extent)) {
+                cullingStats.culled++;
+                continue;
+            }
+            if (view.occlusion != nullptr && !view.occlusion->isBoxVisible(center, extent)) {
+                cullingStats.occluded++;
+                continue;
+            }
+            cullingStats.drawn++;
+            lodInstances[selectLod(view, center, glm::length(extent), lodCount)].push_back(transforms[i]);
+        }
+
+        for (unsigned int level = 0; level < lodCount; level++) {
+            if (lodInstances[level].empty())
+                continue;
+            size_t instanceOffset = instanceBuffer.append(lodInstances[level].data(), lodInstances[level].size());
+            for (unsigned int i = 0; i < meshCount; i++)
+                drawMesh(meshes[level * meshCount + i], instanceOffset, lodInstances[level].size());
+        }
+    }
+}
+
+void CachedModel::drawMesh(const ModelMeshEntry& mesh, size_t instanceOffset, size_t instanceCount) const
+{
+    if (mesh.indexCount == 0)
+        return;
+    cullingStats.triangles += (long long)mesh.indexCount / 3 * instanceCount;
+    drawBatch.add(mesh, instanceOffset, instanceCount);
+}
+
+void InstanceBuffer::init(size_t initialCapacity)
+{
+    capacity = initialCapacity;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+}
+
+void InstanceBuffer::beginFrame()
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+    offset = 0;
+}
+
+size_t InstanceBuffer::append(const glm::mat4* transforms, size_t count)
+{
+    size_t size = count * sizeof(glm::mat4);
+    if (offset + size > capacity) {
+        // the batched draws still refer to the matrices in the current storage
+        drawBatch.flush();
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        capacity = std::max(capacity, 2 * size);
+        glBufferData(GL_ARRAY_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+        offset = 0;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+    // The range has not been written since the buffer was orphaned, so there is nothing to wait for
+    void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, offset, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (mapped != nullptr) {
+        memcpy(mapped, transforms, size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    else {
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, transforms);
+    }
+
+    size_t result = offset;
+    offset += size;
+    return result;
+}
+
+void GeometryArena::init(size_t vertexCapacityAtStart, size_t indexCapacityAtStart)
+{
+    glGenVertexArrays(1, &VAO);
+    initialVertexCapacity = vertexCapacityAtStart;
+    initialIndexCapacity = indexCapacityAtStart;
+    resource = gpuResources.create("geometry arena", MEMORY_MESH, 0, 0, 0, nullptr);
+    reallocate(initialVertexCapacity, initialIndexCapacity);
+}
+
+void GeometryArena::append(const ModelVertex* vertices, unsigned int newVertexCount, const unsigned int* indices, unsigned int newIndexCount,
+    unsigned int& firstVertex, unsigned int& firstIndex)
+{
+    // a released range that is large enough, the end of the arena otherwise
+    size_t vertexOffset = vertexCount;
+    size_t indexOffset = indexCount;
+    size_t vertexEnd = vertexCount;
+    size_t indexEnd = indexCount;
+    if (!takeFreeRange(freeVertices, newVertexCount, vertexOffset))
+        vertexEnd += newVertexCount;
+    if (!takeFreeRange(freeIndices, newIndexCount, indexOffset))
+        indexEnd += newIndexCount;
+    if (vertexEnd > vertexCapacity || indexEnd > indexCapacity)
+        reallocate(std::max(2 * vertexCapacity, vertexEnd), std::max(2 * indexCapacity, indexEnd));
+
+    firstVertex = (unsigned int)vertexOffset;
+    firstIndex = (unsigned int)indexOffset;
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferSubData(GL_ARRAY_BUFFER, vertexOffset * sizeof(ModelVertex), newVertexCount * sizeof(ModelVertex), vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, layerBuffer);
+    std::vector<unsigned short> layers(newVertexCount, 0);
+    glBufferSubData(GL_ARRAY_BUFFER, vertexOffset * sizeof(unsigned short), newVertexCount * sizeof(unsigned short), layers.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset * sizeof(unsigned int), newIndexCount * sizeof(unsigned int), indices);
+    vertexCount = vertexEnd;
+    indexCount = indexEnd;
+    usedVertices += newVertexCount;
+    usedIndices += newIndexCount;
+    updateResource();
+}
+
+// Nothing draws the vertices of the ranges until an append reuses them
+void GeometryArena::release(unsigned int firstVertex, unsigned int releasedVertexCount, unsigned int firstIndex, unsigned int releasedIndexCount)
+{
+    addFreeRange(freeVertices, firstVertex, releasedVertexCount);
+    addFreeRange(freeIndices, firstIndex, releasedIndexCount);
+    vertexCount = trimFreeTail(freeVertices, vertexCount);
+    indexCount = trimFreeTail(freeIndices, indexCount);
+    usedVertices -= releasedVertexCount;
+    usedIndices -= releasedIndexCount;
+    if ((vertexCapacity > initialVertexCapacity || indexCapacity > initialIndexCapacity)
+        && vertexCount <= vertexCapacity / 4 && indexCount <= indexCapacity / 4)
+        reallocate(std::max(initialVertexCapacity, vertexCapacity / 2), std::max(initialIndexCapacity, indexCapacity / 2));
+    updateResource();
+}
+
+void GeometryArena::setLayer(unsigned int firstVertex, unsigned int count, unsigned short layer)
+{
+    std::vector<unsigned short> layers(count, layer);
+    glBindBuffer(GL_ARRAY_BUFFER, layerBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, firstVertex * sizeof(unsigned short), count * sizeof(unsigned short), layers.data());
+}
+
+// New buffers of the capacity, with what is below vertexCount and indexCount copied
+void GeometryArena::reallocate(size_t newVertexCapacity, size_t newIndexCapacity)
+{
+    unsigned int buffers[3];
+    glGenBuffers(3, buffers);
+    size_t sizes[3] = {
+        newVertexCapacity * sizeof(ModelVertex), newVertexCapacity * sizeof(unsigned short), newIndexCapacity * sizeof(unsigned int) };
+    size_t used[3] = {
+        vertexCount * sizeof(ModelVertex), vertexCount * sizeof(unsigned short), indexCount * sizeof(unsigned int) };
+    unsigned int* oldBuffers[3] = { &VBO, &layerBuffer, &EBO };
+
+    for (int i = 0; i < 3; i++) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[i]);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizes[i], nullptr, GL_STATIC_DRAW);
+        if (*oldBuffers[i] != 0) {
+            if (used[i] > 0) {
+                glBindBuffer(GL_COPY_READ_BUFFER, *oldBuffers[i]);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used[i]);
+            }
+            glDeleteBuffers(1, oldBuffers[i]);
+        }
+        *oldBuffers[i] = buffers[i];
+    }
+    vertexCapacity = newVertexCapacity;
+    indexCapacity = newIndexCapacity;
+    setAttributes();
+}
+
+void GeometryArena::updateResource()
+{
+    const size_t vertexBytes = sizeof(ModelVertex) + sizeof(unsigned short);
+    gpuResources.resize(resource, (vertexCapacity - usedVertices) * vertexBytes + (indexCapacity - usedIndices) * sizeof(unsigned int), 0);
+}
+
+void GeometryArena::setAttributes()
+{
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ModelVertex), (void*)offsetof(ModelVertex, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ModelVertex), (void*)offsetof(ModelVertex, normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(ModelVertex), (void*)offsetof(ModelVertex, texCoords));
+    glBindBuffer(GL_ARRAY_BUFFER, layerBuffer);
+    glEnableVertexAttribArray(LAYER_ATTRIBUTE_LOCATION);
+    glVertexAttribIPointer(LAYER_ATTRIBUTE_LOCATION, 1, GL_UNSIGNED_SHORT, sizeof(unsigned short), (void*)0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    // one model matrix per instance, pointed at the instance buffer by the draw batch
+    for (unsigned int column = 0; column < 4; column++) {
+        glEnableVertexAttribArray(INSTANCE_ATTRIBUTE_LOCATION + column);
+        glVertexAttribDivisor(INSTANCE_ATTRIBUTE_LOCATION + column, 1);
+    }
+    glBindVertexArray(0);
+}
+
+void TextureArray::init(unsigned int initialCapacity)
+{
+    texture = allocate(initialCapacity);
+    initialLayerCapacity = initialCapacity;
+    layerCapacity = initialCapacity;
+    resource = gpuResources.create("texture array", MEMORY_TEXTURE, 0, 0, 0, nullptr);
+
+    // the placeholder
+    std::vector<unsigned char> pixels((size_t)TEXTURE_LAYER_SIZE * TEXTURE_LAYER_SIZE * 4, 255);
+    for (size_t i = 0; i < pixels.size(); i += 4)
+        memcpy(&pixels[i], PLACEHOLDER_TEXTURE_COLOR, 3);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, addLayer(), TEXTURE_LAYER_SIZE, TEXTURE_LAYER_SIZE, 1,
+        GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    generateMipmaps();
+}
+
+// Array textures cannot be resized: the layers are copied into a new texture of twice the capacity
+unsigned int TextureArray::addLayer()
+{
+    if (!freeLayers.empty()) {
+        unsigned int layer = freeLayers.back();
+        freeLayers.pop_back();
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        updateResource();
+        return layer;
+    }
+    if (layerCount == layerCapacity)
+        reallocate(2 * layerCapacity);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    layerCount++;
+    updateResource();
+    return layerCount - 1;
+}
+
+void TextureArray::freeLayer(unsigned int layer)
+{
+    if (layer == 0)
+        return;
+    freeLayers.push_back(layer);
+    for (auto last = std::find(freeLayers.begin(), freeLayers.end(), layerCount - 1); last != freeLayers.end();
+        last = std::find(freeLayers.begin(), freeLayers.end(), layerCount - 1)) {
+        freeLayers.erase(last);
+        layerCount--;
+    }
+    if (layerCapacity > initialLayerCapacity && layerCount <= layerCapacity / 4)
+        reallocate(layerCapacity / 2);
+    updateResource();
+}
+
+void TextureArray::reallocate(unsigned int capacity)
+{
+    unsigned int reallocated = allocate(capacity);
+
+    unsigned int framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    for (unsigned int layer = 0; layer < layerCount; layer++) {
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, layer);
+        glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, 0, 0, TEXTURE_LAYER_SIZE, TEXTURE_LAYER_SIZE);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+
+    glDeleteTextures(1, &texture);
+    texture = reallocated;
+    layerCapacity = capacity;
+    generateMipmaps();
+}
+
+void TextureArray::updateResource()
+{
+    size_t textureLayers = layerCount - 1 - freeLayers.size();
+    gpuResources.resize(resource, (layerCapacity - textureLayers) * TEXTURE_LAYER_BYTES, 0);
+}
+
+void TextureArray::generateMipmaps()
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+}
+
+// Leaves the new texture bound
+unsigned int TextureArray::allocate(unsigned int capacity)
+{
+    unsigned int result;
+    glGenTextures(1, &result);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, result);
+    for (int level = 0, size = TEXTURE_LAYER_SIZE; size > 0; level++, size /= 2)
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, size, size, capacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    return result;
+}
+
+void DrawBatch::init()
+{
+    isIndirect = hasMultiDrawIndirect();
+    if (isIndirect)
+        glGenBuffers(1, &indirectBuffer);
+}
+
+// The matrices of an instance are found through the base instance, which moves the instance attributes
+void DrawBatch::add(const ModelMeshEntry& mesh, size_t instanceOffset, size_t instanceCount)
+{
+    DrawElementsIndirectCommand command;
+    command.count = mesh.indexCount;
+    command.instanceCount = (unsigned int)instanceCount;
+    command.firstIndex = mesh.firstIndex;
+    command.baseVertex = mesh.baseVertex;
+    command.baseInstance = (unsigned int)(instanceOffset / sizeof(glm::mat4));
+    commands.push_back(command);
+}
+
+// The diffuse textures are bound to GL_TEXTURE0, the sampler "diffuseTexture"
+void DrawBatch::flush()
+{
+    if (commands.empty())
+        return;
+    glBindVertexArray(geometryArena.getVertexArray());
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray.getTexture());
+
+#ifdef USE_MULTI_DRAW_INDIRECT
+    if (isIndirect) {
+        bindInstances(0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        size_t size = commands.size() * sizeof(DrawElementsIndirectCommand);
+        // new storage, so that the previous draws do not have to finish first
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, size, commands.data());
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, (GLsizei)commands.size(), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        cullingStats.drawCalls++;
+    }
+    else
+#endif
+    {
+        // without a base instance, the instance attributes are pointed at the matrices of every draw
+        size_t boundInstance = ~(size_t)0;
+        for (const DrawElementsIndirectCommand& command : commands) {
+            if (command.baseInstance != boundInstance) {
+                bindInstances(command.baseInstance * sizeof(glm::mat4));
+                boundInstance = command.baseInstance;
+            }
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                (void*)(command.firstIndex * sizeof(unsigned int)), command.instanceCount, command.baseVertex);
+        }
+        cullingStats.drawCalls += (int)commands.size();
+    }
+    glBindVertexArray(0);
+    commands.clear();
+}
+
+// Point the instance attributes of the arena at the matrices from the offset on
+void DrawBatch::bindInstances(size_t offset) const
+{
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer.getBuffer());
+    for (unsigned int column = 0; column < 4; column++) {
+        glVertexAttribPointer(INSTANCE_ATTRIBUTE_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+            (void*)(offset + column * sizeof(glm::vec4)));
+    }
+}
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+#ifdef _WIN32
+    // shared for writing, so that the modification time in the header can be updated while the cache is mapped
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        close();
+        return false;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        close();
+        return false;
+    }
+    data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        close();
+        return false;
+    }
+    size = (size_t)fileSize.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+    data = (const unsigned char*)mapped;
+    size = (size_t)fileStat.st_size;
+#endif
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+    if (mapping != NULL)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+    mapping = NULL;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (data != nullptr)
+        munmap((void*)data, size);
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+bool getModelSource(const std::string& path, ModelSource& source)
+{
+    std::error_code error;
+    source.size = std::filesystem::file_size(path, error);
+    if (error)
+        return false;
+    source.time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    return !error;
+}
+
+// 64-bit FNV-1a
+unsigned long long hashBytes(const unsigned char* data, size_t size)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Import the OBJ like the learnopengl Model, without the tangent space that none of the shaders uses
+bool convertModel(const std::string& path, ModelData& data)
+{
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFile(path.c_str(), aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+        return false;
+    }
+
+    convertModelNode(scene->mRootNode, scene, data);
+    generateModelLods(data);
+    return true;
+}
+
+// Append the meshes of the node and its children; like the learnopengl Model, the node transformations are ignored
+void convertModelNode(const aiNode* node, const aiScene* scene, ModelData& data)
+{
+    for (unsigned int i = 0; i < node->mNumMeshes; i++) {
+        const aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+
+        ModelMeshEntry entry;
+        entry.firstIndex = (unsigned int)data.indices.size();
+        entry.baseVertex = (unsigned int)data.vertices.size();
+        entry.material = (unsigned int)data.materials.size();
+
+        for (unsigned int j = 0; j < mesh->mNumVertices; j++) {
+            ModelVertex vertex;
+            vertex.position = glm::vec3(mesh->mVertices[j].x, mesh->mVertices[j].y, mesh->mVertices[j].z);
+            vertex.normal = mesh->HasNormals() ? glm::vec3(mesh->mNormals[j].x, mesh->mNormals[j].y, mesh->mNormals[j].z) : glm::vec3(0.0f);
+            vertex.texCoords = mesh->mTextureCoords[0] ? glm::vec2(mesh->mTextureCoords[0][j].x, mesh->mTextureCoords[0][j].y) : glm::vec2(0.0f);
+            data.vertices.push_back(vertex);
+        }
+        for (unsigned int j = 0; j < mesh->mNumFaces; j++) {
+            const aiFace& face = mesh->mFaces[j];
+            for (unsigned int k = 0; k < face.mNumIndices; k++)
+                data.indices.push_back(face.mIndices[k]);
+        }
+        entry.indexCount = (unsigned int)data.indices.size() - entry.firstIndex;
+        entry.boundsMin = glm::vec3(0.0f);
+        entry.boundsMax = glm::vec3(0.0f);
+
+        // every mesh gets its own material entry, the texture paths are shared in the string table
+        ModelMaterialEntry material = { MODEL_NO_TEXTURE };
+        const aiMaterial* aiMat = scene->mMaterials[mesh->mMaterialIndex];
+        aiString texturePath;
+        if (aiMat->GetTextureCount(aiTextureType_DIFFUSE) > 0 && aiMat->GetTexture(aiTextureType_DIFFUSE, 0, &texturePath) == AI_SUCCESS) {
+            std::string name = texturePath.C_Str();
+            size_t offset = data.strings.find(name + '\0');
+            if (offset == std::string::npos || (offset > 0 && data.strings[offset - 1] != '\0')) {
+                offset = data.strings.size();
+                data.strings += name;
+                data.strings += '\0';
+            }
+            material.diffuseTexture = (unsigned int)offset;
+        }
+        data.materials.push_back(material);
+        appendModelMesh(data, entry);
+    }
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+        convertModelNode(node->mChildren[i], scene, data);
+}
+
+// A mesh larger than MODEL_CHUNK_SIZE is split into the cells of a grid in the xz plane, one entry per cell
+// with its own bounds, so that the parts outside the view can be skipped. The chunks share the vertices
+// and the material of the mesh; only the order of its triangles changes
+void appendModelMesh(ModelData& data, const ModelMeshEntry& mesh)
+{
+    ModelMeshEntry whole = mesh;
+    computeMeshBounds(data, whole);
+    glm::vec3 extent = whole.boundsMax - whole.boundsMin;
+    if (extent.x <= MODEL_CHUNK_SIZE && extent.z <= MODEL_CHUNK_SIZE) {
+        data.meshes.push_back(whole);
+        return;
+    }
+
+    // cell of every triangle by its centroid, the cells in row order
+    int columns = (int)ceil(extent.x / MODEL_CHUNK_SIZE);
+    int rows = (int)ceil(extent.z / MODEL_CHUNK_SIZE);
+    unsigned int* indices = data.indices.data() + mesh.firstIndex;
+    const ModelVertex* vertices = data.vertices.data() + mesh.baseVertex;
+    unsigned int triangleCount = mesh.indexCount / 3;
+    std::vector<std::pair<int, unsigned int>> triangles(triangleCount);
+    for (unsigned int i = 0; i < triangleCount; i++) {
+        glm::vec3 centroid = (vertices[indices[3 * i]].position + vertices[indices[3 * i + 1]].position
+            + vertices[indices[3 * i + 2]].position) / 3.0f;
+        int column = glm::clamp((int)((centroid.x - whole.boundsMin.x) / MODEL_CHUNK_SIZE), 0, columns - 1);
+        int row = glm::clamp((int)((centroid.z - whole.boundsMin.z) / MODEL_CHUNK_SIZE), 0, rows - 1);
+        triangles[i] = std::make_pair(row * columns + column, i);
+    }
+    std::stable_sort(triangles.begin(), triangles.end(),
+        [](const std::pair<int, unsigned int>& a, const std::pair<int, unsigned int>& b) { return a.first < b.first; });
+
+    std::vector<unsigned int> sorted(triangleCount * 3);
+    for (unsigned int i = 0; i < triangleCount; i++)
+        for (int k = 0; k < 3; k++)
+            sorted[3 * i + k] = indices[3 * triangles[i].second + k];
+    std::copy(sorted.begin(), sorted.end(), indices);
+
+    // one entry per run of triangles in the same cell
+    for (unsigned int first = 0; first < triangleCount;) {
+        unsigned int last = first;
+        while (last < triangleCount && triangles[last].first == triangles[first].first)
+            last++;
+
+        ModelMeshEntry chunk = mesh;
+        chunk.firstIndex = mesh.firstIndex + 3 * first;
+        chunk.indexCount = 3 * (last - first);
+        computeMeshBounds(data, chunk);
+        data.meshes.push_back(chunk);
+        first = last;
+    }
+}
+
+// Levels of detail by vertex clustering: the vertices of each mesh are grouped on a grid, each group is replaced
+// by its member with the smallest quadric error, and the triangles that collapse are dropped. The levels only
+// add indices, they use the vertices of level 0. Chunks of the same mesh are clustered together, so the
+// levels have no cracks between the chunks
+void generateModelLods(ModelData& data)
+{
+    unsigned int meshCount = (unsigned int)data.meshes.size();
+    data.lodCount = MODEL_LOD_COUNT;
+    if (meshCount == 0)
+        return;
+
+    glm::vec3 boundsMin = data.meshes[0].boundsMin;
+    glm::vec3 boundsMax = data.meshes[0].boundsMax;
+    for (const ModelMeshEntry& mesh : data.meshes) {
+        boundsMin = glm::min(boundsMin, mesh.boundsMin);
+        boundsMax = glm::max(boundsMax, mesh.boundsMax);
+    }
+    glm::vec3 size = boundsMax - boundsMin;
+    float modelSize = std::max(std::max(size.x, size.y), std::max(size.z, 1e-6f));
+
+    // quadric of every vertex: the planes of its triangles, weighted by their area
+    std::vector<Quadric> quadrics(data.vertices.size());
+    for (const ModelMeshEntry& mesh : data.meshes) {
+        for (unsigned int i = 0; i + 2 < mesh.indexCount; i += 3) {
+            unsigned int a = mesh.baseVertex + data.indices[mesh.firstIndex + i];
+            unsigned int b = mesh.baseVertex + data.indices[mesh.firstIndex + i + 1];
+            unsigned int c = mesh.baseVertex + data.indices[mesh.firstIndex + i + 2];
+            glm::vec3 normal = glm::cross(data.vertices[b].position - data.vertices[a].position,
+                data.vertices[c].position - data.vertices[a].position);
+            float doubleArea = glm::length(normal);
+            if (doubleArea <= 0.0f)
+                continue;
+            normal /= doubleArea;
+            double d = -glm::dot(normal, data.vertices[a].position);
+            quadrics[a].addPlane(normal, d, doubleArea * 0.5);
+            quadrics[b].addPlane(normal, d, doubleArea * 0.5);
+            quadrics[c].addPlane(normal, d, doubleArea * 0.5);
+        }
+    }
+
+    // The meshes were converted one after the other, so each one (with all its chunks) owns the vertices from its base
+    // vertex up to the next base vertex
+    std::vector<unsigned int> vertexStarts;
+    for (const ModelMeshEntry& mesh : data.meshes)
+        vertexStarts.push_back(mesh.baseVertex);
+    vertexStarts.push_back((unsigned int)data.vertices.size());
+    std::sort(vertexStarts.begin(), vertexStarts.end());
+    vertexStarts.erase(std::unique(vertexStarts.begin(), vertexStarts.end()), vertexStarts.end());
+
+    std::vector<unsigned int> representative(data.vertices.size());
+    for (unsigned int level = 1; level < MODEL_LOD_COUNT; level++) {
+        float cellSize = modelSize / MODEL_LOD_GRID[level];
+
+        for (size_t group = 0; group + 1 < vertexStarts.size(); group++) {
+            std::unordered_map<unsigned long long, unsigned int> clusterIds;
+            std::vector<Quadric> clusterQuadrics;
+            std::vector<unsigned int> clusterOfVertex(vertexStarts[group + 1] - vertexStarts[group]);
+
+            for (unsigned int v = vertexStarts[group]; v < vertexStarts[group + 1]; v++) {
+                glm::vec3 cell = glm::floor((data.vertices[v].position - boundsMin) / cellSize);
+                unsigned long long key = ((unsigned long long)((int)cell.x & 0x1fffff))
+                    | ((unsigned long long)((int)cell.y & 0x1fffff) << 21)
+                    | ((unsigned long long)((int)cell.z & 0x1fffff) << 42);
+                auto inserted = clusterIds.emplace(key, (unsigned int)clusterQuadrics.size());
+                if (inserted.second)
+                    clusterQuadrics.push_back(Quadric());
+                clusterQuadrics[inserted.first->second].add(quadrics[v]);
+                clusterOfVertex[v - vertexStarts[group]] = inserted.first->second;
+            }
+
+            std::vector<unsigned int> best(clusterQuadrics.size(), 0);
+            std::vector<double> bestError(clusterQuadrics.size(), -1.0);
+            for (unsigned int v = vertexStarts[group]; v < vertexStarts[group + 1]; v++) {
+                unsigned int cluster = clusterOfVertex[v - vertexStarts[group]];
+                double error = clusterQuadrics[cluster].evaluate(data.vertices[v].position);
+                if (bestError[cluster] < 0.0 || error < bestError[cluster]) {
+                    best[cluster] = v;
+                    bestError[cluster] = error;
+                }
+            }
+            for (unsigned int v = vertexStarts[group]; v < vertexStarts[group + 1]; v++)
+                representative[v] = best[clusterOfVertex[v - vertexStarts[group]]];
+        }
+
+        for (unsigned int i = 0; i < meshCount; i++) {
+            ModelMeshEntry lod = data.meshes[i];
+            lod.firstIndex = (unsigned int)data.indices.size();
+            for (unsigned int j = 0; j + 2 < data.meshes[i].indexCount; j += 3) {
+                unsigned int corners[3];
+                for (int k = 0; k < 3; k++)
+                    corners[k] = representative[lod.baseVertex + data.indices[data.meshes[i].firstIndex + j + k]] - lod.baseVertex;
+                if (corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2])
+                    continue;
+                data.indices.insert(data.indices.end(), corners, corners + 3);
+            }
+            lod.indexCount = (unsigned int)data.indices.size() - lod.firstIndex;
+            data.meshes.push_back(lod);
+        }
+    }
+}
+
+void computeMeshBounds(const ModelData& data, ModelMeshEntry& mesh)
+{
+    mesh.boundsMin = glm::vec3(0.0f);
+    mesh.boundsMax = glm::vec3(0.0f);
+    for (unsigned int i = 0; i < mesh.indexCount; i++) {
+        const glm::vec3& position = data.vertices[mesh.baseVertex + data.indices[mesh.firstIndex + i]].position;
+        mesh.boundsMin = i == 0 ? position : glm::min(mesh.boundsMin, position);
+        mesh.boundsMax = i == 0 ? position : glm::max(mesh.boundsMax, position);
+    }
+}
+
+// Written to a temporary file first, so that an interrupted conversion never leaves a broken cache behind
+bool writeModelCache(const std::string& cachePath, const ModelData& data, const ModelSource& source, unsigned long long sourceHash)
+{
+    ModelCacheHeader header = makeModelCacheHeader(data);
+    header.sourceSize = source.size;
+    header.sourceTime = source.time;
+    header.sourceHash = sourceHash;
+
+    std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(data.vertices.data()), data.vertices.size() * sizeof(ModelVertex));
+        out.write(reinterpret_cast<const char*>(data.indices.data()), data.indices.size() * sizeof(unsigned int));
+        out.write(reinterpret_cast<const char*>(data.meshes.data()), data.meshes.size() * sizeof(ModelMeshEntry));
+        out.write(reinterpret_cast<const char*>(data.materials.data()), data.materials.size() * sizeof(ModelMaterialEntry));
+        out.write(data.strings.data(), data.strings.size());
+        if (!out)
+            return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, cachePath, error);
+    return !error;
+}
+
+// Header without the source, the meshes are counted per level of detail
+ModelCacheHeader makeModelCacheHeader(const ModelData& data)
+{
+    ModelCacheHeader header = {};
+    memcpy(header.magic, MODEL_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MODEL_CACHE_VERSION;
+    header.vertexCount = (unsigned int)data.vertices.size();
+    header.indexCount = (unsigned int)data.indices.size();
+    header.meshCount = (unsigned int)(data.meshes.size() / data.lodCount);
+    header.materialCount = (unsigned int)data.materials.size();
+    header.stringBytes = (unsigned int)data.strings.size();
+    header.lodCount = data.lodCount;
+    return header;
+}
+
+// Check the header against the file size, and every mesh and material against the sections, so that a truncated,
+// foreign or corrupt file is converted again instead of being read out of bounds: the indices of a mesh stay within
+// the vertices, its material is one of the materials, every texture path starts in the string table and the
+// table ends with '\0'
+bool isModelCacheValid(const ModelCacheHeader& header, const unsigned char* sections, size_t fileSize)
+{
+    if (memcmp(header.magic, MODEL_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != MODEL_CACHE_VERSION
+        || header.lodCount == 0 || header.lodCount > MODEL_LOD_COUNT)
+        return false;
+
+    unsigned long long expectedSize = sizeof(ModelCacheHeader)
+        + (unsigned long long)header.vertexCount * sizeof(ModelVertex)
+        + (unsigned long long)header.indexCount * sizeof(unsigned int)
+        + (unsigned long long)header.meshCount * header.lodCount * sizeof(ModelMeshEntry)
+        + (unsigned long long)header.materialCount * sizeof(ModelMaterialEntry)
+        + header.stringBytes;
+    if (expectedSize != fileSize)
+        return false;
+
+    const unsigned int* indices = (const unsigned int*)(sections + header.vertexCount * sizeof(ModelVertex));
+    const unsigned char* meshEntries = (const unsigned char*)(indices + header.indexCount);
+    const unsigned char* materialEntries = meshEntries + header.meshCount * header.lodCount * sizeof(ModelMeshEntry);
+    const char* strings = (const char*)(materialEntries + header.materialCount * sizeof(ModelMaterialEntry));
+    if (header.stringBytes > 0 && strings[header.stringBytes - 1] != '\0')
+        return false;
+
+    for (unsigned int i = 0; i < header.meshCount * header.lodCount; i++) {
+        ModelMeshEntry mesh;
+        memcpy(&mesh, meshEntries + i * sizeof(ModelMeshEntry), sizeof(mesh));
+        if ((unsigned long long)mesh.firstIndex + mesh.indexCount > header.indexCount || mesh.baseVertex > header.vertexCount
+            || mesh.material >= header.materialCount)
+            return false;
+        for (unsigned int j = 0; j < mesh.indexCount; j++) {
+            if (indices[mesh.firstIndex + j] >= header.vertexCount - mesh.baseVertex)
+                return false;
+        }
+    }
+    for (unsigned int i = 0; i < header.materialCount; i++) {
+        ModelMaterialEntry material;
+        memcpy(&material, materialEntries + i * sizeof(ModelMaterialEntry), sizeof(material));
+        if (material.diffuseTexture != MODEL_NO_TEXTURE && material.diffuseTexture >= header.stringBytes)
+            return false;
+    }
+    return true;
+}
+
+// "--build-model-cache": convert every model, whether its cache is current or not
+int buildModelCaches()
+{
+    int result = 0;
+    for (const char* modelPath : MODEL_PATHS) {
+        std::string path = FileSystem::getPath(modelPath);
+        auto start = std::chrono::steady_clock::now();
+
+        ModelSource source;
+        ModelData data;
+        MappedFile obj;
+        if (!getModelSource(path, source) || !obj.open(path) || !convertModel(path, data)) {
+            std::cout << "Failed to convert model: " << path << std::endl;
+            result = -1;
+            continue;
+        }
+        if (!writeModelCache(path + MODEL_CACHE_EXTENSION, data, source, hashBytes(obj.getData(), obj.getSize()))) {
+            std::cout << "Failed to write model cache: " << path << MODEL_CACHE_EXTENSION << std::endl;
+            result = -1;
+            continue;
+        }
+        std::cout << path << MODEL_CACHE_EXTENSION << ": " << data.vertices.size() << " vertices, " << data.indices.size() / 3
+            << " triangles, " << data.meshes.size() / data.lodCount << " meshes, " << data.lodCount << " levels of detail, "
+            << elapsedMs(start) << " ms" << std::endl;
+
+        if (strcmp(modelPath, RACE_TRACK_MODEL_PATH) == 0) {
+            ModelCacheHeader header = makeModelCacheHeader(data);
+            header.sourceHash = hashBytes(obj.getData(), obj.getSize());
+            std::vector<unsigned char> sections;
+            appendModelSections(data, sections);
+            if (!writeTrackTiles(path + TRACK_TILES_EXTENSION, header, sections.data())) {
+                std::cout << "Failed to write track tiles: " << path << TRACK_TILES_EXTENSION << std::endl;
+                result = -1;
+            }
+        }
+    }
+    return result;
+}
+
+// ---------------------------------
+// shader permutations
+// ---------------------------------
+
+// Switch the main shader to the permutation of the shadow settings, and set its samplers
+bool selectMainShader()
+{
+    std::vector<std::string> defines;
+    if (isShadowEnabled) {
+        defines.push_back("SHADOW_FILTER_SIZE " + std::to_string(shadowFilterSize));
+        defines.push_back("CASCADE_COUNT " + std::to_string(SHADOW_CASCADE_COUNT));
+    }
+    else {
+        defines.push_back("NO_SHADOWS");
+    }
+    if (isClusteredLighting) {
+        defines.push_back("CLUSTERED_LIGHTS");
+        defines.push_back("CLUSTER_COUNT_X " + std::to_string(CLUSTER_COUNT_X));
+        defines.push_back("CLUSTER_COUNT_Y " + std::to_string(CLUSTER_COUNT_Y));
+        defines.push_back("CLUSTER_COUNT_Z " + std::to_string(CLUSTER_COUNT_Z));
+    }
+    ShaderProgram* program = shaderLibrary.get("shader/light_and_shadow.vs", "shader/light_and_shadow.fs", defines);
+    if (program == nullptr || !checkShaderInterface(program, "shader/light_and_shadow.vs", true, true, true))
+        return false;
+
+    mainShader = program;
+    mainShader->use();
+    mainShader->setInt("diffuseTexture", 0);
+    // The cascades are bound to "GL_TEXTURE12" and up, which needs to correspond to renderLight
+    for (int i = 0; isShadowEnabled && i < SHADOW_CASCADE_COUNT; i++)
+        mainShader->setInt("shadowMaps[" + std::to_string(i) + "]", SHADOW_TEXTURE_UNIT + i);
+    mainShader->setInt("cascadeCount", SHADOW_CASCADE_COUNT);
+    // a shader without the light lists would never read them, so they are not built at all
+    if (isClusteredLighting && glGetUniformLocation(mainShader->ID, "clusterGrid") == -1) {
+        std::cout << "[LIGHTS]light_and_shadow.fs does not read the clusters, clustered lighting is off" << std::endl;
+        isClusteredLighting = false;
+        lightClusters.stop();
+    }
+    // the texture buffers of the clusters, bound by LightClusters::upload
+    if (isClusteredLighting) {
+        mainShader->setInt("lightData", CLUSTER_TEXTURE_UNIT);
+        mainShader->setInt("clusterGrid", CLUSTER_TEXTURE_UNIT + 1);
+        mainShader->setInt("clusterLights", CLUSTER_TEXTURE_UNIT + 2);
+    }
+    return true;
+}
+
+// A shader from before the uniform buffer, the instance buffer or the texture array would compile and draw garbage,
+// so one that does not declare what the draws feed it is refused
+bool checkShaderInterface(const ShaderProgram* program, const char* path, bool usesFrameConstants, bool usesInstances, bool usesLayer)
+{
+    bool isValid = true;
+    if (usesFrameConstants && glGetUniformBlockIndex(program->ID, "FrameConstants") == GL_INVALID_INDEX) {
+        std::cout << "ERROR::SHADER::INTERFACE: " << path << " does not declare the uniform block FrameConstants" << std::endl;
+        isValid = false;
+    }
+    if (usesInstances && glGetAttribLocation(program->ID, "instanceModel") != (GLint)INSTANCE_ATTRIBUTE_LOCATION) {
+        std::cout << "ERROR::SHADER::INTERFACE: " << path << " does not read \"mat4 instanceModel\" at location "
+            << INSTANCE_ATTRIBUTE_LOCATION << std::endl;
+        isValid = false;
+    }
+    if (usesLayer && glGetAttribLocation(program->ID, "aLayer") != (GLint)LAYER_ATTRIBUTE_LOCATION) {
+        std::cout << "ERROR::SHADER::INTERFACE: " << path << " does not read \"uint aLayer\" at location "
+            << LAYER_ATTRIBUTE_LOCATION << std::endl;
+        isValid = false;
+    }
+    return isValid;
+}
+
+ShaderProgram* ShaderLibrary::get(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines)
+{
+    std::string key = std::string(vertexPath) + '|' + fragmentPath;
+    for (const std::string& define : defines)
+        key += '|' + define;
+
+    auto found = programs.find(key);
+    if (found != programs.end())
+        return found->second.get();
+
+    std::unique_ptr<ShaderProgram> program(new ShaderProgram());
+    if (!program->load(vertexPath, fragmentPath, defines))
+        return nullptr;
+    return (programs[key] = std::move(program)).get();
+}
+
+bool ShaderProgram::load(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines)
+{
+    std::string sources[2];
+    const char* paths[2] = { vertexPath, fragmentPath };
+    for (int i = 0; i < 2; i++) {
+        std::ifstream file(paths[i], std::ios::binary);
+        if (!file) {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << paths[i] << std::endl;
+            return false;
+        }
+        std::stringstream stream;
+        stream << file.rdbuf();
+        sources[i] = stream.str();
+
+        // the defines go after the "#version" line, which has to stay the first one
+        std::string defineLines;
+        for (const std::string& define : defines)
+            defineLines += "#define " + define + "\n";
+        size_t insertAt = 0;
+        if (sources[i].compare(0, 8, "#version") == 0) {
+            if (sources[i].find('\n') == std::string::npos)
+                sources[i] += '\n';
+            insertAt = sources[i].find('\n') + 1;
+        }
+        sources[i].insert(insertAt, defineLines);
+    }
+
+    // The binary of a program depends on the sources with the defines and on the driver that compiled it
+    std::string key = sources[0] + '\0' + sources[1] + '\0';
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+        const GLubyte* value = glGetString(name);
+        key += value != nullptr ? (const char*)value : "";
+        key += '\0';
+    }
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", hashBytes((const unsigned char*)key.data(), key.size()));
+    std::string cachePath = std::string(SHADER_CACHE_DIRECTORY) + "/" + hash + ".bin";
+
+    if (!loadBinary(cachePath)) {
+        if (!compile(sources[0], sources[1]))
+            return false;
+        saveBinary(cachePath);
+    }
+
+    lightSpaceMatrixLocation = glGetUniformLocation(ID, "lightSpaceMatrix");
+    // not part of the binary, set after every load
+    unsigned int blockIndex = glGetUniformBlockIndex(ID, "FrameConstants");
+    if (blockIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(ID, blockIndex, FRAME_CONSTANTS_BINDING);
+    return true;
+}
+
+bool ShaderProgram::compile(const std::string& vertexSource, const std::string& fragmentSource)
+{
+    const std::string* sources[2] = { &vertexSource, &fragmentSource };
+    const GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    const char* typeNames[2] = { "VERTEX", "FRAGMENT" };
+    char infoLog[1024];
+
+    ID = glCreateProgram();
+    bool isCompiled = true;
+    for (int i = 0; i < 2; i++) {
+        unsigned int shaderObject = glCreateShader(types[i]);
+        const char* code = sources[i]->c_str();
+        glShaderSource(shaderObject, 1, &code, NULL);
+        glCompileShader(shaderObject);
+        GLint success;
+        glGetShaderiv(shaderObject, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            glGetShaderInfoLog(shaderObject, sizeof(infoLog), NULL, infoLog);
+            std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << typeNames[i] << "\n" << infoLog << std::endl;
+            isCompiled = false;
+        }
+        glAttachShader(ID, shaderObject);
+        // deleted with the program
+        glDeleteShader(shaderObject);
+    }
+
+#ifdef USE_PROGRAM_BINARY
+    if (hasProgramBinary())
+        glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+    glLinkProgram(ID);
+    GLint success;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(ID, sizeof(infoLog), NULL, infoLog);
+        std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: PROGRAM\n" << infoLog << std::endl;
+    }
+    if (!isCompiled || !success) {
+        glDeleteProgram(ID);
+        ID = 0;
+        return false;
+    }
+    return true;
+}
+
+// A binary the driver rejects (another driver version, a corrupt file) is compiled again and overwritten
+bool ShaderProgram::loadBinary(const std::string& cachePath)
+{
+#ifdef USE_PROGRAM_BINARY
+    if (!hasProgramBinary())
+        return false;
+
+    MappedFile file;
+    struct {
+        char magic[4];
+        unsigned int version;
+        unsigned int format;
+    } header;
+    if (!file.open(cachePath) || file.getSize() <= sizeof(header))
+        return false;
+    memcpy(&header, file.getData(), sizeof(header));
+    if (memcmp(header.magic, SHADER_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != SHADER_CACHE_VERSION)
+        return false;
+
+    ID = glCreateProgram();
+    glProgramBinary(ID, header.format, file.getData() + sizeof(header), (GLsizei)(file.getSize() - sizeof(header)));
+    GLint success;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    if (success)
+        return true;
+    glDeleteProgram(ID);
+    ID = 0;
+#endif
+    return false;
+}
+
+void ShaderProgram::saveBinary(const std::string& cachePath) const
+{
+#ifdef USE_PROGRAM_BINARY
+    if (!hasProgramBinary())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(ID, length, &length, &format, binary.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(SHADER_CACHE_DIRECTORY, error);
+    std::ofstream file(cachePath, std::ios::binary);
+    unsigned int version = SHADER_CACHE_VERSION;
+    unsigned int binaryFormat = format;
+    file.write(SHADER_CACHE_MAGIC, sizeof(SHADER_CACHE_MAGIC));
+    file.write((const char*)&version, sizeof(version));
+    file.write((const char*)&binaryFormat, sizeof(binaryFormat));
+    file.write(binary.data(), length);
+    if (!file)
+        std::cout << "Failed to write shader cache: " << cachePath << std::endl;
+#endif
+}
+
+// ---------------------------------
+// render graph
+// ---------------------------------
+
+bool isDepthFormat(GLenum internalFormat)
+{
+    return internalFormat == GL_DEPTH_COMPONENT || internalFormat == GL_DEPTH_COMPONENT16 || internalFormat == GL_DEPTH_COMPONENT24
+        || internalFormat == GL_DEPTH_COMPONENT32F || internalFormat == GL_DEPTH24_STENCIL8;
+}
+
+void RenderGraph::reset()
+{
+    resources.clear();
+    passes.clear();
+    order.clear();
+}
+
+RenderResource RenderGraph::importFramebuffer(const char* name, unsigned int framebuffer, int width, int height, GLbitfield attachments, bool isOutput)
+{
+    Resource resource;
+    resource.name = name;
+    resource.kind = RESOURCE_FRAMEBUFFER;
+    resource.framebuffer = framebuffer;
+    resource.width = width;
+    resource.height = height;
+    resource.attachments = attachments;
+    resource.isOutput = isOutput;
+    resources.push_back(resource);
+    return (RenderResource)resources.size() - 1;
+}
+
+RenderResource RenderGraph::createTexture(const char* name, int width, int height, GLenum internalFormat)
+{
+    Resource resource;
+    resource.name = name;
+    resource.kind = RESOURCE_TEXTURE;
+    resource.width = width;
+    resource.height = height;
+    resource.internalFormat = internalFormat;
+    resources.push_back(resource);
+    return (RenderResource)resources.size() - 1;
+}
+
+int RenderGraph::addPass(const char* name, ProfilePass profilePass, std::function<void()> execute)
+{
+    Pass pass;
+    pass.name = name;
+    pass.profilePass = profilePass;
+    pass.execute = std::move(execute);
+    passes.push_back(std::move(pass));
+    return (int)passes.size() - 1;
+}
+
+void RenderGraph::read(int pass, RenderResource resource)
+{
+    passes[pass].reads.push_back(resource);
+}
+
+void RenderGraph::write(int pass, RenderResource resource, RenderLoadOp load)
+{
+    passes[pass].writes.push_back(std::make_pair(resource, load));
+}
+
+void RenderGraph::setShader(int pass, const ShaderProgram* shader)
+{
+    passes[pass].shader = shader;
+}
+
+void RenderGraph::setDepthFunc(int pass, GLenum passDepthFunc)
+{
+    passes[pass].depthFunc = passDepthFunc;
+}
+
+void RenderGraph::setViewport(int pass, int width, int height)
+{
+    passes[pass].viewportWidth = width;
+    passes[pass].viewportHeight = height;
+}
+
+void RenderGraph::compile()
+{
+    frame++;
+    cull();
+    sort();
+    allocate();
+}
+
+// Starting from the resources nobody reads, a pass goes when none of what it writes is read or an output,
+// and then what it reads may go as well
+void RenderGraph::cull()
+{
+    std::vector<int> readerCount(resources.size(), 0);
+    for (const Pass& pass : passes) {
+        for (RenderResource resource : pass.reads)
+            readerCount[resource]++;
+    }
+
+    std::vector<int> usedWrites(passes.size(), 0);
+    std::vector<RenderResource> unused;
+    for (size_t i = 0; i < passes.size(); i++) {
+        passes[i].isCulled = false;
+        usedWrites[i] = (int)passes[i].writes.size();
+        for (const auto& write : passes[i].writes) {
+            if (resources[write.first].isOutput)
+                usedWrites[i] = std::numeric_limits<int>::max();
+        }
+    }
+    for (size_t i = 0; i < resources.size(); i++) {
+        if (readerCount[i] == 0 && !resources[i].isOutput)
+            unused.push_back((RenderResource)i);
+    }
+    // a pass that writes nothing has nothing to keep it
+    for (size_t i = 0; i < passes.size(); i++) {
+        if (usedWrites[i] == 0)
+            passes[i].isCulled = true;
+    }
+
+    while (!unused.empty()) {
+        RenderResource resource = unused.back();
+        unused.pop_back();
+        for (size_t i = 0; i < passes.size(); i++) {
+            Pass& pass = passes[i];
+            if (pass.isCulled)
+                continue;
+            for (const auto& write : pass.writes) {
+                if (write.first != resource || --usedWrites[i] > 0)
+                    continue;
+                pass.isCulled = true;
+                for (RenderResource input : pass.reads) {
+                    if (--readerCount[input] == 0 && !resources[input].isOutput)
+                        unused.push_back(input);
+                }
+                break;
+            }
+        }
+    }
+}
+
+// A pass runs after the writers of what it reads, and after the readers and writers of what it overwrites.
+// Of the passes that are ready, the one of the earliest profiler pass runs first, so the timer of a profiler
+// pass covers one run of passes, then the one added first
+void RenderGraph::sort()
+{
+    std::vector<std::vector<int>> successors(passes.size());
+    std::vector<int> predecessorCount(passes.size(), 0);
+    std::vector<int> lastWriter(resources.size(), -1);
+    std::vector<std::vector<int>> readersSinceWrite(resources.size());
+    auto addEdge = [&](int from, int to) {
+        if (from < 0 || from == to)
+            return;
+        successors[from].push_back(to);
+        predecessorCount[to]++;
+    };
+    for (int i = 0; i < (int)passes.size(); i++) {
+        const Pass& pass = passes[i];
+        if (pass.isCulled)
+            continue;
+        for (RenderResource resource : pass.reads) {
+            addEdge(lastWriter[resource], i);
+            readersSinceWrite[resource].push_back(i);
+        }
+        for (const auto& write : pass.writes) {
+            addEdge(lastWriter[write.first], i);
+            for (int reader : readersSinceWrite[write.first])
+                addEdge(reader, i);
+            readersSinceWrite[write.first].clear();
+            lastWriter[write.first] = i;
+        }
+    }
+
+    auto isBefore = [this](int a, int b) {
+        if (passes[a].profilePass != passes[b].profilePass)
+            return passes[a].profilePass < passes[b].profilePass;
+        return a < b;
+    };
+    std::vector<int> ready;
+    for (int i = 0; i < (int)passes.size(); i++) {
+        if (!passes[i].isCulled && predecessorCount[i] == 0)
+            ready.push_back(i);
+    }
+    while (!ready.empty()) {
+        auto next = std::min_element(ready.begin(), ready.end(), isBefore);
+        int pass = *next;
+        ready.erase(next);
+        order.push_back(pass);
+        for (int successor : successors[pass]) {
+            if (--predecessorCount[successor] == 0)
+                ready.push_back(successor);
+        }
+    }
+}
+
+// Every transient texture takes a pooled texture of its size and format that is free from its first to its last
+// pass; a texture whose last pass is over can be taken by the next one
+void RenderGraph::allocate()
+{
+    for (int k = 0; k < (int)order.size(); k++) {
+        const Pass& pass = passes[order[k]];
+        auto use = [&](RenderResource resource) {
+            Resource& used = resources[resource];
+            if (used.kind != RESOURCE_TEXTURE)
+                return;
+            if (used.firstUse < 0)
+                used.firstUse = k;
+            used.lastUse = k;
+        };
+        for (RenderResource resource : pass.reads)
+            use(resource);
+        for (const auto& write : pass.writes)
+            use(write.first);
+    }
+
+    for (PooledTexture& pooled : pool)
+        pooled.busyUntil = -1;
+    for (int k = 0; k < (int)order.size(); k++) {
+        for (Resource& resource : resources) {
+            if (resource.kind != RESOURCE_TEXTURE || resource.firstUse != k)
+                continue;
+            for (size_t i = 0; i < pool.size() && resource.pooled < 0; i++) {
+                const PooledTexture& pooled = pool[i];
+                if (pooled.busyUntil < k && pooled.width == resource.width && pooled.height == resource.height
+                    && pooled.internalFormat == resource.internalFormat)
+                    resource.pooled = (int)i;
+            }
+            if (resource.pooled < 0) {
+                PooledTexture pooled;
+                pooled.width = resource.width;
+                pooled.height = resource.height;
+                pooled.internalFormat = resource.internalFormat;
+                glGenTextures(1, &pooled.texture);
+                glBindTexture(GL_TEXTURE_2D, pooled.texture);
+                bool isDepth = isDepthFormat(resource.internalFormat);
+                glTexImage2D(GL_TEXTURE_2D, 0, resource.internalFormat, resource.width, resource.height, 0,
+                    isDepth ? GL_DEPTH_COMPONENT : GL_RGBA, isDepth ? GL_FLOAT : GL_UNSIGNED_BYTE, NULL);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glBindTexture(GL_TEXTURE_2D, 0);
+                pooled.resource = gpuResources.create(resource.name, MEMORY_RENDER_TARGET, 0,
+                    (size_t)resource.width * resource.height * textureFormatBytes(resource.internalFormat), 0, textureDeleter(pooled.texture));
+                pool.push_back(pooled);
+                resource.pooled = (int)pool.size() - 1;
+            }
+            pool[resource.pooled].busyUntil = resource.lastUse;
+            pool[resource.pooled].lastUsedFrame = frame;
+        }
+    }
+
+    // Textures of sizes no longer rendered, and the framebuffers they are attached to
+    for (size_t i = pool.size(); i-- > 0;) {
+        if (frame - pool[i].lastUsedFrame <= RENDER_GRAPH_POOL_FRAMES)
+            continue;
+        unsigned int texture = pool[i].texture;
+        for (auto it = framebuffers.begin(); it != framebuffers.end();) {
+            if (it->first.first == texture || it->first.second == texture) {
+                glDeleteFramebuffers(1, &it->second);
+                it = framebuffers.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        gpuResources.destroy(pool[i].resource);
+        pool.erase(pool.begin() + i);
+        for (Resource& resource : resources) {
+            if (resource.pooled > (int)i)
+                resource.pooled--;
+        }
+    }
+}
+
+void RenderGraph::execute()
+{
+    // other code may have changed the bindings between the frames
+    boundFramebuffer = std::numeric_limits<unsigned int>::max();
+    viewportWidth = viewportHeight = -1;
+    boundShader = nullptr;
+    depthFunc = GL_LESS;
+    glDepthFunc(GL_LESS);
+
+    ProfilePass profilePass = PROFILE_PASS_COUNT;
+    for (int index : order) {
+        const Pass& pass = passes[index];
+        if (pass.profilePass != profilePass) {
+            if (profilePass != PROFILE_PASS_COUNT)
+                profiler.endPass(profilePass);
+            profilePass = pass.profilePass;
+            if (profilePass != PROFILE_PASS_COUNT)
+                profiler.beginPass(profilePass);
+        }
+
+        bindTarget(pass);
+        if (pass.shader != nullptr && pass.shader != boundShader) {
+            pass.shader->use();
+            boundShader = pass.shader;
+        }
+        if (pass.depthFunc != depthFunc) {
+            glDepthFunc(pass.depthFunc);
+            depthFunc = pass.depthFunc;
+        }
+        pass.execute();
+        // the batched draws go to the framebuffer of this pass
+        drawBatch.flush();
+    }
+    if (profilePass != PROFILE_PASS_COUNT)
+        profiler.endPass(profilePass);
+
+    glDepthFunc(GL_LESS);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// The framebuffer of what the pass writes: an imported one, or one made of its transient textures
+void RenderGraph::bindTarget(const Pass& pass)
+{
+    unsigned int framebuffer = 0;
+    unsigned int color = 0, depth = 0;
+    int width = 0, height = 0;
+    bool hasTarget = false;
+    GLbitfield clearMask = 0;
+    for (const auto& write : pass.writes) {
+        const Resource& resource = resources[write.first];
+        if (resource.kind == RESOURCE_FRAMEBUFFER) {
+            framebuffer = resource.framebuffer;
+            if (write.second == RENDER_CLEAR)
+                clearMask |= resource.attachments;
+        }
+        else {
+            bool isDepth = isDepthFormat(resource.internalFormat);
+            (isDepth ? depth : color) = pool[resource.pooled].texture;
+            if (write.second == RENDER_CLEAR)
+                clearMask |= isDepth ? GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT;
+        }
+        width = resource.width;
+        height = resource.height;
+        hasTarget = true;
+    }
+    if (!hasTarget)
+        return;
+    if (color != 0 || depth != 0)
+        framebuffer = getTextureFramebuffer(color, depth);
+    if (pass.viewportWidth > 0) {
+        width = pass.viewportWidth;
+        height = pass.viewportHeight;
+    }
+
+    if (framebuffer != boundFramebuffer) {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        boundFramebuffer = framebuffer;
+    }
+    if (width != viewportWidth || height != viewportHeight) {
+        glViewport(0, 0, width, height);
+        viewportWidth = width;
+        viewportHeight = height;
+    }
+    if (clearMask != 0) {
+        // render background
+        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+        glClear(clearMask);
+    }
+}
+
+// A new framebuffer is made while a pass may already draw, e.g. the upscale blit asks for the one it reads from;
+// the bindings of that pass are put back afterwards
+unsigned int RenderGraph::getTextureFramebuffer(unsigned int color, unsigned int depth)
+{
+    auto key = std::make_pair(color, depth);
+    auto found = framebuffers.find(key);
+    if (found != framebuffers.end())
+        return found->second;
+
+    GLint drawFramebuffer = 0, readFramebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+    unsigned int framebuffer = 0;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    if (color != 0)
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+    if (depth != 0)
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+    if (color == 0) {
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "Render graph framebuffer is not complete" << std::endl;
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+    framebuffers[key] = framebuffer;
+    return framebuffer;
+}
+
+unsigned int RenderGraph::getFramebuffer(RenderResource resource)
+{
+    const Resource& used = resources[resource];
+    if (used.kind == RESOURCE_FRAMEBUFFER)
+        return used.framebuffer;
+    unsigned int texture = pool[used.pooled].texture;
+    return isDepthFormat(used.internalFormat) ? getTextureFramebuffer(0, texture) : getTextureFramebuffer(texture, 0);
+}
+
+unsigned int RenderGraph::getTexture(RenderResource resource) const
+{
+    const Resource& used = resources[resource];
+    return used.kind == RESOURCE_TEXTURE ? pool[used.pooled].texture : 0;
+}
+
+// ---------------------------------
+// frame pacing
+// ---------------------------------
+
+double sessionSeconds()
+{
+    return elapsedMs(sessionStart) / 1000.0;
+}
+
+void markKeyInput(unsigned int keys)
+{
+    if (keys != latchedKeys)
+        framePacer.markInput(sessionSeconds());
+    latchedKeys = keys;
+}
+
+// view and projection of viewCamera
+void setViewConstants()
+{
+    // view transition
+    frameConstants.view = viewCamera.GetViewMatrix();
+    // Projection transformation
+    frameConstants.projection = viewCamera.GetProjMatrix((float)renderWidth / (float)renderHeight);
+    // viewMatrix is constructed to remove the movement of the camera
+    frameConstants.skyboxView = glm::mat4(glm::mat3(frameConstants.view));
+    frameConstants.viewPos = glm::vec4(viewCamera.Position, 1.0f);
+}
+
+// Poll the input again after the shadow pass and move the camera to it, so the main pass shows input that is
+// a shadow pass younger. The shadow cascades stay fitted to the camera of the frame start; their bounding
+// spheres cover the small rotation of a frame
+void latchViewCamera(GLFWwindow* window)
+{
+    glfwPollEvents();
+    if (isSimThread) {
+        // the simulation thread gets the keys for its next tick, and the newest snapshot is shown
+        SimInput input = handleKeyInput(window);
+        markKeyInput(input.keys);
+        sampledKeys = input.keys;
+        updateFromSnapshots();
+    }
+
+    // Mouse movement the simulation has not taken yet; it is applied to the simulated camera on the next tick,
+    // so here it only turns the copy that is drawn
+    {
+        std::lock_guard<std::mutex> lock(pendingInputMutex);
+        for (const InputEvent& event : pendingInputEvents) {
+            if (event.type == INPUT_EVENT_MOUSE && !isViewCameraFixed)
+                viewCamera.ProcessMouseMovement(event.x, event.y);
+            else if (event.type == INPUT_EVENT_SCROLL)
+                viewCamera.ProcessMouseScroll(event.y);
+        }
+    }
+
+    setViewConstants();
+    glBindBuffer(GL_UNIFORM_BUFFER, frameConstantsUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameConstants), &frameConstants);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void FramePacer::init(double maxFps)
+{
+    period = std::chrono::steady_clock::duration(0);
+    if (maxFps > 0.0)
+        period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / maxFps));
+    deadline = std::chrono::steady_clock::now();
+#ifdef _WIN32
+    // the default timer resolution of 15.6 ms would make every sleep overshoot the deadline
+    if (period.count() > 0)
+        timeBeginPeriod(1);
+#endif
+}
+
+void FramePacer::wait()
+{
+    if (period.count() == 0)
+        return;
+
+    // A frame that took too long moves the schedule instead of making the next frames hurry to catch up
+    deadline += period;
+    auto now = std::chrono::steady_clock::now();
+    if (deadline < now) {
+        deadline = now;
+        return;
+    }
+
+    auto spin = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(FRAME_PACER_SPIN_MS));
+    if (deadline - now > spin)
+        std::this_thread::sleep_for(deadline - now - spin);
+    while (std::chrono::steady_clock::now() < deadline)
+        std::this_thread::yield();
+}
+
+void FramePacer::markInput(double seconds)
+{
+    if (inputTime < 0.0 || seconds < inputTime)
+        inputTime = seconds;
+}
+
+void FramePacer::framePresented()
+{
+    collect(false);
+    if (inputTime < 0.0)
+        return;
+
+    double now = sessionSeconds();
+    if (clockCalibrated < 0.0 || now - clockCalibrated > FRAME_PACER_CALIBRATION_SECONDS) {
+        GLint64 glTime = 0;
+        glGetInteger64v(GL_TIMESTAMP, &glTime);
+        clockOffset = now - glTime * 1e-9;
+        clockCalibrated = now;
+    }
+
+    PresentedFrame presented;
+    glGenQueries(1, &presented.query);
+    glQueryCounter(presented.query, GL_TIMESTAMP);
+    presented.inputTime = inputTime;
+    presentedFrames.push_back(presented);
+    inputTime = -1.0;
+}
+
+// Latencies of the presented frames whose timestamp query has a result; waits for all of them on exit
+void FramePacer::collect(bool isWaiting)
+{
+    while (!presentedFrames.empty()) {
+        PresentedFrame& presented = presentedFrames.front();
+        GLint isAvailable = GL_FALSE;
+        if (!isWaiting) {
+            glGetQueryObjectiv(presented.query, GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+            if (!isAvailable)
+                return;
+        }
+        // when the GPU got there, not when this poll noticed
+        GLuint64 glTime = 0;
+        glGetQueryObjectui64v(presented.query, GL_QUERY_RESULT, &glTime);
+        latencies.push((glTime * 1e-9 + clockOffset - presented.inputTime) * 1000.0);
+        glDeleteQueries(1, &presented.query);
+        presentedFrames.pop_front();
+    }
+}
+
+void FramePacer::finish()
+{
+    collect(true);
+#ifdef _WIN32
+    if (period.count() > 0)
+        timeEndPeriod(1);
+#endif
+
+    TimingSummary latency = latencySummary(LATENCY_HISTORY_FRAMES);
+    if (latencies.size() > 0) {
+        std::cout << "[LATENCY] input to present over " << latencies.size() << " frames: average " << latency.average
+            << " ms, p50 " << latency.p50 << " ms, p95 " << latency.p95 << " ms, p99 " << latency.p99
+            << " ms, max " << latency.max << " ms" << std::endl;
+    }
+}
+
+// the last frames with input
+TimingSummary FramePacer::latencySummary(size_t frames) const
+{
+    std::vector<double> values;
+    size_t count = latencies.size();
+    for (size_t i = count > frames ? count - frames : 0; i < count; i++)
+        values.push_back(latencies.at(i));
+    return summarizeTimings(values);
+}
+
+// ---------------------------------
+// dynamic resolution
+// ---------------------------------
+
+// Scale of this frame from the GPU time of the newest measured frame
+void updateRenderSize()
+{
+    // the capture renders at its own size
+    if (isCapture)
+        return;
+
+    const RingBuffer<FrameTiming, PROFILE_HISTORY_FRAMES>& history = profiler.getHistory();
+    if (isDynamicResolution && history.size() > 0 && history.at(history.size() - 1).frame != lastMeasuredFrame) {
+        const FrameTiming& timing = history.at(history.size() - 1);
+        lastMeasuredFrame = timing.frame;
+        // Without timer query results there is nothing to go by; the swap is left out, it waits for the display
+        double gpuMs = 0.0;
+        bool isMeasured = false;
+        for (int pass = 0; pass < PROFILE_SWAP; pass++) {
+            if (timing.gpuMs[pass] >= 0.0) {
+                gpuMs += timing.gpuMs[pass];
+                isMeasured = true;
+            }
+        }
+        int shadowLevel = resolutionController.getShadowLevel();
+        if (isMeasured && resolutionController.update(gpuMs) && resolutionController.getShadowLevel() != shadowLevel)
+            resizeShadowMaps(resolutionController.getShadowLevel());
+    }
+
+    float scale = isDynamicResolution ? resolutionController.getScale() : 1.0f;
+    renderWidth = std::max(1, (int)(windowWidth * scale));
+    renderHeight = std::max(1, (int)(windowHeight * scale));
+}
+
+void ResolutionController::init(double frameBudgetMs)
+{
+    budgetMs = frameBudgetMs;
+}
+
+bool ResolutionController::update(double gpuMs)
+{
+    averageMs += gpuMs;
+    if (++averagedFrames < DYNAMIC_RESOLUTION_SETTLE_FRAMES)
+        return false;
+    double frameMs = averageMs / averagedFrames;
+    averageMs = 0.0;
+    averagedFrames = 0;
+
+    // The GPU time grows with the number of pixels, the square of the scale
+    float previousScale = scale;
+    int previousShadowLevel = shadowLevel;
+    if (frameMs > budgetMs) {
+        if (scale > DYNAMIC_RESOLUTION_MIN_SCALE) {
+            float target = scale * (float)sqrt(budgetMs / frameMs);
+            scale = std::max(DYNAMIC_RESOLUTION_MIN_SCALE, std::min(scale - DYNAMIC_RESOLUTION_STEP,
+                floor(target / DYNAMIC_RESOLUTION_STEP) * DYNAMIC_RESOLUTION_STEP));
+        }
+        else if (shadowLevel < SHADOW_QUALITY_LEVELS - 1) {
+            shadowLevel++;
+        }
+    }
+    else if (frameMs < budgetMs * DYNAMIC_RESOLUTION_HEADROOM) {
+        if (shadowLevel > 0) {
+            shadowLevel--;
+        }
+        else if (scale < 1.0f) {
+            // aim inside the band, so the next measurement does not push it back down
+            float target = scale * (float)sqrt(budgetMs * (1.0 + DYNAMIC_RESOLUTION_HEADROOM) / 2.0 / frameMs);
+            scale = std::min(1.0f, std::max(scale + DYNAMIC_RESOLUTION_STEP,
+                floor(target / DYNAMIC_RESOLUTION_STEP) * DYNAMIC_RESOLUTION_STEP));
+        }
+    }
+    return scale != previousScale || shadowLevel != previousShadowLevel;
+}
+
+// ---------------------------------
+// frame capture
+// ---------------------------------
+
+// "1920x1080"
+bool parseCaptureSize(const char* text, int& width, int& height)
+{
+    int parsedWidth = 0, parsedHeight = 0;
+    if (sscanf(text, "%dx%d", &parsedWidth, &parsedHeight) != 2 || parsedWidth <= 0 || parsedHeight <= 0
+        || parsedWidth > 16384 || parsedHeight > 16384)
+        return false;
+    width = parsedWidth;
+    height = parsedHeight;
+    return true;
+}
+
+bool FrameCapture::init(const std::string& captureDirectory, int captureWidth, int captureHeight, CaptureFormat captureFormat)
+{
+    directory = captureDirectory;
+    width = captureWidth;
+    height = captureHeight;
+    format = captureFormat;
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        std::cout << "Failed to create capture directory: " << directory << std::endl;
+        return false;
+    }
+
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(1, &colorBuffer);
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    bool isComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!isComplete) {
+        std::cout << "Capture framebuffer is not complete" << std::endl;
+        glDeleteFramebuffers(1, &framebuffer);
+        framebuffer = 0;
+        return false;
+    }
+
+    // the GPU writes into the pixel buffers, the CPU reads them once
+    for (Slot& slot : slots) {
+        glGenBuffers(1, &slot.pixelBuffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixelBuffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    // color, depth and the pixel buffers, four bytes per pixel each
+    resource = gpuResources.create("capture", MEMORY_RENDER_TARGET, 0, (size_t)width * height * 4 * (2 + RING_SIZE), 0, nullptr);
+
+    unsigned int cores = std::thread::hardware_concurrency();
+    encoders.start(std::max(1u, cores / 2));
+    return true;
+}
+
+void FrameCapture::endFrame(int destinationWidth, int destinationHeight)
+{
+    // the oldest slot is reused; its frame was queued RING_SIZE frames ago and is usually done by now
+    Slot& slot = slots[nextSlot];
+    if (slot.fence != 0)
+        readSlot(slot);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixelBuffer);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.frame = frameCount++;
+    nextSlot = (nextSlot + 1) % RING_SIZE;
+
+    // show the frame scaled into the window
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, destinationWidth, destinationHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Copies the pixels of a queued frame out of its pixel buffer and hands them to an encoder
+void FrameCapture::readSlot(Slot& slot)
+{
+    // flush the first time, so the fence is signaled at all
+    GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    while (status == GL_TIMEOUT_EXPIRED)
+        status = glClientWaitSync(slot.fence, 0, 1000000);
+    glDeleteSync(slot.fence);
+    slot.fence = 0;
+    if (status == GL_WAIT_FAILED)
+        return;
+
+    // too many frames waiting for the disk, hold the renderer back instead of growing without limit
+    {
+        std::unique_lock<std::mutex> lock(writeMutex);
+        writeDone.wait(lock, [this] { return pendingWrites < MAX_PENDING_WRITES; });
+        pendingWrites++;
+    }
+
+    size_t size = (size_t)width * height * 4;
+    auto pixels = std::make_shared<std::vector<unsigned char>>(size);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixelBuffer);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (mapped != NULL) {
+        memcpy(pixels->data(), mapped, size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    char name[32];
+    snprintf(name, sizeof(name), "frame_%06lld.%s", slot.frame, format == CAPTURE_PNG ? "png" : "rgba");
+    std::string path = directory + "/" + name;
+    int imageWidth = width, imageHeight = height;
+    CaptureFormat imageFormat = format;
+    encoders.submit([this, pixels, path, imageWidth, imageHeight, imageFormat]() {
+        // OpenGL reads the rows from the bottom up
+        size_t rowSize = (size_t)imageWidth * 4;
+        std::vector<unsigned char> row(rowSize);
+        for (int y = 0; y < imageHeight / 2; y++) {
+            unsigned char* top = pixels->data() + y * rowSize;
+            unsigned char* bottom = pixels->data() + (imageHeight - 1 - y) * rowSize;
+            memcpy(row.data(), top, rowSize);
+            memcpy(top, bottom, rowSize);
+            memcpy(bottom, row.data(), rowSize);
+        }
+        bool isWritten;
+        if (imageFormat == CAPTURE_PNG) {
+            isWritten = writePng(path, pixels->data(), imageWidth, imageHeight);
+        }
+        else {
+            std::ofstream file(path, std::ios::binary);
+            file.write((const char*)pixels->data(), pixels->size());
+            isWritten = (bool)file;
+        }
+        if (!isWritten)
+            std::cout << "Failed to write frame: " << path << std::endl;
+
+        std::lock_guard<std::mutex> lock(writeMutex);
+        pendingWrites--;
+        writeDone.notify_all();
+    });
+}
+
+void FrameCapture::finish()
+{
+    auto start = std::chrono::steady_clock::now();
+    // the slots in the order their frames were queued
+    for (int i = 0; i < RING_SIZE; i++) {
+        Slot& slot = slots[(nextSlot + i) % RING_SIZE];
+        if (slot.fence != 0)
+            readSlot(slot);
+    }
+    {
+        std::unique_lock<std::mutex> lock(writeMutex);
+        writeDone.wait(lock, [this] { return pendingWrites == 0; });
+    }
+    encoders.stop();
+    std::cout << "[CAPTURE] " << frameCount << " frames of " << width << "x" << height << " written to " << directory
+        << ", " << elapsedMs(start) << " ms to drain" << std::endl;
+
+    for (Slot& slot : slots)
+        glDeleteBuffers(1, &slot.pixelBuffer);
+    glDeleteRenderbuffers(1, &colorBuffer);
+    glDeleteRenderbuffers(1, &depthBuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+    framebuffer = 0;
+    gpuResources.destroy(resource);
+}
+
+unsigned int pngCrc32(unsigned int crc, const unsigned char* data, size_t size)
+{
+    static unsigned int table[256];
+    static bool isTableReady = [] {
+        for (unsigned int i = 0; i < 256; i++) {
+            unsigned int c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)isTableReady;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// RGB PNG from RGBA rows; the image data is deflate in stored blocks, so writing costs about as much as copying
+bool writePng(const std::string& path, const unsigned char* pixels, int width, int height)
+{
+    auto putBigEndian = [](std::vector<unsigned char>& out, unsigned int value) {
+        out.push_back((unsigned char)(value >> 24));
+        out.push_back((unsigned char)(value >> 16));
+        out.push_back((unsigned char)(value >> 8));
+        out.push_back((unsigned char)value);
+    };
+    std::vector<unsigned char> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    auto putChunk = [&](const char type[4], const std::vector<unsigned char>& data) {
+        putBigEndian(png, (unsigned int)data.size());
+        size_t typeOffset = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data.begin(), data.end());
+        putBigEndian(png, pngCrc32(0, png.data() + typeOffset, data.size() + 4));
+    };
+
+    std::vector<unsigned char> header;
+    putBigEndian(header, width);
+    putBigEndian(header, height);
+    // 8 bit, RGB, deflate, adaptive filters, not interlaced
+    header.insert(header.end(), { 8, 2, 0, 0, 0 });
+    putChunk("IHDR", header);
+
+    // every row starts with its filter type, none
+    size_t rowSize = (size_t)width * 3 + 1;
+    std::vector<unsigned char> rows(rowSize * height);
+    for (int y = 0; y < height; y++) {
+        unsigned char* row = rows.data() + y * rowSize;
+        const unsigned char* source = pixels + (size_t)y * width * 4;
+        row[0] = 0;
+        for (int x = 0; x < width; x++) {
+            row[1 + x * 3] = source[x * 4];
+            row[2 + x * 3] = source[x * 4 + 1];
+            row[3 + x * 3] = source[x * 4 + 2];
+        }
+    }
+
+    // zlib stream of stored blocks of at most 65535 bytes
+    std::vector<unsigned char> data = { 0x78, 0x01 };
+    data.reserve(rows.size() + rows.size() / 65535 * 5 + 16);
+    unsigned int a = 1, b = 0;
+    size_t offset = 0;
+    do {
+        size_t length = std::min<size_t>(rows.size() - offset, 65535);
+        bool isLast = offset + length == rows.size();
+        data.push_back(isLast ? 1 : 0);
+        data.push_back((unsigned char)length);
+        data.push_back((unsigned char)(length >> 8));
+        data.push_back((unsigned char)~length);
+        data.push_back((unsigned char)(~length >> 8));
+        data.insert(data.end(), rows.begin() + offset, rows.begin() + offset + length);
+        for (size_t i = offset; i < offset + length; i++) {
+            a = (a + rows[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        offset += length;
+    } while (offset < rows.size());
+    putBigEndian(data, (b << 16) | a);
+    putChunk("IDAT", data);
+    putChunk("IEND", {});
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*)png.data(), png.size());
+    return (bool)file;
+}
+
+// ---------------------------------
+// clustered lighting
+// ---------------------------------
+
+void LightClusters::start(unsigned int threadCount)
+{
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+    const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+    for (int i = 0; i < 3; i++) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    // every worker bins its own range of slices
+    slices.resize(threadCount);
+    for (unsigned int i = 0; i < threadCount; i++) {
+        slices[i].firstSlice = CLUSTER_COUNT_Z * i / threadCount;
+        slices[i].sliceCount = CLUSTER_COUNT_Z * (i + 1) / threadCount - slices[i].firstSlice;
+    }
+    workers.start(threadCount);
+    isStarted = true;
+}
+
+void LightClusters::stop()
+{
+    if (!isStarted)
+        return;
+    waitAll();
+    workers.stop();
+    glDeleteTextures(3, textures);
+    glDeleteBuffers(3, buffers);
+    isStarted = false;
+}
+
+void LightClusters::beginFrame(std::vector<Light> frameLights, const glm::mat4& frameView, const glm::mat4& frameProjection)
+{
+    // the lights of the last frame can only be replaced once nothing bins them
+    waitAll();
+    if (!isStarted)
+        return;
+    lights = std::move(frameLights);
+    if (lights.size() > MAX_FRAME_LIGHTS)
+        lights.resize(MAX_FRAME_LIGHTS);
+    view = frameView;
+    projection = frameProjection;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = (int)slices.size();
+    }
+    for (Slices& range : slices) {
+        workers.submit([this, &range]() {
+            bin(range);
+            std::lock_guard<std::mutex> lock(mutex);
+            pending--;
+            done.notify_all();
+        });
+    }
+}
+
+// Runs on a worker. Every light is bounded by its sphere, a spot light as well. The tiles it covers come from
+// the corners of the box around the sphere on screen, grown by one tile, because the late latch may still turn the
+// camera a little after the binning; a sphere reaching behind the camera covers every tile
+void LightClusters::bin(Slices& range)
+{
+    int clusterCount = CLUSTER_COUNT_X * CLUSTER_COUNT_Y * range.sliceCount;
+    std::vector<Bounds> bounds;
+    std::vector<unsigned int> counts(clusterCount, 0);
+    for (const Light& light : lights) {
+        glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+        float nearDepth = -center.z - light.range;
+        float farDepth = -center.z + light.range;
+        Bounds cover = { 0, 0, CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1,
+            std::max(clusterSlice(nearDepth), range.firstSlice) - range.firstSlice,
+            std::min(clusterSlice(farDepth), range.firstSlice + range.sliceCount - 1) - range.firstSlice };
+        if (farDepth <= 0.0f)
+            cover.maxZ = -1;
+        if (cover.maxZ < cover.minZ) {
+            bounds.push_back(cover);
+            continue;
+        }
+
+        if (nearDepth > 0.0f) {
+            float minX = 1.0f, minY = 1.0f, maxX = -1.0f, maxY = -1.0f;
+            for (int corner = 0; corner < 8; corner++) {
+                glm::vec3 offset((corner & 1) ? light.range : -light.range, (corner & 2) ? light.range : -light.range,
+                    (corner & 4) ? light.range : -light.range);
+                glm::vec4 clip = projection * glm::vec4(center + offset, 1.0f);
+                minX = std::min(minX, clip.x / clip.w);
+                minY = std::min(minY, clip.y / clip.w);
+                maxX = std::max(maxX, clip.x / clip.w);
+                maxY = std::max(maxY, clip.y / clip.w);
+            }
+            cover.minX = glm::clamp((int)floor((minX * 0.5f + 0.5f) * CLUSTER_COUNT_X) - 1, 0, CLUSTER_COUNT_X - 1);
+            cover.minY = glm::clamp((int)floor((minY * 0.5f + 0.5f) * CLUSTER_COUNT_Y) - 1, 0, CLUSTER_COUNT_Y - 1);
+            cover.maxX = glm::clamp((int)floor((maxX * 0.5f + 0.5f) * CLUSTER_COUNT_X) + 1, 0, CLUSTER_COUNT_X - 1);
+            cover.maxY = glm::clamp((int)floor((maxY * 0.5f + 0.5f) * CLUSTER_COUNT_Y) + 1, 0, CLUSTER_COUNT_Y - 1);
+        }
+        bounds.push_back(cover);
+
+        for (int z = cover.minZ; z <= cover.maxZ; z++) {
+            for (int y = cover.minY; y <= cover.maxY; y++) {
+                for (int x = cover.minX; x <= cover.maxX; x++)
+                    counts[(z * CLUSTER_COUNT_Y + y) * CLUSTER_COUNT_X + x]++;
+            }
+        }
+    }
+
+    // the lists one after the other, then filled in the order of the lights
+    range.grid.resize(2 * clusterCount);
+    unsigned int offset = 0;
+    for (int i = 0; i < clusterCount; i++) {
+        range.grid[2 * i] = offset;
+        range.grid[2 * i + 1] = 0;
+        offset += counts[i];
+    }
+    range.indices.resize(offset);
+    for (size_t light = 0; light < lights.size(); light++) {
+        const Bounds& cover = bounds[light];
+        for (int z = cover.minZ; z <= cover.maxZ; z++) {
+            for (int y = cover.minY; y <= cover.maxY; y++) {
+                for (int x = cover.minX; x <= cover.maxX; x++) {
+                    unsigned int* cluster = &range.grid[2 * ((z * CLUSTER_COUNT_Y + y) * CLUSTER_COUNT_X + x)];
+                    range.indices[cluster[0] + cluster[1]++] = (unsigned int)light;
+                }
+            }
+        }
+    }
+}
+
+void LightClusters::upload()
+{
+    waitAll();
+    if (!isStarted)
+        return;
+
+    // the ranges of slices one after the other, with the offsets of their lists moved along
+    std::vector<unsigned int> grid;
+    std::vector<unsigned int> indices;
+    grid.reserve(2 * CLUSTER_COUNT_X * CLUSTER_COUNT_Y * CLUSTER_COUNT_Z);
+    for (const Slices& range : slices) {
+        unsigned int base = (unsigned int)indices.size();
+        for (size_t i = 0; i < range.grid.size(); i += 2) {
+            grid.push_back(range.grid[i] + base);
+            grid.push_back(range.grid[i + 1]);
+        }
+        indices.insert(indices.end(), range.indices.begin(), range.indices.end());
+    }
+    indexCount = indices.size();
+
+    // new storage every frame, so that the draws of the last frame keep theirs
+    const void* data[3] = { lights.data(), grid.data(), indices.data() };
+    size_t sizes[3] = { lights.size() * sizeof(Light), grid.size() * sizeof(unsigned int), indices.size() * sizeof(unsigned int) };
+    for (int i = 0; i < 3; i++) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, std::max(sizes[i], (size_t)16), nullptr, GL_STREAM_DRAW);
+        if (sizes[i] > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+        glActiveTexture(GL_TEXTURE0 + CLUSTER_TEXTURE_UNIT + i);
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::waitAll()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+}
+
+// The lights of the player car, the traffic and the lamps, in world space
+std::vector<Light> collectLights()
+{
+    std::vector<Light> lights;
+    float yaw = glm::radians(renderCarState.yaw);
+    addCarLights(lights, renderCarState.midValPosition, glm::vec3(sin(yaw), 0.0f, cos(yaw)));
+    // the x axis of a car model points forward
+    for (const glm::mat4& car : sceneInstances.cars)
+        addCarLights(lights, glm::vec3(car[3]), glm::normalize(glm::vec3(car[0])));
+
+    for (int i = 0; i < lampCount; i++) {
+        float angle = glm::radians(360.0f * i / lampCount);
+        float radius = SCENE_RING_RADIUS + ((i & 1) ? LAMP_RING_OFFSET : -LAMP_RING_OFFSET);
+        Light lamp;
+        lamp.position = glm::vec3(radius * cos(angle), LAMP_HEIGHT, radius * sin(angle));
+        lamp.range = LAMP_RANGE;
+        lamp.color = LAMP_COLOR;
+        lamp.spotCosOuter = -1.0f;
+        lamp.direction = -WORLD_UP;
+        lamp.spotCosInner = -1.0f;
+        lights.push_back(lamp);
+    }
+    return lights;
+}
+
+// two headlights and two tail lights
+void addCarLights(std::vector<Light>& lights, const glm::vec3& position, const glm::vec3& forward)
+{
+    glm::vec3 side = glm::normalize(glm::cross(forward, WORLD_UP));
+    for (float sideSign : { -1.0f, 1.0f }) {
+        Light headlight;
+        headlight.position = position + forward * HEADLIGHT_OFFSET.x + WORLD_UP * HEADLIGHT_OFFSET.y + side * (sideSign * HEADLIGHT_OFFSET.z);
+        headlight.range = HEADLIGHT_RANGE;
+        headlight.color = HEADLIGHT_COLOR;
+        headlight.spotCosOuter = HEADLIGHT_COS_OUTER;
+        headlight.direction = glm::normalize(forward - WORLD_UP * HEADLIGHT_PITCH);
+        headlight.spotCosInner = HEADLIGHT_COS_INNER;
+        lights.push_back(headlight);
+
+        Light tailLight;
+        tailLight.position = position + forward * TAIL_LIGHT_OFFSET.x + WORLD_UP * TAIL_LIGHT_OFFSET.y + side * (sideSign * TAIL_LIGHT_OFFSET.z);
+        tailLight.range = TAIL_LIGHT_RANGE;
+        tailLight.color = TAIL_LIGHT_COLOR;
+        tailLight.spotCosOuter = -1.0f;
+        tailLight.direction = -forward;
+        tailLight.spotCosInner = -1.0f;
+        lights.push_back(tailLight);
+    }
+}
+
+// The slice of a view depth, the same as the shader computes with clusterScale
+int clusterSlice(float depth)
+{
+    if (depth <= CLUSTER_NEAR)
+        return 0;
+    float sliceScale = CLUSTER_COUNT_Z / log(CLUSTER_FAR / CLUSTER_NEAR);
+    int slice = (int)floor(log(depth) * sliceScale - sliceScale * log(CLUSTER_NEAR));
+    return std::min(slice, CLUSTER_COUNT_Z - 1);
+}
+
+
+// ---------------------------------
+// track streaming
+// ---------------------------------
+
+bool TrackStreamer::open(const std::string& trackPath, const ModelCacheHeader& header, const unsigned char* sections)
+{
+    std::string path = trackPath + TRACK_TILES_EXTENSION;
+    if (!read(path, header.sourceHash)) {
+        if (!writeTrackTiles(path, header, sections) || !read(path, header.sourceHash))
+            return false;
+    }
+    directory = trackPath.substr(0, trackPath.find_last_of("/\\"));
+    return true;
+}
+
+bool TrackStreamer::read(const std::string& path, unsigned long long sourceHash)
+{
+    tiles.clear();
+    file.close();
+    if (sourceHash == 0 || !file.open(path) || file.getSize() < sizeof(TrackTilesHeader))
+        return false;
+
+    TrackTilesHeader header;
+    memcpy(&header, file.getData(), sizeof(header));
+    if (memcmp(header.magic, TRACK_TILES_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACK_TILES_VERSION
+        || header.sourceHash != sourceHash || header.tileSize != TRACK_TILE_SIZE
+        || file.getSize() < sizeof(header) + (unsigned long long)header.tileCount * sizeof(TrackTileEntry)) {
+        file.close();
+        return false;
+    }
+
+    tiles.resize(header.tileCount);
+    for (unsigned int i = 0; i < header.tileCount; i++) {
+        TrackTileEntry& entry = tiles[i].entry;
+        memcpy(&entry, file.getData() + sizeof(header) + i * sizeof(TrackTileEntry), sizeof(entry));
+        if (entry.offset > file.getSize() || entry.compressedSize > file.getSize() - entry.offset) {
+            tiles.clear();
+            file.close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void TrackStreamer::close()
+{
+    tiles.clear();
+    file.close();
+}
+
+bool TrackStreamer::update(const glm::vec3& position, float deltaTime)
+{
+    if (tiles.empty())
+        return false;
+
+    if (hasPosition && deltaTime > 0.0f)
+        velocity = glm::mix(velocity, (position - lastPosition) / deltaTime, TRACK_VELOCITY_SMOOTHING);
+    lastPosition = position;
+    hasPosition = true;
+    glm::vec3 ahead = position + velocity * TRACK_PREFETCH_SECONDS;
+
+    std::vector<std::pair<float, size_t>> wanted;
+    int loading = 0;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        Tile& tile = tiles[i];
+        float distance = std::min(distanceXZ(tile.entry.boundsMin, tile.entry.boundsMax, position),
+            distanceXZ(tile.entry.boundsMin, tile.entry.boundsMax, ahead));
+        if (tile.model == nullptr) {
+            if (distance <= TRACK_STREAM_RADIUS && tile.failures < TRACK_TILE_MAX_ATTEMPTS)
+                wanted.push_back(std::make_pair(distance, i));
+        }
+        else if (tile.model->isFailed()) {
+            // requested again with the next update, unless it keeps failing
+            if (++tile.failures == TRACK_TILE_MAX_ATTEMPTS)
+                std::cout << "[TRACK]tile " << i << " failed to load " << TRACK_TILE_MAX_ATTEMPTS << " times, it is left out" << std::endl;
+            tile.model.reset();
+        }
+        else if (!tile.model->isLoaded()) {
+            // a tile is only released once the loader is done with its model
+            loading++;
+        }
+        else if (distance > TRACK_STREAM_RADIUS * TRACK_UNLOAD_FACTOR) {
+            // the static shadow layers that were rendered with the tile
+            if (tile.model->isLoaded())
+                invalidateStaticShadows(tile.entry.boundsMin, tile.entry.boundsMax);
+            tile.model.reset();
+        }
+    }
+
+    std::sort(wanted.begin(), wanted.end());
+    size_t requests = std::min(wanted.size(), (size_t)std::max(0, TRACK_STREAM_MAX_LOADS - loading));
+    for (size_t i = 0; i < requests; i++) {
+        Tile& tile = tiles[wanted[i].second];
+        tile.model.reset(new CachedModel());
+        assetLoader.loadTrackTile(*tile.model, tile.entry, file.getData() + tile.entry.offset, directory);
+    }
+    return requests > 0;
+}
+
+void TrackStreamer::draw(const DrawView& view) const
+{
+    glm::mat4 modelMatrix = glm::mat4(1.0f);
+    for (const Tile& tile : tiles) {
+        if (tile.model != nullptr)
+            tile.model->Draw(view, modelMatrix);
+    }
+}
+
+size_t TrackStreamer::getLoadedCount() const
+{
+    size_t count = 0;
+    for (const Tile& tile : tiles) {
+        if (tile.model != nullptr && tile.model->isLoaded())
+            count++;
+    }
+    return count;
+}
+
+// The sections of a model in the layout of the cache file
+void appendModelSections(const ModelData& data, std::vector<unsigned char>& sections)
+{
+    auto append = [&sections](const void* bytes, size_t size) {
+        sections.insert(sections.end(), (const unsigned char*)bytes, (const unsigned char*)bytes + size);
+    };
+    append(data.vertices.data(), data.vertices.size() * sizeof(ModelVertex));
+    append(data.indices.data(), data.indices.size() * sizeof(unsigned int));
+    append(data.meshes.data(), data.meshes.size() * sizeof(ModelMeshEntry));
+    append(data.materials.data(), data.materials.size() * sizeof(ModelMaterialEntry));
+    append(data.strings.data(), data.strings.size());
+}
+
+// Every mesh goes to the tile under the center of its level 0 bounds; the chunks of large meshes are smaller
+// than a tile, so no tile reaches far beyond its square
+bool writeTrackTiles(const std::string& path, const ModelCacheHeader& header, const unsigned char* sections)
+{
+    auto start = std::chrono::steady_clock::now();
+    const ModelMeshEntry* meshes = (const ModelMeshEntry*)(sections + header.vertexCount * sizeof(ModelVertex)
+        + header.indexCount * sizeof(unsigned int));
+    std::map<std::pair<int, int>, std::vector<unsigned int>> cells;
+    for (unsigned int i = 0; i < header.meshCount; i++) {
+        glm::vec3 center = (meshes[i].boundsMin + meshes[i].boundsMax) * 0.5f;
+        cells[std::make_pair((int)floor(center.x / TRACK_TILE_SIZE), (int)floor(center.z / TRACK_TILE_SIZE))].push_back(i);
+    }
+
+    TrackTilesHeader tilesHeader = {};
+    memcpy(tilesHeader.magic, TRACK_TILES_MAGIC, sizeof(tilesHeader.magic));
+    tilesHeader.version = TRACK_TILES_VERSION;
+    tilesHeader.sourceHash = header.sourceHash;
+    tilesHeader.tileSize = TRACK_TILE_SIZE;
+    tilesHeader.tileCount = (unsigned int)cells.size();
+
+    std::vector<TrackTileEntry> entries;
+    std::vector<std::vector<unsigned char>> compressed;
+    unsigned long long offset = sizeof(TrackTilesHeader) + cells.size() * sizeof(TrackTileEntry);
+    size_t size = 0;
+    for (const auto& cell : cells) {
+        ModelData tile;
+        buildTrackTile(header, sections, cell.second, tile);
+        std::vector<unsigned char> tileSections;
+        appendModelSections(tile, tileSections);
+
+        TrackTileEntry entry = {};
+        entry.header = makeModelCacheHeader(tile);
+        entry.boundsMin = meshes[cell.second[0]].boundsMin;
+        entry.boundsMax = meshes[cell.second[0]].boundsMax;
+        for (unsigned int mesh : cell.second) {
+            entry.boundsMin = glm::min(entry.boundsMin, meshes[mesh].boundsMin);
+            entry.boundsMax = glm::max(entry.boundsMax, meshes[mesh].boundsMax);
+        }
+        compressed.push_back(lzCompress(tileSections.data(), tileSections.size()));
+        entry.size = (unsigned int)tileSections.size();
+        entry.compressedSize = (unsigned int)compressed.back().size();
+        entry.offset = offset;
+        offset += entry.compressedSize;
+        size += entry.size;
+        entries.push_back(entry);
+    }
+
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char*>(&tilesHeader), sizeof(tilesHeader));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(TrackTileEntry));
+        for (const auto& bytes : compressed)
+            out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        if (!out)
+            return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    if (error)
+        return false;
+
+    std::cout << "[TRACK] " << entries.size() << " tiles, " << toMegabytes(size) << " MB compressed to "
+        << toMegabytes((size_t)offset) << " MB in " << elapsedMs(start) << " ms" << std::endl;
+    return true;
+}
+
+// Every level of every mesh gets its own copy of the vertices its indices use, so that the texture layer of
+// a mesh is set on its vertices only
+void buildTrackTile(const ModelCacheHeader& header, const unsigned char* sections, const std::vector<unsigned int>& meshes, ModelData& tile)
+{
+    const ModelVertex* vertices = (const ModelVertex*)sections;
+    const unsigned int* indices = (const unsigned int*)(sections + header.vertexCount * sizeof(ModelVertex));
+    const unsigned char* meshEntries = (const unsigned char*)(indices + header.indexCount);
+    const unsigned char* materialEntries = meshEntries + header.meshCount * header.lodCount * sizeof(ModelMeshEntry);
+    const char* strings = (const char*)(materialEntries + header.materialCount * sizeof(ModelMaterialEntry));
+
+    tile.lodCount = header.lodCount;
+    tile.materials.resize(header.materialCount);
+    memcpy(tile.materials.data(), materialEntries, header.materialCount * sizeof(ModelMaterialEntry));
+    tile.strings.assign(strings, header.stringBytes);
+
+    std::unordered_map<unsigned int, unsigned int> remap;
+    for (unsigned int lod = 0; lod < header.lodCount; lod++) {
+        for (unsigned int mesh : meshes) {
+            ModelMeshEntry entry;
+            memcpy(&entry, meshEntries + (lod * header.meshCount + mesh) * sizeof(ModelMeshEntry), sizeof(entry));
+            unsigned int firstIndex = entry.firstIndex;
+            unsigned int baseVertex = entry.baseVertex;
+            entry.firstIndex = (unsigned int)tile.indices.size();
+            entry.baseVertex = (unsigned int)tile.vertices.size();
+
+            remap.clear();
+            for (unsigned int i = 0; i < entry.indexCount; i++) {
+                unsigned int vertex = indices[firstIndex + i] + baseVertex;
+                auto inserted = remap.emplace(vertex, (unsigned int)remap.size());
+                if (inserted.second)
+                    tile.vertices.push_back(vertices[vertex]);
+                tile.indices.push_back(inserted.first->second);
+            }
+            tile.meshes.push_back(entry);
+        }
+    }
+}
+
+// Sequences of a token, literals and a match. The token holds the number of literals in its high four bits and
+// the length of the match minus LZ_MIN_MATCH in the low four; 15 continues in the bytes after it, each adding
+// up to 255. The match is two bytes of offset back into the output, the last sequence has literals only
+std::vector<unsigned char> lzCompress(const unsigned char* data, size_t size)
+{
+    std::vector<unsigned char> out;
+    out.reserve(size / 2 + 16);
+    // last position of every hashed four bytes
+    std::vector<size_t> table((size_t)1 << LZ_HASH_BITS, std::numeric_limits<size_t>::max());
+    auto writeLength = [&out](size_t length) {
+        for (; length >= 255; length -= 255)
+            out.push_back(255);
+        out.push_back((unsigned char)length);
+    };
+    auto emit = [&](size_t literalStart, size_t literalCount, size_t offset, size_t matchLength) {
+        size_t matchCode = matchLength >= LZ_MIN_MATCH ? matchLength - LZ_MIN_MATCH : 0;
+        out.push_back((unsigned char)((std::min(literalCount, (size_t)15) << 4) | std::min(matchCode, (size_t)15)));
+        if (literalCount >= 15)
+            writeLength(literalCount - 15);
+        out.insert(out.end(), data + literalStart, data + literalStart + literalCount);
+        if (matchLength == 0)
+            return;
+        out.push_back((unsigned char)(offset & 0xff));
+        out.push_back((unsigned char)(offset >> 8));
+        if (matchCode >= 15)
+            writeLength(matchCode - 15);
+    };
+
+    size_t literalStart = 0;
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= size) {
+        unsigned int sequence;
+        memcpy(&sequence, data + i, sizeof(sequence));
+        size_t slot = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[slot];
+        table[slot] = i;
+        if (candidate == std::numeric_limits<size_t>::max() || i - candidate > LZ_MAX_OFFSET
+            || memcmp(data + candidate, data + i, LZ_MIN_MATCH) != 0) {
+            i++;
+            continue;
+        }
+        size_t length = LZ_MIN_MATCH;
+        while (i + length < size && data[candidate + length] == data[i + length])
+            length++;
+        emit(literalStart, i - literalStart, i - candidate, length);
+        i += length;
+        literalStart = i;
+    }
+    emit(literalStart, size - literalStart, 0, 0);
+    return out;
+}
+
+// False for data that is not a complete compression of exactly outSize bytes
+bool lzDecompress(const unsigned char* data, size_t size, unsigned char* out, size_t outSize)
+{
+    const unsigned char* end = data + size;
+    size_t written = 0;
+    auto readLength = [&](size_t& length) {
+        unsigned char byte;
+        do {
+            if (data == end)
+                return false;
+            byte = *data++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    };
+
+    while (data < end) {
+        unsigned char token = *data++;
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !readLength(literalCount))
+            return false;
+        if (literalCount > (size_t)(end - data) || literalCount > outSize - written)
+            return false;
+        memcpy(out + written, data, literalCount);
+        data += literalCount;
+        written += literalCount;
+        if (data == end)
+            break;
+
+        if (end - data < 2)
+            return false;
+        size_t offset = data[0] | ((size_t)data[1] << 8);
+        data += 2;
+        size_t length = token & 15;
+        if (length == 15 && !readLength(length))
+            return false;
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > written || length > outSize - written)
+            return false;
+        // byte by byte, a match may overlap the bytes it copies
+        for (size_t k = 0; k < length; k++, written++)
+            out[written] = out[written - offset];
+    }
+    return written == outSize;
+}
+
+// distance in the xz plane from the point to the box, 0 inside it
+float distanceXZ(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& point)
+{
+    float dx = std::max(0.0f, std::max(boundsMin.x - point.x, point.x - boundsMax.x));
+    float dz = std::max(0.0f, std::max(boundsMin.z - point.z, point.z - boundsMax.z));
+    return sqrt(dx * dx + dz * dz);
+}
+
+
+// ---------------------------------
+// resource manager
+// ---------------------------------
+
+void ResourceManager::init(size_t budgetBytes)
+{
+    budget = budgetBytes;
+}
+
+ResourceHandle ResourceManager::create(const std::string& name, MemoryCategory category, unsigned long long contentHash, size_t gpuBytes,
+    size_t cpuBytes, std::function<void()> freeResource, ResourceLocation location)
+{
+    ResourceHandle handle = nextHandle++;
+    Entry& entry = entries[handle];
+    entry.name = name;
+    entry.category = category;
+    entry.contentHash = contentHash;
+    entry.refCount = 1;
+    entry.lastUsed = ++useClock;
+    entry.location = location;
+    entry.freeResource = std::move(freeResource);
+    if (contentHash != 0)
+        byContent[category][contentHash] = handle;
+    resize(handle, gpuBytes, cpuBytes);
+    return handle;
+}
+
+ResourceHandle ResourceManager::acquire(MemoryCategory category, unsigned long long contentHash)
+{
+    if (contentHash == 0)
+        return 0;
+    auto found = byContent[category].find(contentHash);
+    if (found == byContent[category].end())
+        return 0;
+    addRef(found->second);
+    sharedCount++;
+    return found->second;
+}
+
+void ResourceManager::addRef(ResourceHandle handle)
+{
+    auto found = entries.find(handle);
+    if (found == entries.end())
+        return;
+    found->second.refCount++;
+    found->second.lastUsed = ++useClock;
+}
+
+// Unknown handles are ignored, the resources of the users that outlive destroyAll are already gone
+void ResourceManager::release(ResourceHandle handle)
+{
+    auto found = entries.find(handle);
+    if (found == entries.end() || found->second.refCount == 0)
+        return;
+    found->second.refCount--;
+    found->second.lastUsed = ++useClock;
+    // nothing could acquire it again
+    if (found->second.refCount == 0 && found->second.contentHash == 0)
+        destroy(handle);
+}
+
+void ResourceManager::destroy(ResourceHandle handle)
+{
+    auto found = entries.find(handle);
+    if (found == entries.end())
+        return;
+    Entry& entry = found->second;
+    if (entry.freeResource)
+        entry.freeResource();
+    categoryGpuBytes[entry.category] -= entry.gpuBytes;
+    categoryCpuBytes[entry.category] -= entry.cpuBytes;
+    auto content = byContent[entry.category].find(entry.contentHash);
+    if (content != byContent[entry.category].end() && content->second == handle)
+        byContent[entry.category].erase(content);
+    entries.erase(found);
+}
+
+void ResourceManager::resize(ResourceHandle handle, size_t gpuBytes, size_t cpuBytes)
+{
+    auto found = entries.find(handle);
+    if (found == entries.end())
+        return;
+    Entry& entry = found->second;
+    categoryGpuBytes[entry.category] = categoryGpuBytes[entry.category] - entry.gpuBytes + gpuBytes;
+    categoryCpuBytes[entry.category] = categoryCpuBytes[entry.category] - entry.cpuBytes + cpuBytes;
+    entry.gpuBytes = gpuBytes;
+    entry.cpuBytes = cpuBytes;
+}
+
+void ResourceManager::enforceBudget()
+{
+    if (budget == 0 || getGpuBytes() <= budget) {
+        isOverBudgetReported = false;
+        return;
+    }
+
+    std::vector<std::pair<unsigned long long, ResourceHandle>> unused;
+    for (const auto& entry : entries) {
+        if (entry.second.refCount == 0 && entry.second.gpuBytes > 0)
+            unused.push_back(std::make_pair(entry.second.lastUsed, entry.first));
+    }
+    std::sort(unused.begin(), unused.end());
+    for (size_t i = 0; i < unused.size() && getGpuBytes() > budget; i++) {
+        destroy(unused[i].second);
+        evictedCount++;
+    }
+
+    // everything left is in use, which is reported once until the memory goes down again
+    if (getGpuBytes() > budget && !isOverBudgetReported) {
+        std::cout << "[MEMORY] " << toMegabytes(getGpuBytes()) << " MB of GPU memory in use, over the budget of "
+            << toMegabytes(budget) << " MB" << std::endl;
+        isOverBudgetReported = true;
+    }
+}
+
+void ResourceManager::destroyAll()
+{
+    for (auto& entry : entries) {
+        if (entry.second.freeResource)
+            entry.second.freeResource();
+    }
+    entries.clear();
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+        byContent[i].clear();
+        categoryGpuBytes[i] = 0;
+        categoryCpuBytes[i] = 0;
+    }
+}
+
+ResourceLocation ResourceManager::getLocation(ResourceHandle handle) const
+{
+    auto found = entries.find(handle);
+    return found != entries.end() ? found->second.location : ResourceLocation();
+}
+
+size_t ResourceManager::getGpuBytes() const
+{
+    size_t bytes = 0;
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+        bytes += categoryGpuBytes[i];
+    return bytes;
+}
+
+size_t ResourceManager::getCpuBytes() const
+{
+    size_t bytes = 0;
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+        bytes += categoryCpuBytes[i];
+    return bytes;
+}
+
+void ResourceManager::writeReport(std::ostream& out) const
+{
+    static const char* const CATEGORY_NAMES[MEMORY_CATEGORY_COUNT] = {
+        "textures", "meshes", "skybox", "shadow maps", "render targets", "collision" };
+    int counts[MEMORY_CATEGORY_COUNT] = {};
+    int unusedCounts[MEMORY_CATEGORY_COUNT] = {};
+    for (const auto& entry : entries) {
+        counts[entry.second.category]++;
+        if (entry.second.refCount == 0)
+            unusedCounts[entry.second.category]++;
+    }
+
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+        out << "[MEMORY] " << CATEGORY_NAMES[i] << ": " << counts[i] << " (" << unusedCounts[i] << " unused), "
+            << toMegabytes(categoryGpuBytes[i]) << " MB GPU, " << toMegabytes(categoryCpuBytes[i]) << " MB CPU" << std::endl;
+    }
+    out << "[MEMORY] total " << toMegabytes(getGpuBytes()) << " MB GPU, " << toMegabytes(getCpuBytes()) << " MB CPU, budget ";
+    if (budget == 0)
+        out << "none";
+    else
+        out << toMegabytes(budget) << " MB";
+    out << "; " << sharedCount << " loads shared a loaded resource, " << evictedCount << " freed for the budget" << std::endl;
+}
+
+std::function<void()> textureDeleter(unsigned int texture)
+{
+    return [texture]() { glDeleteTextures(1, &texture); };
+}
+
+// an estimate, the driver may pad the texels
+size_t textureFormatBytes(GLenum internalFormat)
+{
+    switch (internalFormat) {
+    case GL_DEPTH_COMPONENT16:
+        return 2;
+    case GL_RGBA16F:
+        return 8;
+    case GL_RGBA32F:
+        return 16;
+    default:
+        return 4;
+    }
+}
+
+// rounded to a tenth, for the reports
+double toMegabytes(size_t bytes)
+{
+    return round(bytes / (1024.0 * 1024.0) * 10.0) / 10.0;
+}
+
+// The first range large enough for "count", the rest of it stays free
+bool takeFreeRange(std::map<size_t, size_t>& ranges, size_t count, size_t& offset)
+{
+    if (count == 0)
+        return false;
+    for (auto it = ranges.begin(); it != ranges.end(); ++it) {
+        if (it->second < count)
+            continue;
+        offset = it->first;
+        size_t left = it->second - count;
+        ranges.erase(it);
+        if (left > 0)
+            ranges[offset + count] = left;
+        return true;
+    }
+    return false;
+}
+
+// merged with the free ranges right before and after it
+void addFreeRange(std::map<size_t, size_t>& ranges, size_t offset, size_t count)
+{
+    if (count == 0)
+        return;
+    auto next = ranges.lower_bound(offset);
+    if (next != ranges.end() && offset + count == next->first) {
+        count += next->second;
+        next = ranges.erase(next);
+    }
+    if (next != ranges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            previous->second += count;
+            return;
+        }
+    }
+    ranges[offset] = count;
+}
+
+// the new end when the last free range reaches up to "end", which is then no longer free
+size_t trimFreeTail(std::map<size_t, size_t>& ranges, size_t end)
+{
+    if (ranges.empty())
+        return end;
+    auto last = std::prev(ranges.end());
+    if (last->first + last->second != end)
+        return end;
+    end = last->first;
+    ranges.erase(last);
+    return end;
+}
+
+
+// ---------------------------------
+// frame profiler
+// ---------------------------------
+
+void FrameProfiler::init()
+{
+    glGenQueries(QUERY_LATENCY * PROFILE_PASS_COUNT, &queries[0][0]);
+}
+
+void FrameProfiler::beginFrame()
+{
+    int slot = frame % QUERY_LATENCY;
+    // The slot still holds the frame from QUERY_LATENCY frames ago, its GPU results should be ready by now
+    if (frame >= QUERY_LATENCY)
+        collect(slot);
+
+    pending[slot] = FrameTiming();
+    pending[slot].frame = frame;
+    for (int pass = 0; pass < PROFILE_PASS_COUNT; pass++)
+        isQueryIssued[slot][pass] = false;
+    frameStart = std::chrono::steady_clock::now();
+}
+
+void FrameProfiler::beginPass(ProfilePass pass)
+{
+    int slot = frame % QUERY_LATENCY;
+    passStart[pass] = std::chrono::steady_clock::now();
+    glBeginQuery(GL_TIME_ELAPSED, queries[slot][pass]);
+    isQueryIssued[slot][pass] = true;
+}
+
+void FrameProfiler::endPass(ProfilePass pass)
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    pending[frame % QUERY_LATENCY].cpuMs[pass] = elapsedMs(passStart[pass]);
+}
+
+void FrameProfiler::endFrame()
+{
+    pending[frame % QUERY_LATENCY].frameMs = elapsedMs(frameStart);
+    frame++;
+}
+
+// Wait for the frames still in flight, only used on exit
+void FrameProfiler::finish()
+{
+    glFinish();
+    for (long long f = std::max(frame - QUERY_LATENCY, 0LL); f < frame; f++)
+        collect(f % QUERY_LATENCY);
+}
+
+// Read the GPU results of a slot without waiting and move the frame into the history
+void FrameProfiler::collect(int slot)
+{
+    FrameTiming& timing = pending[slot];
+    for (int pass = 0; pass < PROFILE_PASS_COUNT; pass++) {
+        timing.gpuMs[pass] = -1.0;
+        if (!isQueryIssued[slot][pass])
+            continue;
+
+        GLint isAvailable = 0;
+        glGetQueryObjectiv(queries[slot][pass], GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+        if (isAvailable) {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(queries[slot][pass], GL_QUERY_RESULT, &nanoseconds);
+            timing.gpuMs[pass] = nanoseconds / 1.0e6;
+        }
+        isQueryIssued[slot][pass] = false;
+    }
+    history.push(timing);
+}
+
+void FrameProfiler::recordStartup(const std::string& name, double ms)
+{
+    startupTimings.push_back(std::make_pair(name, ms));
+}
+
+// One bar per pass in the top left corner, the white mark is 16.6 ms (60 fps)
+void FrameProfiler::drawOverlay(int width, int height) const
+{
+    const float colors[PROFILE_PASS_COUNT][3] = {
+        { 0.9f, 0.9f, 0.2f }, { 0.9f, 0.6f, 0.2f }, { 0.9f, 0.3f, 0.2f }, { 0.2f, 0.8f, 0.3f }, { 0.2f, 0.5f, 0.9f }, { 0.7f, 0.4f, 0.9f }
+    };
+    const float pixelsPerMs = 20.0f;
+    const int barHeight = 10;
+
+    double average[PROFILE_PASS_COUNT] = {};
+    size_t count = std::min(history.size(), (size_t)60);
+    for (size_t i = history.size() - count; i < history.size(); i++) {
+        const FrameTiming& timing = history.at(i);
+        for (int pass = 0; pass < PROFILE_PASS_COUNT; pass++)
+            average[pass] += (timing.gpuMs[pass] >= 0.0 ? timing.gpuMs[pass] : timing.cpuMs[pass]) / count;
+    }
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(0, height - (barHeight + 2) * PROFILE_PASS_COUNT - 4, (int)(pixelsPerMs * 34), (barHeight + 2) * PROFILE_PASS_COUNT + 4);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    for (int pass = 0; pass < PROFILE_PASS_COUNT; pass++) {
+        int y = height - (barHeight + 2) * (pass + 1) - 2;
+        int barWidth = std::min((int)(average[pass] * pixelsPerMs), width);
+        if (barWidth > 0) {
+            glScissor(2, y, barWidth, barHeight);
+            glClearColor(colors[pass][0], colors[pass][1], colors[pass][2], 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+    }
+    glScissor((int)(pixelsPerMs * 16.6f), height - (barHeight + 2) * PROFILE_PASS_COUNT - 4, 1, (barHeight + 2) * PROFILE_PASS_COUNT + 4);
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+}
+
+// Average frame time and GPU (or CPU) time of every pass over the last frames
+std::string FrameProfiler::summary(size_t frames) const
+{
+    size_t count = std::min(history.size(), frames);
+    if (count == 0)
+        return "";
+
+    double frameMs = 0.0;
+    double passMs[PROFILE_PASS_COUNT] = {};
+    for (size_t i = history.size() - count; i < history.size(); i++) {
+        const FrameTiming& timing = history.at(i);
+        frameMs += timing.frameMs / count;
+        for (int pass = 0; pass < PROFILE_PASS_COUNT; pass++)
+            passMs[pass] += (timing.gpuMs[pass] >= 0.0 ? timing.gpuMs[pass] : timing.cpuMs[pass]) / count;
+    }
+
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "frame %.2f ms", frameMs);
+    std::string text = buffer;
+    for (int pass = 0; pass < PROFILE_PASS_COUNT; pass++) {
+        snprintf(buffer, sizeof(buffer), " | %s %.2f", PROFILE_PASS_NAMES[pass], passMs[pass]);
+        text += buffer;
+    }
+    return text;
+}
+
+bool FrameProfiler::writeCsv(const std::string& path) const
+{
+    std::ofstream file(path);
+    if (!file) {
+        std::cout << "Failed to write profile: " << path << std::endl;
+        return false;
+    }
+
+    file << "frame,frame_ms";
+    for (int pass = 0; pass < PROFILE_PASS_COUNT; pass++)
+        file << "," << PROFILE_PASS_NAMES[pass] << "_cpu_ms," << PROFILE_PASS_NAMES[pass] << "_gpu_ms";
+    file << "\n";
+
+    for (size_t i = 0; i < history.size(); i++) {
+        const FrameTiming& timing = history.at(i);
+        file << timing.frame << "," << timing.frameMs;
+        for (int pass = 0; pass < PROFILE_PASS_COUNT; pass++)
+            file << "," << timing.cpuMs[pass] << "," << timing.gpuMs[pass];
+        file << "\n";
+    }
+    return true;
+}
+
+bool FrameProfiler::writeJson(const std::string& path) const
+{
+    std::ofstream file(path);
+    if (!file) {
+        std::cout << "Failed to write profile: " << path << std::endl;
+        return false;
+    }
+
+    file << "{\n  \"startup_ms\": {";
+    for (size_t i = 0; i < startupTimings.size(); i++)
+        file << (i ? ", " : "") << "\"" << startupTimings[i].first << "\": " << startupTimings[i].second;
+    file << "},\n  \"frames\": [\n";
+
+    for (size_t i = 0; i < history.size(); i++) {
+        const FrameTiming& timing = history.at(i);
+        file << "    { \"frame\": " << timing.frame << ", \"frame_ms\": " << timing.frameMs;
+        for (int pass = 0; pass < PROFILE_PASS_COUNT; pass++) {
+            file << ", \"" << PROFILE_PASS_NAMES[pass] << "\": { \"cpu_ms\": " << timing.cpuMs[pass]
+                << ", \"gpu_ms\": " << timing.gpuMs[pass] << " }";
+        }
+        file << " }" << (i + 1 < history.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    return true;
+}
+
+// JSON report of the frames from firstFrame on: frame time percentiles and the breakdown per pass
+void FrameProfiler::writeBenchmark(std::ostream& out, long long firstFrame) const
+{
+    auto writeSummary = [&out](const TimingSummary& summary) {
+        out << "{ \"avg\": " << summary.average << ", \"p50\": " << summary.p50 << ", \"p95\": " << summary.p95
+            << ", \"p99\": " << summary.p99 << ", \"max\": " << summary.max << " }";
+    };
+
+    std::vector<double> frameMs;
+    std::vector<double> cpuMs[PROFILE_PASS_COUNT];
+    std::vector<double> gpuMs[PROFILE_PASS_COUNT];
+    for (size_t i = 0; i < history.size(); i++) {
+        const FrameTiming& timing = history.at(i);
+        if (timing.frame < firstFrame)
+            continue;
+        frameMs.push_back(timing.frameMs);
+        for (int pass = 0; pass < PROFILE_PASS_COUNT; pass++) {
+            cpuMs[pass].push_back(timing.cpuMs[pass]);
+            if (timing.gpuMs[pass] >= 0.0)
+                gpuMs[pass].push_back(timing.gpuMs[pass]);
+        }
+    }
+
+    const char* renderer = (const char*)glGetString(GL_RENDERER);
+    out << "{\n  \"renderer\": \"" << (renderer ? renderer : "") << "\",\n  \"frames\": " << frameMs.size()
+        << ",\n  \"frame_ms\": ";
+    writeSummary(summarizeTimings(frameMs));
+    out << ",\n  \"passes\": {\n";
+    for (int pass = 0; pass < PROFILE_PASS_COUNT; pass++) {
+        out << "    \"" << PROFILE_PASS_NAMES[pass] << "\": { \"cpu_ms\": ";
+        writeSummary(summarizeTimings(cpuMs[pass]));
+        out << ", \"gpu_ms\": ";
+        writeSummary(summarizeTimings(gpuMs[pass]));
+        out << " }" << (pass + 1 < PROFILE_PASS_COUNT ? "," : "") << "\n";
+    }
+    out << "  }\n}" << std::endl;
+}
+
+// ---------------------------------
+// keyboard/mouse monitor
+// ---------------------------------
+
+// Sample the keys of this frame, the simulation applies them on its own ticks
+SimInput handleKeyInput(GLFWwindow* window)
+{
+    // esc exit
+    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, true);
+
+    const struct { int glfwKey; SimInputKey inputKey; } keyMap[] = {
+        // Camera WSAD front, back, left and right Space up and left Ctrl down
+        { GLFW_KEY_W, INPUT_CAMERA_FORWARD },
+        { GLFW_KEY_S, INPUT_CAMERA_BACKWARD },
+        { GLFW_KEY_A, INPUT_CAMERA_LEFT },
+        { GLFW_KEY_D, INPUT_CAMERA_RIGHT },
+        { GLFW_KEY_SPACE, INPUT_CAMERA_UP },
+        { GLFW_KEY_LEFT_CONTROL, INPUT_CAMERA_DOWN },
+        // cart move
+        { GLFW_KEY_UP, INPUT_CAR_FORWARD },
+        { GLFW_KEY_DOWN, INPUT_CAR_BACKWARD },
+        { GLFW_KEY_LEFT, INPUT_CAR_LEFT },
+        { GLFW_KEY_RIGHT, INPUT_CAR_RIGHT }
+    };
+
+    SimInput input;
+    for (const auto& entry : keyMap) {
+        if (glfwGetKey(window, entry.glfwKey) == GLFW_PRESS)
+            input.keys |= entry.inputKey;
+    }
+    return input;
+}
+
+// Apply the sampled keys to the camera and the car
+void applySimInput(const SimInput& input, float deltaTime)
+{
+    if (!isCameraFixed) {
+
+        // Camera WSAD front, back, left and right Space up and left Ctrl down
+        if (input.isDown(INPUT_CAMERA_FORWARD))
+            camera.ProcessKeyboard(FORWARD, deltaTime);
+        if (input.isDown(INPUT_CAMERA_BACKWARD))
+            camera.ProcessKeyboard(BACKWARD, deltaTime);
+        if (input.isDown(INPUT_CAMERA_LEFT))
+            camera.ProcessKeyboard(LEFT, deltaTime);
+        if (input.isDown(INPUT_CAMERA_RIGHT))
+            camera.ProcessKeyboard(RIGHT, deltaTime);
+        if (input.isDown(INPUT_CAMERA_UP))
+            camera.ProcessKeyboard(UP, deltaTime);
+        if (input.isDown(INPUT_CAMERA_DOWN))
+            camera.ProcessKeyboard(DOWN, deltaTime);
+    }
+    else {
+        if (input.isDown(INPUT_CAMERA_LEFT))
+            fixedCamera.ProcessKeyboard(CAMERA_LEFT, deltaTime);
+        if (input.isDown(INPUT_CAMERA_RIGHT))
+            fixedCamera.ProcessKeyboard(CAMERA_RIGHT, deltaTime);
+    }
+
+    // cart move; a move into a wall of the track is undone
+    Car carBeforeMove = car;
+    if (input.isDown(INPUT_CAR_FORWARD)) {
+        car.ProcessKeyboard(CAR_FORWARD, deltaTime);
+
+        // You can only rotate left and right when the car is moving
+        if (input.isDown(INPUT_CAR_LEFT))
+            car.ProcessKeyboard(CAR_LEFT, deltaTime);
+        if (input.isDown(INPUT_CAR_RIGHT))
+            car.ProcessKeyboard(CAR_RIGHT, deltaTime);
+
+        if (isCameraFixed)
+            camera.ZoomOut();
+    }
+    if (input.isDown(INPUT_CAR_BACKWARD)) {
+        car.ProcessKeyboard(CAR_BACKWARD, deltaTime);
+
+
+        // You can only rotate left and right when the car is moving, functions same as above
+        if (input.isDown(INPUT_CAR_LEFT))
+            car.ProcessKeyboard(CAR_LEFT, deltaTime);
+        if (input.isDown(INPUT_CAR_RIGHT))
+            car.ProcessKeyboard(CAR_RIGHT, deltaTime);
+
+        if (isCameraFixed)
+            camera.ZoomIn();
+    }
+    // the car moves on a plane, the walls are tested at the height it is shown at
+    glm::vec3 from = carBeforeMove.getPosition();
+    from.y = currentCarState.midValPosition.y;
+    if (trackCollision.sweepCar(from, car.getPosition(), nullptr))
+        car = carBeforeMove;
+}
+
+
+// key callback function, so that only one event is triggered per key press
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    // Switching the camera changes the simulation, it is applied (and recorded) on the next tick
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        queueInputEvent(INPUT_EVENT_TOGGLE_CAMERA, 0.0f, 0.0f);
+    }
+    if (key == GLFW_KEY_X && action == GLFW_PRESS) {
+        isPolygonMode = !isPolygonMode;
+        if (isPolygonMode) {
+            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        }
+        else {
+            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        }
+        string info = isPolygonMode ? "ÇÐ»»ÎªÏß¿òÍ¼äÖÈ¾Ä£Ê½" : "ÇÐ»»ÎªÕý³£äÖÈ¾Ä£Ê½";
+        std::cout << "[POLYGON_MODE]" << info << std::endl;
+    }
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        isProfilerOverlay = !isProfilerOverlay;
+    }
+    // switches to the main shader without shadows and skips the shadow pass
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        isShadowEnabled = !isShadowEnabled;
+        if (!selectMainShader()) {
+            isShadowEnabled = !isShadowEnabled;
+            selectMainShader();
+        }
+        std::cout << "[SHADOWS]" << (isShadowEnabled ? "on" : "off") << std::endl;
+    }
+}
+
+// mouse movement
+void mouse_callback(GLFWwindow* window, double xpos, double ypos)
+{
+    if (!isViewCameraFixed) {
+        if (firstMouse) {
+            lastX = xpos;
+            lastY = ypos;
+            firstMouse = false;
+        }
+
+        float xoffset = xpos - lastX;
+        float yoffset = lastY - ypos; // Coordinates are flipped to correspond to the coordinate system
+
+        lastX = xpos;
+        lastY = ypos;
+
+        queueInputEvent(INPUT_EVENT_MOUSE, xoffset, yoffset);
+    }
+}
+
+// mouse wheel
+void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+{
+    queueInputEvent(INPUT_EVENT_SCROLL, 0.0f, (float)yoffset);
+}
+
+// ---------------------------------
+// window related functions
+// ---------------------------------
+
+// Callback function for resizing the window
+void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+{
+    // The next frame renders and sets its projection for the new window size; 0x0 while it is minimized
+    windowWidth = width;
+    windowHeight = height;
+}
+
+
+// ---------------------------------
+// load related functions
+// ---------------------------------
+
+void ThreadPool::start(unsigned int threadCount)
+{
+    stopping = false;
+    for (unsigned int i = 0; i < threadCount; i++)
+        threads.emplace_back(&ThreadPool::run, this);
+}
+
+void ThreadPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        jobs.clear();
+    }
+    condition.notify_all();
+    for (std::thread& thread : threads)
+        thread.join();
+    threads.clear();
+}
+
+void ThreadPool::submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    condition.notify_one();
+}
+
+void ThreadPool::run()
+{
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping)
+                return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+// Called on the GL thread, which owns the pixel buffer
+void AssetLoader::start(unsigned int threadCount)
+{
+    glGenBuffers(1, &pixelBuffer);
+    stopping = false;
+    pool.start(threadCount);
+}
+
+// Workers waiting for room in the queue give up, and the decoded assets are dropped
+void AssetLoader::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(uploadMutex);
+        stopping = true;
+        uploads.clear();
+    }
+    uploadNotFull.notify_all();
+    pool.stop();
+}
+
+void AssetLoader::loadModel(CachedModel& model, const std::string& path)
+{
+    outstanding++;
+    auto requested = std::chrono::steady_clock::now();
+    pool.submit([this, &model, path, requested]() {
+        AssetUpload upload;
+        upload.type = ASSET_UPLOAD_MODEL;
+        upload.name = path.substr(path.find_last_of("/\\") + 1);
+        upload.requested = requested;
+        upload.model = &model;
+        upload.directory = path.substr(0, path.find_last_of("/\\"));
+        upload.isDecoded = readModel(path, upload);
+        push(std::move(upload));
+    });
+}
+
+void AssetLoader::loadTrackTile(CachedModel& model, const TrackTileEntry& tile, const unsigned char* compressed, const std::string& directory)
+{
+    outstanding++;
+    auto requested = std::chrono::steady_clock::now();
+    pool.submit([this, &model, tile, compressed, directory, requested]() {
+        AssetUpload upload;
+        upload.type = ASSET_UPLOAD_MODEL;
+        upload.name = "track tile";
+        upload.requested = requested;
+        upload.model = &model;
+        upload.directory = directory;
+        upload.isStreamed = true;
+        upload.header = tile.header;
+        upload.sections.resize(tile.size);
+        upload.isDecoded = lzDecompress(compressed, tile.compressedSize, upload.sections.data(), tile.size)
+            && isModelCacheValid(tile.header, upload.sections.data(), sizeof(ModelCacheHeader) + tile.size);
+        push(std::move(upload));
+    });
+}
+
+void AssetLoader::loadCubemap(const std::vector<std::string>& faces)
+{
+    cubemapRequested = std::chrono::steady_clock::now();
+    cubemapFacesLeft = (int)faces.size();
+    for (size_t i = 0; i < faces.size(); i++) {
+        outstanding++;
+        std::string path = faces[i];
+        pool.submit([this, path, i]() {
+            AssetUpload upload;
+            upload.type = ASSET_UPLOAD_CUBEMAP_FACE;
+            upload.name = path;
+            upload.face = (int)i;
+            upload.isDecoded = decodeImage(path, upload);
+            push(std::move(upload));
+        });
+    }
+}
+
+void AssetLoader::requestTexture(const std::string& path, unsigned int firstVertex, unsigned int vertexCount)
+{
+    auto found = textures.find(path);
+    if (found != textures.end()) {
+        found->second.users++;
+        if (found->second.layer != 0)
+            geometryArena.setLayer(firstVertex, vertexCount, found->second.layer);
+        else
+            found->second.waitingVertices.push_back(std::make_pair(firstVertex, vertexCount));
+        return;
+    }
+
+    // The vertices start with the placeholder layer, which is what the arena gives new vertices
+    TextureSlot& slot = textures[path];
+    slot.users = 1;
+    slot.waitingVertices.push_back(std::make_pair(firstVertex, vertexCount));
+
+    outstanding++;
+    pool.submit([this, path]() {
+        AssetUpload upload;
+        upload.type = ASSET_UPLOAD_TEXTURE;
+        upload.name = path;
+        upload.isDecoded = decodeTextureLayer(path, upload);
+        push(std::move(upload));
+    });
+}
+
+void AssetLoader::push(AssetUpload&& upload)
+{
+    std::unique_lock<std::mutex> lock(uploadMutex);
+    uploadNotFull.wait(lock, [this] { return stopping || uploads.size() < UPLOAD_QUEUE_CAPACITY; });
+    if (stopping)
+        return;
+    uploads.push_back(std::move(upload));
+    uploadNotEmpty.notify_one();
+}
+
+void AssetLoader::update(double budgetMs)
+{
+    auto start = std::chrono::steady_clock::now();
+    do {
+        AssetUpload upload;
+        {
+            std::lock_guard<std::mutex> lock(uploadMutex);
+            if (uploads.empty())
+                break;
+            upload = std::move(uploads.front());
+            uploads.pop_front();
+        }
+        uploadNotFull.notify_one();
+
+        finishUpload(upload);
+        // a model requests its textures before it stops being outstanding, so zero means everything is there
+        outstanding--;
+    } while (elapsedMs(start) < budgetMs);
+
+    if (!isStartupRecorded && outstanding == 0) {
+        profiler.recordStartup("all assets", elapsedMs(sessionStart));
+        isStartupRecorded = true;
+    }
+}
+
+// Without requests the layer stays in the array until the resource manager needs its memory
+void AssetLoader::releaseTexture(const std::string& path, unsigned int firstVertex, unsigned int vertexCount)
+{
+    auto found = textures.find(path);
+    if (found == textures.end())
+        return;
+    std::vector<std::pair<unsigned int, unsigned int>>& waiting = found->second.waitingVertices;
+    auto vertices = std::find(waiting.begin(), waiting.end(), std::make_pair(firstVertex, vertexCount));
+    if (vertices != waiting.end())
+        waiting.erase(vertices);
+    if (--found->second.users > 0)
+        return;
+    if (found->second.resource != 0)
+        gpuResources.release(found->second.resource);
+    textures.erase(found);
+}
+
+void AssetLoader::finishAll()
+{
+    while (outstanding > 0) {
+        {
+            std::unique_lock<std::mutex> lock(uploadMutex);
+            uploadNotEmpty.wait(lock, [this] { return !uploads.empty(); });
+        }
+        update(1e9);
+    }
+}
+
+void AssetLoader::finishUpload(AssetUpload& upload)
+{
+    switch (upload.type) {
+    case ASSET_UPLOAD_MODEL:
+        if (!upload.isDecoded) {
+            upload.model->fail();
+            break;
+        }
+        upload.model->upload(upload.header, upload.getSections(), upload.directory);
+        if (!upload.isStreamed)
+            profiler.recordStartup(upload.name + (upload.isConverted ? " (converted)" : ""), elapsedMs(upload.requested));
+        // the static shadow layers were rendered without this model; a track tile only reaches into some of them
+        if (upload.isStreamed)
+            invalidateStaticShadows(upload.model->getBoundsMin(), upload.model->getBoundsMax());
+        else
+            invalidateStaticShadows();
+        break;
+
+    case ASSET_UPLOAD_TEXTURE:
+        if (!upload.isDecoded) {
+            std::cout << "Texture failed to load at path: " << upload.name << std::endl;
+            break;
+        }
+        {
+            // released while it decoded, or requested again after that and uploaded by the first request
+            auto found = textures.find(upload.name);
+            if (found == textures.end() || found->second.resource != 0)
+                break;
+            TextureSlot& slot = found->second;
+            // the same image under another path shares its layer
+            slot.resource = gpuResources.acquire(MEMORY_TEXTURE, upload.contentHash);
+            if (slot.resource != 0) {
+                slot.layer = (unsigned short)gpuResources.getLocation(slot.resource).first;
+            }
+            else {
+                unsigned int layer = textureArray.addLayer();
+                uploadPixels(GL_TEXTURE_2D_ARRAY, upload, layer);
+                textureArray.generateMipmaps();
+                ResourceLocation location;
+                location.first = layer;
+                slot.resource = gpuResources.create(upload.name, MEMORY_TEXTURE, upload.contentHash, TEXTURE_LAYER_BYTES, 0,
+                    [layer]() { textureArray.freeLayer(layer); }, location);
+                slot.layer = (unsigned short)layer;
+            }
+            for (const auto& vertices : slot.waitingVertices)
+                geometryArena.setLayer(vertices.first, vertices.second, slot.layer);
+            slot.waitingVertices.clear();
+        }
+        break;
+
+    case ASSET_UPLOAD_CUBEMAP_FACE:
+        if (!upload.isDecoded)
+            std::cout << "Cubemap texture failed to load at path: " << upload.name << std::endl;
+
+        // The faces go into a new texture, which replaces the placeholder once it is complete
+        if (cubemapLoading == 0) {
+            glGenTextures(1, &cubemapLoading);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapLoading);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        }
+        if (upload.isDecoded) {
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapLoading);
+            uploadPixels(GL_TEXTURE_CUBE_MAP_POSITIVE_X + upload.face, upload);
+            // drivers keep RGB textures as RGBA
+            cubemapBytes += (size_t)upload.width * upload.height * 4;
+        }
+        if (--cubemapFacesLeft == 0) {
+            gpuResources.destroy(cubemapResource);
+            cubemapTexture = cubemapLoading;
+            cubemapResource = gpuResources.create("skybox", MEMORY_SKYBOX, 0, cubemapBytes, 0, textureDeleter(cubemapTexture));
+            cubemapLoading = 0;
+            cubemapBytes = 0;
+            profiler.recordStartup("skybox", elapsedMs(cubemapRequested));
+        }
+        break;
+    }
+}
+
+// The pixels are copied into the pixel buffer, and the texture is specified from there, so the driver
+// transfers them asynchronously instead of copying them again from client memory.
+// An array texture gets the pixels in the layer, which has the size of the image
+void AssetLoader::uploadPixels(GLenum target, const AssetUpload& upload, unsigned int layer)
+{
+    GLenum format = GL_RGB;
+    if (upload.channels == 1)
+        format = GL_RED;
+    else if (upload.channels == 2)
+        format = GL_RG;
+    else if (upload.channels == 4)
+        format = GL_RGBA;
+    size_t size = (size_t)upload.width * upload.height * upload.channels;
+    auto specify = [&](const void* pixels) {
+        if (target == GL_TEXTURE_2D_ARRAY)
+            glTexSubImage3D(target, 0, 0, 0, layer, upload.width, upload.height, 1, format, GL_UNSIGNED_BYTE, pixels);
+        else
+            glTexImage2D(target, 0, format, upload.width, upload.height, 0, format, GL_UNSIGNED_BYTE, pixels);
+    };
+
+    // rows of RGB images are not padded to four bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+    // new storage, so that the previous upload does not have to finish first
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped != nullptr) {
+        memcpy(mapped, upload.getPixels(), size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        specify((void*)0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    else {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        specify(upload.getPixels());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Runs on a worker
+bool decodeImage(const std::string& path, AssetUpload& upload)
+{
+    upload.pixels.reset(stbi_load(path.c_str(), &upload.width, &upload.height, &upload.channels, 0));
+    return upload.pixels != nullptr;
+}
+
+// Runs on a worker: RGBA, scaled to the size of a layer of the texture array
+bool decodeTextureLayer(const std::string& path, AssetUpload& upload)
+{
+    int width, height, channels;
+    std::unique_ptr<unsigned char, StbiDeleter> pixels(stbi_load(path.c_str(), &width, &height, &channels, 4));
+    if (pixels == nullptr)
+        return false;
+
+    upload.scaledPixels = scaleImage(pixels.get(), width, height, TEXTURE_LAYER_SIZE);
+    upload.contentHash = hashBytes(upload.scaledPixels.data(), upload.scaledPixels.size());
+    upload.width = TEXTURE_LAYER_SIZE;
+    upload.height = TEXTURE_LAYER_SIZE;
+    upload.channels = 4;
+    return true;
+}
+
+// Scale an RGBA image to size x size. Each side is halved with a box filter while it is at least twice the size,
+// the rest is sampled bilinearly
+std::vector<unsigned char> scaleImage(const unsigned char* pixels, int width, int height, int size)
+{
+    std::vector<unsigned char> image(pixels, pixels + (size_t)width * height * 4);
+    while (width >= 2 * size || height >= 2 * size) {
+        int stepX = width >= 2 * size ? 2 : 1;
+        int stepY = height >= 2 * size ? 2 : 1;
+        int halfWidth = width / stepX;
+        int halfHeight = height / stepY;
+        std::vector<unsigned char> half((size_t)halfWidth * halfHeight * 4);
+        for (int y = 0; y < halfHeight; y++) {
+            for (int x = 0; x < halfWidth; x++) {
+                for (int c = 0; c < 4; c++) {
+                    int sum = 0;
+                    for (int dy = 0; dy < stepY; dy++)
+                        for (int dx = 0; dx < stepX; dx++)
+                            sum += image[(((size_t)y * stepY + dy) * width + x * stepX + dx) * 4 + c];
+                    half[((size_t)y * halfWidth + x) * 4 + c] = (unsigned char)((sum + stepX * stepY / 2) / (stepX * stepY));
+                }
+            }
+        }
+        image.swap(half);
+        width = halfWidth;
+        height = halfHeight;
+    }
+    if (width == size && height == size)
+        return image;
+
+    std::vector<unsigned char> result((size_t)size * size * 4);
+    for (int y = 0; y < size; y++) {
+        float sourceY = glm::clamp((y + 0.5f) * height / size - 0.5f, 0.0f, (float)(height - 1));
+        int y0 = (int)sourceY;
+        int y1 = std::min(y0 + 1, height - 1);
+        float ty = sourceY - y0;
+        for (int x = 0; x < size; x++) {
+            float sourceX = glm::clamp((x + 0.5f) * width / size - 0.5f, 0.0f, (float)(width - 1));
+            int x0 = (int)sourceX;
+            int x1 = std::min(x0 + 1, width - 1);
+            float tx = sourceX - x0;
+            for (int c = 0; c < 4; c++) {
+                float top = glm::mix((float)image[((size_t)y0 * width + x0) * 4 + c], (float)image[((size_t)y0 * width + x1) * 4 + c], tx);
+                float bottom = glm::mix((float)image[((size_t)y1 * width + x0) * 4 + c], (float)image[((size_t)y1 * width + x1) * 4 + c], tx);
+                result[((size_t)y * size + x) * 4 + c] = (unsigned char)(glm::mix(top, bottom, ty) + 0.5f);
+            }
+        }
+    }
+    return result;
+}
+
+// 1x1 texture of a single color, with the sampling parameters of the texture it stands in for
+unsigned int createPlaceholderTexture(GLenum target, const unsigned char color[3])
+{
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(target, texture);
+    if (target == GL_TEXTURE_CUBE_MAP) {
+        for (unsigned int i = 0; i < 6; i++)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, color);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    }
+    else {
+        glTexImage2D(target, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, color);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    }
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return texture;
+}
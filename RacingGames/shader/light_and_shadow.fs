@@ -0,0 +1,164 @@
+#version 330 core
+#ifdef DEPTH_ONLY
+// the shadow passes only write depth
+void main()
+{
+}
+#else
+out vec4 FragColor;
+
+in VS_OUT {
+    vec3 FragPos;
+    vec3 Normal;
+    vec2 TexCoords;
+    flat uint Layer;
+} fs_in;
+
+// per-frame constants, the std140 layout of FrameConstants in main.cpp
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    mat4 skyboxView;
+    mat4 lightSpaceMatrices[4];
+    vec4 cascadePlaneDistances;
+    vec4 viewPos;
+    vec4 lightDirection;
+    vec4 clusterScale;
+};
+
+uniform sampler2DArray diffuseTexture;
+
+#ifndef NO_SHADOWS
+uniform sampler2D shadowMaps[CASCADE_COUNT];
+uniform int cascadeCount;
+
+// Share of the fragment in the shadow of one cascade, filtered over SHADOW_FILTER_SIZE x SHADOW_FILTER_SIZE texels
+float filterShadow(sampler2D shadowMap, vec3 projCoords, float bias)
+{
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0));
+    float shadow = 0.0;
+    for (int x = -SHADOW_FILTER_SIZE / 2; x <= SHADOW_FILTER_SIZE / 2; ++x) {
+        for (int y = -SHADOW_FILTER_SIZE / 2; y <= SHADOW_FILTER_SIZE / 2; ++y) {
+            float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
+            shadow += projCoords.z - bias > pcfDepth ? 1.0 : 0.0;
+        }
+    }
+    return shadow / float(SHADOW_FILTER_SIZE * SHADOW_FILTER_SIZE);
+}
+
+// The cascade is the first one whose far distance lies beyond the view space depth of the fragment
+float shadowCalculation(vec3 normal, vec3 lightDir)
+{
+    float depth = abs((view * vec4(fs_in.FragPos, 1.0)).z);
+    int cascade = cascadeCount - 1;
+    for (int i = 0; i < cascadeCount; ++i) {
+        if (depth < cascadePlaneDistances[i]) {
+            cascade = i;
+            break;
+        }
+    }
+
+    vec4 fragPosLightSpace = lightSpaceMatrices[cascade] * vec4(fs_in.FragPos, 1.0);
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+    // beyond the far plane of the light there is no shadow
+    if (projCoords.z > 1.0)
+        return 0.0;
+
+    // the farther cascades cover more world per texel and need a larger bias
+    float bias = max(0.005 * (1.0 - dot(normal, lightDir)), 0.0005) * (1.0 + float(cascade));
+
+    // samplers in an array can only be indexed with a constant
+    if (cascade == 0)
+        return filterShadow(shadowMaps[0], projCoords, bias);
+#if CASCADE_COUNT > 1
+    if (cascade == 1)
+        return filterShadow(shadowMaps[1], projCoords, bias);
+#endif
+#if CASCADE_COUNT > 2
+    if (cascade == 2)
+        return filterShadow(shadowMaps[2], projCoords, bias);
+#endif
+#if CASCADE_COUNT > 3
+    if (cascade == 3)
+        return filterShadow(shadowMaps[3], projCoords, bias);
+#endif
+    return 0.0;
+}
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+// three texels per light: (position, range), (color, spotCosOuter), (direction, spotCosInner)
+uniform samplerBuffer lightData;
+// offset and count of the light list of each cluster, at (z * CLUSTER_COUNT_Y + y) * CLUSTER_COUNT_X + x
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLights;
+
+// The point and spot lights binned into the cluster of the fragment, without shadows
+vec3 clusteredLights(vec3 normal, vec3 viewDir, vec3 color)
+{
+    float depth = abs((view * vec4(fs_in.FragPos, 1.0)).z);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy * clusterScale.xy), ivec2(0), ivec2(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1));
+    int slice = clamp(int(floor(log(max(depth, 1e-4)) * clusterScale.z + clusterScale.w)), 0, CLUSTER_COUNT_Z - 1);
+    uvec2 list = texelFetch(clusterGrid, (slice * CLUSTER_COUNT_Y + tile.y) * CLUSTER_COUNT_X + tile.x).rg;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < list.y; ++i) {
+        int light = int(texelFetch(clusterLights, int(list.x + i)).r) * 3;
+        vec4 positionRange = texelFetch(lightData, light);
+        vec4 colorOuter = texelFetch(lightData, light + 1);
+        vec4 directionInner = texelFetch(lightData, light + 2);
+
+        vec3 toLight = positionRange.xyz - fs_in.FragPos;
+        float lightDistance = length(toLight);
+        if (lightDistance >= positionRange.w)
+            continue;
+        vec3 lightDir = toLight / max(lightDistance, 1e-4);
+        // fades to nothing at the range of the light
+        float attenuation = 1.0 - lightDistance / positionRange.w;
+        attenuation *= attenuation;
+        // a point light has spotCosOuter -1, which lets the cone cover everything
+        if (colorOuter.w > -1.0)
+            attenuation *= smoothstep(colorOuter.w, directionInner.w, dot(-lightDir, directionInner.xyz));
+
+        float diff = max(dot(lightDir, normal), 0.0);
+        float spec = pow(max(dot(normal, normalize(lightDir + viewDir)), 0.0), 64.0);
+        result += (diff * color + spec) * colorOuter.rgb * attenuation;
+    }
+    return result;
+}
+#endif
+
+void main()
+{
+    vec4 texColor = texture(diffuseTexture, vec3(fs_in.TexCoords, float(fs_in.Layer)));
+    if (texColor.a < 0.1)
+        discard;
+    vec3 color = texColor.rgb;
+    vec3 normal = normalize(fs_in.Normal);
+    vec3 lightColor = vec3(0.8);
+    // ambient
+    vec3 ambient = 0.3 * lightColor;
+    // diffuse, the light direction points towards the sun
+    vec3 lightDir = normalize(lightDirection.xyz);
+    float diff = max(dot(lightDir, normal), 0.0);
+    vec3 diffuse = diff * lightColor;
+    // specular
+    vec3 viewDir = normalize(viewPos.xyz - fs_in.FragPos);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), 64.0);
+    vec3 specular = spec * lightColor;
+    // calculate shadow
+#ifdef NO_SHADOWS
+    float shadow = 0.0;
+#else
+    float shadow = shadowCalculation(normal, lightDir);
+#endif
+    vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * color;
+#ifdef CLUSTERED_LIGHTS
+    lighting += clusteredLights(normal, viewDir, color);
+#endif
+
+    FragColor = vec4(lighting, 1.0);
+}
+#endif
@@ -0,0 +1,47 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// layer of the diffuse texture in the texture array
+layout (location = 3) in uint aLayer;
+// model matrix from the instance buffer, locations 7 to 10
+layout (location = 7) in mat4 instanceModel;
+
+// per-frame constants, the std140 layout of FrameConstants in main.cpp
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    mat4 skyboxView;
+    mat4 lightSpaceMatrices[4];
+    vec4 cascadePlaneDistances;
+    vec4 viewPos;
+    vec4 lightDirection;
+    vec4 clusterScale;
+};
+
+#ifdef DEPTH_ONLY
+// the light space matrix of the cascade or of the static layer being rendered
+uniform mat4 lightSpaceMatrix;
+#endif
+
+out VS_OUT {
+    vec3 FragPos;
+    vec3 Normal;
+    vec2 TexCoords;
+    flat uint Layer;
+} vs_out;
+
+void main()
+{
+    vec4 worldPos = instanceModel * vec4(aPos, 1.0);
+#ifdef DEPTH_ONLY
+    gl_Position = lightSpaceMatrix * worldPos;
+#else
+    vs_out.FragPos = worldPos.xyz;
+    vs_out.Normal = mat3(transpose(inverse(instanceModel))) * aNormal;
+    vs_out.TexCoords = aTexCoords;
+    vs_out.Layer = aLayer;
+    gl_Position = projection * view * worldPos;
+#endif
+}
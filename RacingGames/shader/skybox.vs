@@ -0,0 +1,25 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+// per-frame constants, the std140 layout of FrameConstants in main.cpp
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    mat4 skyboxView;
+    mat4 lightSpaceMatrices[4];
+    vec4 cascadePlaneDistances;
+    vec4 viewPos;
+    vec4 lightDirection;
+    vec4 clusterScale;
+};
+
+out vec3 TexCoords;
+
+void main()
+{
+    TexCoords = aPos;
+    vec4 pos = projection * skyboxView * vec4(aPos, 1.0);
+    // the depth of the skybox is always 1.0, behind everything drawn before it
+    gl_Position = pos.xyww;
+}